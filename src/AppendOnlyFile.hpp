@@ -0,0 +1,392 @@
+#ifndef APPENDONLYFILE_HPP
+#define APPENDONLYFILE_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utility.hpp"
+
+/*
+  Append only file : every write command is logged in RESP form (an array of bulk strings) and replayed on startup.
+  Commands are group committed : append() only serializes into a buffer, flush() is called once per event loop
+  iteration and hands everything logged during that iteration to a single write() (and a single fsync with
+  appendfsync always). With appendfsync everysec a background thread fsyncs once per second, so the event loop never
+  waits for the disk; writes are postponed (up to max_postpone_ms) while that fsync is still running, since a write
+  to a file being fsync'ed can block.
+  A rewrite replaces the file by a compact one : an rdb snapshot of the dataset (the preamble, written by a forked
+  child) followed by the commands logged while the snapshot was being written, which are kept in rewrite_buffer.
+*/
+class AppendOnlyFile {
+public:
+    enum class FsyncPolicy { Always, Everysec, No };
+
+    static int parse_fsync_policy(const std::string& str, FsyncPolicy& policy) {
+        if (utility::compareCaseInsensitive("always", str))
+            policy = FsyncPolicy::Always;
+        else if (utility::compareCaseInsensitive("everysec", str))
+            policy = FsyncPolicy::Everysec;
+        else if (utility::compareCaseInsensitive("no", str))
+            policy = FsyncPolicy::No;
+        else
+            return -1;
+        return 0;
+    }
+
+    AppendOnlyFile() = default;
+    AppendOnlyFile(const AppendOnlyFile&) = delete;
+    AppendOnlyFile& operator=(const AppendOnlyFile&) = delete;
+
+    ~AppendOnlyFile() {
+        close();
+    }
+
+    // true if filename starts with an rdb snapshot, the commands following it are loaded with start_offset set to
+    // the end of the rdb data
+    static bool has_rdb_preamble(const std::string& filename) {
+        int file_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_fd < 0)
+            return false;
+        char magic[5];
+        bool is_rdb = (sizeof(magic) == read(file_fd, magic, sizeof(magic))) && (0 == memcmp(magic, "REDIS", sizeof(magic)));
+        ::close(file_fd);
+        return is_rdb;
+    }
+
+    // calls on_command(std::vector<std::string>&&) for every command logged in filename after start_offset. A last
+    // command cut short (crash in the middle of a write) is dropped and truncated off the file; returns 0 on success,
+    // 1 if the file cannot be read or is corrupt
+    template <typename OnCommand>
+    static int load(const std::string& filename, OnCommand&& on_command, uint64_t& num_commands, uint64_t start_offset = 0) {
+        num_commands = 0;
+        std::string content;
+        if (0 != read_whole_file(filename, start_offset, content))
+            return 1;
+        size_t pos = 0;
+        while (pos < content.length()) {
+            std::vector<std::string> argv;
+            size_t command_end = pos;
+            int status = parse_command(content, command_end, argv);
+            if (status < 0) {
+                DEBUG_LOG(utility::colourize("corrupt append only file " + filename + " at offset " + std::to_string(start_offset + pos), utility::cc::RED));
+                return 1;
+            }
+            if (status == 0) {
+                DEBUG_LOG(utility::colourize("append only file " + filename + " ends with a truncated command, dropping its last " +
+                                             std::to_string(content.length() - pos) + " bytes", utility::cc::YELLOW));
+                if (0 != truncate(filename.c_str(), start_offset + pos))
+                    return 1;
+                break;
+            }
+            on_command(std::move(argv));
+            num_commands++;
+            pos = command_end;
+        }
+        return 0;
+    }
+
+    // opens filename for appending; returns 0 on success, -1 on failure
+    int open(const std::string& filename, FsyncPolicy policy) {
+        close();
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            DEBUG_LOG(utility::colourize("failed to open " + filename + " : " + strerror(errno), utility::cc::RED));
+            return -1;
+        }
+        struct stat file_stat;
+        current_size = (0 == fstat(fd, &file_stat)) ? file_stat.st_size : 0;
+        base_size = current_size;
+        this->filename = filename;
+        this->policy = policy;
+        is_last_write_ok = true;
+        is_fsync_pending = false;
+        if (policy == FsyncPolicy::Everysec) {
+            is_stopping = false;
+            fsync_thread = std::thread(&AppendOnlyFile::fsync_every_second, this);
+        }
+        return 0;
+    }
+
+    // writes what is still buffered and makes it durable (unless appendfsync is no)
+    void close() {
+        if (fd < 0)
+            return;
+        flush(true);
+        if (fsync_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(fsync_mutex);
+                is_stopping = true;
+            }
+            fsync_cv.notify_one();
+            fsync_thread.join();
+        }
+        if (policy != FsyncPolicy::No)
+            fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+
+    bool is_open() const {
+        return fd >= 0;
+    }
+
+    void append(const std::vector<std::string>& argv) {
+        size_t command_begin = pending.length();
+        pending.push_back('*');
+        pending.append(std::to_string(argv.size()));
+        pending.append("\r\n");
+        for (auto& arg : argv) {
+            pending.push_back('$');
+            pending.append(std::to_string(arg.length()));
+            pending.append("\r\n");
+            pending.append(arg);
+            pending.append("\r\n");
+        }
+        if (is_rewriting)
+            rewrite_buffer.append(pending, command_begin, std::string::npos);
+    }
+
+    // commands not written yet, or (appendfsync always) written but not fsync'ed after a failed fsync
+    bool has_pending_writes() const {
+        return !pending.empty() || is_fsync_pending;
+    }
+
+    // with appendfsync always, replies to the commands buffered so far may only be sent after the next flush(),
+    // and after a failed write or fsync only once a retry succeeded
+    bool is_reply_deferred() const {
+        return policy == FsyncPolicy::Always && (!pending.empty() || !is_last_write_ok);
+    }
+
+    // group commit of the commands appended since the last call; returns 0 on success (or if the write is
+    // postponed), -1 if the write or fsync failed (the unwritten part stays buffered, a failed fsync is pending,
+    // both are retried by the next call)
+    int flush(bool is_forced = false) {
+        if (fd < 0 || !has_pending_writes())
+            return 0;
+        if (policy == FsyncPolicy::Everysec && fsync_in_progress && !is_forced) {
+            uint64_t now = get_current_time_ms();
+            if (postponed_since_ms == 0)
+                postponed_since_ms = now;
+            if (now - postponed_since_ms < max_postpone_ms)
+                return 0;
+            DEBUG_LOG(utility::colourize("fsync of the append only file is taking too long, writing without waiting for it", utility::cc::YELLOW));
+        }
+        postponed_since_ms = 0;
+
+        size_t offset = 0;
+        while (offset < pending.length()) {
+            ssize_t num_bytes_written = ::write(fd, pending.data() + offset, pending.length() - offset);
+            if (num_bytes_written < 0) {
+                if (errno == EINTR)
+                    continue;
+                DEBUG_LOG(utility::colourize("failed writing append only file " + filename + " : " + strerror(errno), utility::cc::RED));
+                pending.erase(0, offset);
+                current_size += offset;
+                is_last_write_ok = false;
+                return -1;
+            }
+            offset += num_bytes_written;
+        }
+        current_size += pending.length();
+        pending.clear();
+        is_last_write_ok = true;
+
+        if (policy == FsyncPolicy::Always) {
+            if (0 != fdatasync(fd)) {
+                DEBUG_LOG(utility::colourize("fsync of append only file " + filename + " failed : " + strerror(errno), utility::cc::RED));
+                is_last_write_ok = false;
+                is_fsync_pending = true;
+                return -1;
+            }
+            is_fsync_pending = false;
+        }
+        else if (policy == FsyncPolicy::Everysec) {
+            has_unsynced_writes = true;
+        }
+        return 0;
+    }
+
+    // commands logged from now on are also kept for the file being rewritten
+    void start_rewrite() {
+        is_rewriting = true;
+        rewrite_buffer.clear();
+    }
+
+    void abort_rewrite() {
+        is_rewriting = false;
+        std::string().swap(rewrite_buffer);
+    }
+
+    bool get_is_rewriting() const {
+        return is_rewriting;
+    }
+
+    // base_filename holds the rdb preamble written by the rewrite child : appends the commands logged since
+    // start_rewrite(), makes it durable, renames it over the append only file and continues logging to it;
+    // returns 0 on success, -1 on failure (the current file is kept)
+    int finish_rewrite(const std::string& base_filename) {
+        is_rewriting = false;
+        flush(true);  // the current file stays complete until it is replaced
+        int base_fd = ::open(base_filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        int status = (base_fd < 0) ? -1 : 0;
+        size_t offset = 0;
+        while (status == 0 && offset < rewrite_buffer.length()) {
+            ssize_t num_bytes_written = ::write(base_fd, rewrite_buffer.data() + offset, rewrite_buffer.length() - offset);
+            if (num_bytes_written < 0 && errno != EINTR)
+                status = -1;
+            else if (num_bytes_written > 0)
+                offset += num_bytes_written;
+        }
+        if (status == 0 && 0 != fsync(base_fd))
+            status = -1;
+        if (base_fd >= 0)
+            ::close(base_fd);
+        std::string().swap(rewrite_buffer);
+        if (status == 0 && 0 != rename(base_filename.c_str(), filename.c_str()))
+            status = -1;
+        if (status != 0) {
+            DEBUG_LOG(utility::colourize("failed to finish the rewrite of " + filename + " : " + strerror(errno), utility::cc::RED));
+            unlink(base_filename.c_str());
+            return -1;
+        }
+        std::string path = filename;
+        return open(path, policy);
+    }
+
+    // true once the file grew by growth_percentage since it was opened or last rewritten, and is at least min_size
+    bool is_rewrite_due(uint64_t growth_percentage, uint64_t min_size) const {
+        if (fd < 0 || growth_percentage == 0 || current_size < min_size)
+            return false;
+        uint64_t base = std::max<uint64_t>(base_size, 1);
+        return (current_size - std::min(current_size, base)) * 100 / base >= growth_percentage;
+    }
+
+    uint64_t get_current_size() const {
+        return current_size;
+    }
+
+    uint64_t get_base_size() const {
+        return base_size;
+    }
+
+    bool get_is_last_write_ok() const {
+        return is_last_write_ok;
+    }
+
+private:
+    // runs on fsync_thread with appendfsync everysec
+    void fsync_every_second() {
+        std::unique_lock<std::mutex> lock(fsync_mutex);
+        while (!is_stopping) {
+            fsync_cv.wait_for(lock, std::chrono::seconds(1), [this]() { return is_stopping; });
+            if (is_stopping || !has_unsynced_writes.exchange(false))
+                continue;
+            fsync_in_progress = true;
+            lock.unlock();
+            if (0 != fdatasync(fd)) {
+                DEBUG_LOG(utility::colourize("fsync of append only file " + filename + " failed : " + strerror(errno), utility::cc::RED));
+            }
+            fsync_in_progress = false;
+            lock.lock();
+        }
+    }
+
+    static int read_whole_file(const std::string& filename, uint64_t offset, std::string& content) {
+        int file_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_fd < 0)
+            return -1;
+        if (offset > 0 && lseek(file_fd, offset, SEEK_SET) < 0) {
+            ::close(file_fd);
+            return -1;
+        }
+        const size_t chunk_size = 1 << 20;
+        size_t total = 0;
+        for (;;) {
+            content.resize(total + chunk_size);
+            ssize_t num_bytes_read = read(file_fd, content.data() + total, chunk_size);
+            if (num_bytes_read < 0 && errno == EINTR)
+                continue;
+            if (num_bytes_read <= 0) {
+                content.resize(total);
+                ::close(file_fd);
+                return (num_bytes_read < 0) ? -1 : 0;
+            }
+            total += num_bytes_read;
+        }
+    }
+
+    // parses the command starting at pos (an array of bulk strings) into argv and moves pos past it;
+    // returns 1 if a whole command was parsed, 0 if content ends in the middle of it, -1 if it is malformed
+    static int parse_command(const std::string& content, size_t& pos, std::vector<std::string>& argv) {
+        auto read_header = [&](char type, uint64_t& number) {
+            if (pos >= content.length())
+                return 0;
+            if (content[pos] != type)
+                return -1;
+            size_t crlf = content.find("\r\n", pos);
+            if (crlf == std::string::npos)
+                return 0;
+            int64_t value = 0;
+            if (0 != utility::parseInt64(content.substr(pos + 1, crlf - pos - 1), value) || value < 0)
+                return -1;
+            number = static_cast<uint64_t>(value);
+            pos = crlf + 2;
+            return 1;
+        };
+        uint64_t num_args = 0;
+        int status = read_header('*', num_args);
+        if (status != 1)
+            return status;
+        argv.reserve(num_args);
+        for (uint64_t i = 0; i < num_args; i++) {
+            uint64_t length = 0;
+            status = read_header('$', length);
+            if (status != 1)
+                return status;
+            if (content.length() - pos < length + 2)
+                return 0;
+            if (content.compare(pos + length, 2, "\r\n") != 0)
+                return -1;
+            argv.emplace_back(content, pos, length);
+            pos += length + 2;
+        }
+        return 1;
+    }
+
+    static uint64_t get_current_time_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static constexpr uint64_t max_postpone_ms = 2000;  // same as redis
+    std::string filename;
+    int fd = -1;
+    FsyncPolicy policy = FsyncPolicy::Everysec;
+    std::string pending;  // commands logged since the last flush()
+    uint64_t current_size = 0;
+    uint64_t base_size = 0;  // size when opened or last rewritten, for automatic rewrites
+    bool is_rewriting = false;
+    std::string rewrite_buffer;  // commands logged while a rewrite child writes the rdb preamble
+    bool is_last_write_ok = true;  // last write (and fsync with appendfsync always) succeeded
+    bool is_fsync_pending = false;  // appendfsync always : written bytes are not known to be on disk
+    uint64_t postponed_since_ms = 0;  // 0 if no write is postponed
+
+    std::thread fsync_thread;
+    std::mutex fsync_mutex;
+    std::condition_variable fsync_cv;
+    bool is_stopping = false;
+    std::atomic<bool> has_unsynced_writes{false};
+    std::atomic<bool> fsync_in_progress{false};
+};
+
+#endif  // APPENDONLYFILE_HPP
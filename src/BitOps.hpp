@@ -0,0 +1,300 @@
+#ifndef BITOPS_HPP
+#define BITOPS_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITOPS_X86 1
+#endif
+#include "utility.hpp"
+
+/*
+  bit level helpers used by SETBIT, GETBIT, BITCOUNT, BITPOS, BITOP and BITFIELD
+  bit 0 is the most significant bit of byte 0 (same as redis).
+  The hot loops have an AVX2 version and a POPCNT (64 bit word) version, chosen at runtime
+  with __builtin_cpu_supports() so no special compiler flags are required.
+*/
+namespace bitops {
+
+    enum class BitOp : uint8_t { AND, OR, XOR, NOT };
+
+    enum class Overflow : uint8_t { WRAP, SAT, FAIL };
+
+    struct BitfieldOp {
+        enum class Type : uint8_t { GET, SET, INCRBY };
+        Type type;
+        bool isSigned;
+        uint8_t bits;  // 1..64 for signed, 1..63 for unsigned
+        uint64_t offset;  // bit offset
+        int64_t value;  // value for SET, increment for INCRBY
+        Overflow overflow;
+    };
+
+    inline bool hasAvx2() {
+#ifdef BITOPS_X86
+        static const bool isSupported = __builtin_cpu_supports("avx2");
+        return isSupported;
+#else
+        return false;
+#endif
+    }
+
+    inline bool hasPopcnt() {
+#ifdef BITOPS_X86
+        static const bool isSupported = __builtin_cpu_supports("popcnt");
+        return isSupported;
+#else
+        return false;
+#endif
+    }
+
+#ifdef BITOPS_X86
+    __attribute__((target("popcnt")))
+    inline uint64_t popcountWordsHw(const uint8_t* data, size_t len) {
+        uint64_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            count += __builtin_popcountll(word);
+        }
+        for (; i < len; i++)
+            count += __builtin_popcount(data[i]);
+        return count;
+    }
+
+    __attribute__((target("avx2")))
+    inline uint64_t popcountAvx2(const uint8_t* data, size_t len) {
+        // nibble lookup popcount (Mula) : per byte counts with vpshufb, summed with vpsadbw
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i lowMask = _mm256_set1_epi8(0x0F);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i total = zero;
+        size_t i = 0;
+        while (i + 32 <= len) {
+            __m256i local = zero;
+            // a byte lane can hold 31 iterations of at most 8 before overflowing
+            for (int k = 0; k < 31 && i + 32 <= len; k++, i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                __m256i lo = _mm256_and_si256(v, lowMask);
+                __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+                local = _mm256_add_epi8(local, _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi)));
+            }
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(local, zero));
+        }
+        uint64_t count = static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) + static_cast<uint64_t>(_mm256_extract_epi64(total, 1))
+                       + static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) + static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+        return count + popcountWordsHw(data + i, len - i);
+    }
+
+    // returns index of the first byte which is not skipByte, or len if there is none
+    __attribute__((target("avx2")))
+    inline size_t findFirstByteNotAvx2(const uint8_t* data, size_t len, uint8_t skipByte) {
+        const __m256i skip = _mm256_set1_epi8(static_cast<char>(skipByte));
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            uint32_t equalMask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, skip)));
+            if (equalMask != 0xFFFFFFFFu)
+                return i + __builtin_ctz(~equalMask);
+        }
+        for (; i < len; i++) {
+            if (data[i] != skipByte)
+                return i;
+        }
+        return len;
+    }
+
+    __attribute__((target("avx2")))
+    inline void bitwiseOpAvx2(BitOp op, uint8_t* dest, const uint8_t* src, size_t len) {
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i r;
+            if (op == BitOp::AND) r = _mm256_and_si256(a, b);
+            else if (op == BitOp::OR) r = _mm256_or_si256(a, b);
+            else r = _mm256_xor_si256(a, b);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), r);
+        }
+        for (; i < len; i++) {
+            if (op == BitOp::AND) dest[i] &= src[i];
+            else if (op == BitOp::OR) dest[i] |= src[i];
+            else dest[i] ^= src[i];
+        }
+    }
+#endif
+
+    inline uint64_t popcountWords(const uint8_t* data, size_t len) {
+        uint64_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            count += __builtin_popcountll(word);
+        }
+        for (; i < len; i++)
+            count += __builtin_popcount(data[i]);
+        return count;
+    }
+
+    inline uint64_t popcount(const uint8_t* data, size_t len) {
+#ifdef BITOPS_X86
+        if (len >= 64 && hasAvx2())
+            return popcountAvx2(data, len);
+        if (hasPopcnt())
+            return popcountWordsHw(data, len);
+#endif
+        return popcountWords(data, len);
+    }
+
+    inline size_t findFirstByteNot(const uint8_t* data, size_t len, uint8_t skipByte) {
+#ifdef BITOPS_X86
+        if (hasAvx2())
+            return findFirstByteNotAvx2(data, len, skipByte);
+#endif
+        size_t i = 0;
+        uint64_t skipWord = 0x0101010101010101ULL * skipByte;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            if (word != skipWord)
+                break;
+        }
+        for (; i < len; i++) {
+            if (data[i] != skipByte)
+                return i;
+        }
+        return len;
+    }
+
+    // dest = dest op src, both len bytes (NOT is handled by the caller)
+    inline void bitwiseOp(BitOp op, uint8_t* dest, const uint8_t* src, size_t len) {
+#ifdef BITOPS_X86
+        if (hasAvx2()) {
+            bitwiseOpAvx2(op, dest, src, len);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < len; i++) {
+            if (op == BitOp::AND) dest[i] &= src[i];
+            else if (op == BitOp::OR) dest[i] |= src[i];
+            else dest[i] ^= src[i];
+        }
+    }
+
+    inline int getBit(const std::string& str, uint64_t bitOffset) {
+        uint64_t byteIndex = bitOffset >> 3;
+        if (byteIndex >= str.length())
+            return 0;
+        return (static_cast<uint8_t>(str[byteIndex]) >> (7 - (bitOffset & 7))) & 1;
+    }
+
+    // str must be large enough to hold bitOffset
+    inline void setBit(std::string& str, uint64_t bitOffset, int bit) {
+        uint64_t byteIndex = bitOffset >> 3;
+        uint8_t mask = static_cast<uint8_t>(1 << (7 - (bitOffset & 7)));
+        uint8_t byte = static_cast<uint8_t>(str[byteIndex]);
+        str[byteIndex] = static_cast<char>(bit ? (byte | mask) : (byte & ~mask));
+    }
+
+    // counts set bits with startBit <= bit <= endBit (both already clamped to the string)
+    inline uint64_t countBitsInRange(const std::string& str, uint64_t startBit, uint64_t endBit) {
+        uint64_t count = 0;
+        while (startBit <= endBit && (startBit & 7) != 0) {
+            count += getBit(str, startBit++);
+        }
+        uint64_t startByte = startBit >> 3;
+        uint64_t endByteExclusive = (endBit + 1) >> 3;
+        if (startBit <= endBit && startByte < endByteExclusive) {
+            count += popcount(reinterpret_cast<const uint8_t*>(str.data()) + startByte, endByteExclusive - startByte);
+            startBit = endByteExclusive << 3;
+        }
+        while (startBit <= endBit) {
+            count += getBit(str, startBit++);
+        }
+        return count;
+    }
+
+    // returns position of the first bit equal to bit with startBit <= pos <= endBit, or -1
+    inline int64_t findBitInRange(const std::string& str, int bit, uint64_t startBit, uint64_t endBit) {
+        while (startBit <= endBit && (startBit & 7) != 0) {
+            if (getBit(str, startBit) == bit)
+                return static_cast<int64_t>(startBit);
+            startBit++;
+        }
+        uint64_t startByte = startBit >> 3;
+        uint64_t endByteExclusive = (endBit + 1) >> 3;
+        if (startBit <= endBit && startByte < endByteExclusive) {
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(str.data());
+            size_t index = startByte + findFirstByteNot(data + startByte, endByteExclusive - startByte, bit ? 0x00 : 0xFF);
+            if (index < endByteExclusive) {
+                uint8_t byte = bit ? data[index] : static_cast<uint8_t>(~data[index]);
+                return static_cast<int64_t>((index << 3) + (__builtin_clz(byte) - 24));
+            }
+            startBit = endByteExclusive << 3;
+        }
+        while (startBit <= endBit) {
+            if (getBit(str, startBit) == bit)
+                return static_cast<int64_t>(startBit);
+            startBit++;
+        }
+        return -1;
+    }
+
+    inline uint64_t getUnsignedField(const std::string& str, uint64_t offset, uint8_t bits) {
+        uint64_t value = 0;
+        for (uint8_t i = 0; i < bits; i++)
+            value = (value << 1) | static_cast<uint64_t>(getBit(str, offset + i));
+        return value;
+    }
+
+    inline int64_t getSignedField(const std::string& str, uint64_t offset, uint8_t bits) {
+        uint64_t value = getUnsignedField(str, offset, bits);
+        if (bits < 64 && (value & (1ULL << (bits - 1))))
+            value |= ~((1ULL << bits) - 1);  // sign extension
+        return static_cast<int64_t>(value);
+    }
+
+    inline void setField(std::string& str, uint64_t offset, uint8_t bits, uint64_t value) {
+        for (uint8_t i = 0; i < bits; i++)
+            setBit(str, offset + i, static_cast<int>((value >> (bits - 1 - i)) & 1));
+    }
+
+    /*
+      applies overflow policy to value (computed with 128 bit precision) for a field of bits width
+      returns false if policy is FAIL and value does not fit
+    */
+    inline bool handleOverflow(__int128 value, bool isSigned, uint8_t bits, Overflow overflow, uint64_t& result) {
+        __int128 maxValue = isSigned ? ((static_cast<__int128>(1) << (bits - 1)) - 1) : ((static_cast<__int128>(1) << bits) - 1);
+        __int128 minValue = isSigned ? -maxValue - 1 : 0;
+        if (value >= minValue && value <= maxValue) {
+            result = static_cast<uint64_t>(value);
+            return true;
+        }
+        if (overflow == Overflow::FAIL)
+            return false;
+        if (overflow == Overflow::SAT) {
+            result = static_cast<uint64_t>(value > maxValue ? maxValue : minValue);
+            return true;
+        }
+        // WRAP : keep low bits (setField only writes bits, sign is implied)
+        result = static_cast<uint64_t>(value);
+        return true;
+    }
+
+    inline int64_t fieldToInt64(uint64_t raw, bool isSigned, uint8_t bits) {
+        if (bits < 64)
+            raw &= (1ULL << bits) - 1;
+        if (isSigned && bits < 64 && (raw & (1ULL << (bits - 1))))
+            raw |= ~((1ULL << bits) - 1);
+        return static_cast<int64_t>(raw);
+    }
+};
+
+#endif  // BITOPS_HPP
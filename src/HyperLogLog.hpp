@@ -0,0 +1,365 @@
+#ifndef HYPERLOGLOG_HPP
+#define HYPERLOGLOG_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "BitOps.hpp"
+#include "utility.hpp"
+
+/*
+  HyperLogLog stored as a plain string value, byte compatible with redis (so it survives RDB files) :
+  header (16 bytes) : "HYLL" | encoding (0 dense, 1 sparse) | 3 unused bytes | cached cardinality (8 bytes, little endian,
+                      MSB of the last byte set means the cache is invalid)
+  dense  : 16384 registers of 6 bits, packed LSB first (12288 bytes)
+  sparse : opcodes describing runs of registers
+           ZERO   00xxxxxx           : xxxxxx+1 registers set to 0 (1..64)
+           XZERO  01xxxxxx yyyyyyyy  : xxxxxxyyyyyyyy+1 registers set to 0 (1..16384)
+           VAL    1vvvvvxx           : xx+1 registers set to vvvvv+1 (value 1..32)
+  Multi key PFCOUNT and PFMERGE work on "raw" registers (one byte per register) which are merged with AVX2 max.
+*/
+namespace hll {
+
+    const int P = 14;  // precision, number of bits used to select a register
+    const int Q = 64 - P;
+    const int REGISTERS = 1 << P;  // 16384
+    const int REGISTER_MAX = 63;
+    const size_t HEADER_SIZE = 16;
+    const size_t DENSE_SIZE = HEADER_SIZE + (REGISTERS * 6 + 7) / 8;
+    const size_t SPARSE_MAX_BYTES = 3000;  // same default as redis hll-sparse-max-bytes
+    const uint8_t ENCODING_DENSE = 0;
+    const uint8_t ENCODING_SPARSE = 1;
+    const int SPARSE_VAL_MAX_VALUE = 32;
+    const int SPARSE_VAL_MAX_LEN = 4;
+    const int SPARSE_ZERO_MAX_LEN = 64;
+    const int SPARSE_XZERO_MAX_LEN = 16384;
+
+    inline uint64_t murmurHash64A(const void* key, size_t len, uint64_t seed) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = seed ^ (len * m);
+        const uint8_t* data = static_cast<const uint8_t*>(key);
+        const uint8_t* end = data + (len - (len & 7));
+        while (data != end) {
+            uint64_t k;
+            memcpy(&k, data, 8);
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+            data += 8;
+        }
+        switch (len & 7) {
+            case 7: h ^= static_cast<uint64_t>(data[6]) << 48; [[fallthrough]];
+            case 6: h ^= static_cast<uint64_t>(data[5]) << 40; [[fallthrough]];
+            case 5: h ^= static_cast<uint64_t>(data[4]) << 32; [[fallthrough]];
+            case 4: h ^= static_cast<uint64_t>(data[3]) << 24; [[fallthrough]];
+            case 3: h ^= static_cast<uint64_t>(data[2]) << 16; [[fallthrough]];
+            case 2: h ^= static_cast<uint64_t>(data[1]) << 8; [[fallthrough]];
+            case 1: h ^= static_cast<uint64_t>(data[0]);
+                    h *= m;
+        }
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+    // returns register index for element and sets count to the length of the 000..1 pattern
+    inline int patternLength(const std::string& element, uint8_t& count) {
+        uint64_t hash = murmurHash64A(element.data(), element.length(), 0xadc83b19ULL);
+        int index = static_cast<int>(hash & (REGISTERS - 1));
+        hash >>= P;
+        hash |= 1ULL << Q;  // makes sure the loop terminates, count is at most Q+1
+        count = static_cast<uint8_t>(__builtin_ctzll(hash) + 1);
+        return index;
+    }
+
+    inline uint8_t getDenseRegister(const uint8_t* registers, int index) {
+        size_t byte = index * 6 / 8;
+        unsigned fb = index * 6 & 7;
+        unsigned b0 = registers[byte];
+        unsigned b1 = (fb > 2) ? registers[byte + 1] : 0;  // register fits in one byte when fb <= 2
+        return static_cast<uint8_t>(((b0 >> fb) | (b1 << (8 - fb))) & REGISTER_MAX);
+    }
+
+    inline void setDenseRegister(uint8_t* registers, int index, uint8_t value) {
+        size_t byte = index * 6 / 8;
+        unsigned fb = index * 6 & 7;
+        registers[byte] &= ~(REGISTER_MAX << fb);
+        registers[byte] |= value << fb;
+        if (fb > 2) {
+            unsigned fb8 = 8 - fb;
+            registers[byte + 1] &= ~(REGISTER_MAX >> fb8);
+            registers[byte + 1] |= value >> fb8;
+        }
+    }
+
+    inline bool isCacheValid(const std::string& value) {
+        return (static_cast<uint8_t>(value[15]) & 0x80) == 0;
+    }
+
+    inline void invalidateCache(std::string& value) {
+        value[15] = static_cast<char>(static_cast<uint8_t>(value[15]) | 0x80);
+    }
+
+    inline uint64_t getCachedCardinality(const std::string& value) {
+        uint64_t card = 0;
+        for (int i = 7; i >= 0; i--)
+            card = (card << 8) | static_cast<uint8_t>(value[8 + i]);
+        return card;
+    }
+
+    inline void setCachedCardinality(std::string& value, uint64_t card) {
+        for (int i = 0; i < 8; i++) {
+            value[8 + i] = static_cast<char>(card & 0xFF);
+            card >>= 8;
+        }
+    }
+
+    // returns 0 if value is a well formed HLL string
+    inline int validate(const std::string& value) {
+        if (value.length() < HEADER_SIZE || value.compare(0, 4, "HYLL") != 0)
+            return -1;
+        uint8_t encoding = static_cast<uint8_t>(value[4]);
+        if (encoding == ENCODING_DENSE)
+            return (value.length() == DENSE_SIZE) ? 0 : -1;
+        if (encoding != ENCODING_SPARSE)
+            return -1;
+        // sparse opcodes must describe exactly REGISTERS registers
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(value.data()) + HEADER_SIZE;
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(value.data()) + value.length();
+        int total = 0;
+        while (p < end) {
+            if ((*p & 0xC0) == 0x00) { total += (*p & 0x3F) + 1; p++; }
+            else if ((*p & 0xC0) == 0x40) {
+                if (p + 1 >= end) return -1;
+                total += (((*p & 0x3F) << 8) | p[1]) + 1;
+                p += 2;
+            }
+            else { total += (*p & 0x3) + 1; p++; }
+        }
+        return (total == REGISTERS) ? 0 : -1;
+    }
+
+    inline std::string createEmpty() {
+        std::string value(HEADER_SIZE, '\0');
+        memcpy(value.data(), "HYLL", 4);
+        value[4] = static_cast<char>(ENCODING_SPARSE);
+        value += static_cast<char>(0x40 | ((SPARSE_XZERO_MAX_LEN - 1) >> 8));  // single XZERO covering all registers
+        value += static_cast<char>((SPARSE_XZERO_MAX_LEN - 1) & 0xFF);
+        return value;  // cached cardinality 0 is valid
+    }
+
+    // expands value (dense or sparse, validated) into one byte per register
+    inline void toRawRegisters(const std::string& value, uint8_t* raw) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(value.data()) + HEADER_SIZE;
+        if (static_cast<uint8_t>(value[4]) == ENCODING_DENSE) {
+            // 3 bytes hold 4 registers
+            for (int i = 0; i < REGISTERS; i += 4, p += 3) {
+                raw[i] = p[0] & 0x3F;
+                raw[i + 1] = ((p[0] >> 6) | (p[1] << 2)) & 0x3F;
+                raw[i + 2] = ((p[1] >> 4) | (p[2] << 4)) & 0x3F;
+                raw[i + 3] = p[2] >> 2;
+            }
+            return;
+        }
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(value.data()) + value.length();
+        int index = 0;
+        while (p < end && index < REGISTERS) {
+            if ((*p & 0xC0) == 0x00) {
+                int runLength = (*p & 0x3F) + 1;
+                memset(raw + index, 0, runLength);
+                index += runLength;
+                p++;
+            }
+            else if ((*p & 0xC0) == 0x40) {
+                int runLength = (((*p & 0x3F) << 8) | p[1]) + 1;
+                memset(raw + index, 0, runLength);
+                index += runLength;
+                p += 2;
+            }
+            else {
+                int runLength = (*p & 0x3) + 1;
+                memset(raw + index, ((*p >> 2) & 0x1F) + 1, runLength);
+                index += runLength;
+                p++;
+            }
+        }
+    }
+
+    // builds a sparse value if every register fits the sparse encoding within SPARSE_MAX_BYTES, else a dense one
+    inline std::string fromRawRegisters(const uint8_t* raw) {
+        std::string value(HEADER_SIZE, '\0');
+        memcpy(value.data(), "HYLL", 4);
+        bool isSparsePossible = true;
+        for (int i = 0; i < REGISTERS && isSparsePossible; i++)
+            isSparsePossible = raw[i] <= SPARSE_VAL_MAX_VALUE;
+
+        if (isSparsePossible) {
+            value[4] = static_cast<char>(ENCODING_SPARSE);
+            int index = 0;
+            while (index < REGISTERS && value.length() <= SPARSE_MAX_BYTES) {
+                uint8_t registerValue = raw[index];
+                int runLength = 1;
+                while (index + runLength < REGISTERS && raw[index + runLength] == registerValue)
+                    runLength++;
+                index += runLength;
+                while (runLength > 0) {
+                    if (registerValue == 0 && runLength > SPARSE_ZERO_MAX_LEN) {
+                        int length = std::min(runLength, SPARSE_XZERO_MAX_LEN);
+                        value += static_cast<char>(0x40 | ((length - 1) >> 8));
+                        value += static_cast<char>((length - 1) & 0xFF);
+                        runLength -= length;
+                    }
+                    else if (registerValue == 0) {
+                        value += static_cast<char>(runLength - 1);
+                        runLength = 0;
+                    }
+                    else {
+                        int length = std::min(runLength, SPARSE_VAL_MAX_LEN);
+                        value += static_cast<char>(0x80 | ((registerValue - 1) << 2) | (length - 1));
+                        runLength -= length;
+                    }
+                }
+            }
+            if (value.length() <= SPARSE_MAX_BYTES) {
+                invalidateCache(value);
+                return value;
+            }
+            value.resize(HEADER_SIZE);
+        }
+
+        value[4] = static_cast<char>(ENCODING_DENSE);
+        value.resize(DENSE_SIZE, '\0');
+        uint8_t* p = reinterpret_cast<uint8_t*>(value.data()) + HEADER_SIZE;
+        for (int i = 0; i < REGISTERS; i += 4, p += 3) {
+            p[0] = static_cast<uint8_t>(raw[i] | (raw[i + 1] << 6));
+            p[1] = static_cast<uint8_t>((raw[i + 1] >> 2) | (raw[i + 2] << 4));
+            p[2] = static_cast<uint8_t>((raw[i + 2] >> 4) | (raw[i + 3] << 2));
+        }
+        invalidateCache(value);
+        return value;
+    }
+
+#ifdef BITOPS_X86
+    __attribute__((target("avx2")))
+    inline void mergeMaxAvx2(uint8_t* dest, const uint8_t* src) {
+        for (int i = 0; i < REGISTERS; i += 32) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_max_epu8(a, b));
+        }
+    }
+#endif
+
+    // dest[i] = max(dest[i], src[i]) over raw registers
+    inline void mergeMax(uint8_t* dest, const uint8_t* src) {
+#ifdef BITOPS_X86
+        if (bitops::hasAvx2()) {
+            mergeMaxAvx2(dest, src);
+            return;
+        }
+#endif
+        for (int i = 0; i < REGISTERS; i++)
+            dest[i] = std::max(dest[i], src[i]);
+    }
+
+    inline double sigma(double x) {
+        if (x == 1.)
+            return INFINITY;
+        double zPrime;
+        double y = 1;
+        double z = x;
+        do {
+            x *= x;
+            zPrime = z;
+            z += x * y;
+            y += y;
+        } while (zPrime != z);
+        return z;
+    }
+
+    inline double tau(double x) {
+        if (x == 0. || x == 1.)
+            return 0.;
+        double zPrime;
+        double y = 1.0;
+        double z = 1 - x;
+        do {
+            x = std::sqrt(x);
+            zPrime = z;
+            y *= 0.5;
+            z -= std::pow(1 - x, 2) * y;
+        } while (zPrime != z);
+        return z / 3;
+    }
+
+    // cardinality estimation from raw registers (Ertl's improved estimator, same as redis)
+    inline uint64_t estimate(const uint8_t* raw) {
+        int histogram[64] = {0};
+        for (int i = 0; i < REGISTERS; i++)
+            histogram[raw[i]]++;
+        const double m = REGISTERS;
+        double z = m * tau((m - histogram[Q + 1]) / m);
+        for (int j = Q; j >= 1; --j) {
+            z += histogram[j];
+            z *= 0.5;
+        }
+        z += m * sigma(histogram[0] / m);
+        const double alphaInf = 0.721347520444481703680;
+        return static_cast<uint64_t>(std::llround(alphaInf * m * m / z));
+    }
+
+    /*
+      adds elements to value (validated HLL), returns number of registers updated
+      dense values are updated in place, sparse ones are rebuilt once per call (and promoted to dense when needed)
+    */
+    inline int addElements(std::string& value, const std::vector<std::string>& elements) {
+        int updated = 0;
+        if (static_cast<uint8_t>(value[4]) == ENCODING_DENSE) {
+            uint8_t* registers = reinterpret_cast<uint8_t*>(value.data()) + HEADER_SIZE;
+            for (auto& element : elements) {
+                uint8_t count;
+                int index = patternLength(element, count);
+                if (getDenseRegister(registers, index) < count) {
+                    setDenseRegister(registers, index, count);
+                    updated++;
+                }
+            }
+        }
+        else {
+            std::vector<uint8_t> raw(REGISTERS);
+            toRawRegisters(value, raw.data());
+            for (auto& element : elements) {
+                uint8_t count;
+                int index = patternLength(element, count);
+                if (raw[index] < count) {
+                    raw[index] = count;
+                    updated++;
+                }
+            }
+            if (updated > 0)
+                value = fromRawRegisters(raw.data());
+        }
+        if (updated > 0)
+            invalidateCache(value);
+        return updated;
+    }
+
+    // cardinality of a single HLL, using and refreshing the cached value
+    inline uint64_t count(std::string& value) {
+        if (isCacheValid(value))
+            return getCachedCardinality(value);
+        std::vector<uint8_t> raw(REGISTERS);
+        toRawRegisters(value, raw.data());
+        uint64_t card = estimate(raw.data());
+        setCachedCardinality(value, card);
+        return card;
+    }
+};
+
+#endif  // HYPERLOGLOG_HPP
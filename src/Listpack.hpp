@@ -0,0 +1,192 @@
+#ifndef LISTPACK_HPP
+#define LISTPACK_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <charconv>
+
+/*
+  Listpack, the compact sequence redis stores in RDB files (quicklist nodes, small hashes / sets / zsets) :
+  header (6 bytes) : total bytes (4, little endian) | number of elements (2, little endian, 65535 if unknown)
+  entries          : encoding + data, followed by backlen (size of encoding + data in 1 to 5 bytes, 7 bits per byte)
+                     0xxxxxxx                       7 bits unsigned int
+                     10xxxxxx <data>                string of up to 63 bytes
+                     110xxxxx yyyyyyyy              13 bits signed int
+                     1110xxxx yyyyyyyy <data>       string of up to 4095 bytes
+                     11110000 <4 bytes len> <data>  string
+                     11110001 / 11110010 / 11110011 / 11110100 : 16 / 24 / 32 / 64 bits signed int (little endian)
+  terminator       : 0xFF
+*/
+namespace listpack {
+
+    const size_t HEADER_SIZE = 6;
+    const uint8_t END = 0xFF;
+
+    inline size_t backlenSize(uint64_t entry_length) {
+        if (entry_length <= 127) return 1;
+        if (entry_length < 16383) return 2;
+        if (entry_length < 2097151) return 3;
+        if (entry_length < 268435455) return 4;
+        return 5;
+    }
+
+    inline void appendBacklen(std::string& lp, uint64_t entry_length) {
+        size_t size = backlenSize(entry_length);
+        // most significant 7 bits first, every byte but the first has its MSB set
+        for (size_t i = 0; i < size; i++) {
+            uint8_t byte = (entry_length >> (7 * (size - 1 - i))) & 127;
+            lp.push_back(static_cast<char>((i == 0) ? byte : (byte | 128)));
+        }
+    }
+
+    // true if str is the canonical decimal form of an int64 (what redis would store as an integer)
+    inline bool parseInteger(const std::string& str, int64_t& value) {
+        if (str.empty() || str.length() > 20)
+            return false;
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.length(), value);
+        if (ec != std::errc() || ptr != str.data() + str.length())
+            return false;
+        return std::to_string(value) == str;
+    }
+
+    inline void appendLittleEndian(std::string& lp, uint64_t value, int num_bytes) {
+        for (int i = 0; i < num_bytes; i++)
+            lp.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    inline void appendElement(std::string& lp, const std::string& element) {
+        size_t entry_begin = lp.length();
+        int64_t value = 0;
+        if (parseInteger(element, value)) {
+            if (value >= 0 && value <= 127) {
+                lp.push_back(static_cast<char>(value));
+            }
+            else if (value >= -4096 && value <= 4095) {
+                uint64_t raw = static_cast<uint64_t>(value) & 0x1FFF;
+                lp.push_back(static_cast<char>(0xC0 | (raw >> 8)));
+                lp.push_back(static_cast<char>(raw & 0xFF));
+            }
+            else if (value >= INT16_MIN && value <= INT16_MAX) {
+                lp.push_back(static_cast<char>(0xF1));
+                appendLittleEndian(lp, static_cast<uint64_t>(value), 2);
+            }
+            else if (value >= -(1 << 23) && value < (1 << 23)) {
+                lp.push_back(static_cast<char>(0xF2));
+                appendLittleEndian(lp, static_cast<uint64_t>(value), 3);
+            }
+            else if (value >= INT32_MIN && value <= INT32_MAX) {
+                lp.push_back(static_cast<char>(0xF3));
+                appendLittleEndian(lp, static_cast<uint64_t>(value), 4);
+            }
+            else {
+                lp.push_back(static_cast<char>(0xF4));
+                appendLittleEndian(lp, static_cast<uint64_t>(value), 8);
+            }
+        }
+        else if (element.length() < 64) {
+            lp.push_back(static_cast<char>(0x80 | element.length()));
+            lp.append(element);
+        }
+        else if (element.length() < 4096) {
+            lp.push_back(static_cast<char>(0xE0 | (element.length() >> 8)));
+            lp.push_back(static_cast<char>(element.length() & 0xFF));
+            lp.append(element);
+        }
+        else {
+            lp.push_back(static_cast<char>(0xF0));
+            appendLittleEndian(lp, element.length(), 4);
+            lp.append(element);
+        }
+        appendBacklen(lp, lp.length() - entry_begin);
+    }
+
+    // builds a listpack holding elements [begin, end)
+    template <typename Iterator>
+    std::string encode(Iterator begin, Iterator end) {
+        std::string lp(HEADER_SIZE, '\0');
+        size_t count = 0;
+        for (auto it = begin; it != end; ++it, ++count)
+            appendElement(lp, *it);
+        lp.push_back(static_cast<char>(END));
+        std::string header;
+        appendLittleEndian(header, lp.length(), 4);
+        appendLittleEndian(header, (count < 65535) ? count : 65535, 2);
+        lp.replace(0, HEADER_SIZE, header);
+        return lp;
+    }
+
+    // calls on_element(std::string&&) for every element, integers are converted to their decimal form;
+    // throws std::runtime_error if lp is not a valid listpack
+    template <typename OnElement>
+    void decode(const std::string& lp, OnElement&& on_element) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(lp.data());
+        size_t size = lp.length();
+        auto require = [&](size_t pos, size_t count) {
+            if (pos + count > size)
+                throw std::runtime_error("corrupt listpack");
+        };
+        auto read_signed = [&](size_t pos, int num_bytes) {
+            require(pos, num_bytes);
+            uint64_t raw = 0;
+            for (int i = 0; i < num_bytes; i++)
+                raw |= static_cast<uint64_t>(p[pos + i]) << (8 * i);
+            int shift = 64 - 8 * num_bytes;
+            return static_cast<int64_t>(raw << shift) >> shift;  // sign extension
+        };
+        require(0, HEADER_SIZE);
+        size_t pos = HEADER_SIZE;
+        for (;;) {
+            require(pos, 1);
+            uint8_t encoding = p[pos];
+            if (encoding == END)
+                break;
+            size_t entry_begin = pos;
+            if ((encoding & 0x80) == 0) {
+                on_element(std::to_string(encoding & 0x7F));
+                pos += 1;
+            }
+            else if ((encoding & 0xC0) == 0x80) {
+                size_t length = encoding & 0x3F;
+                require(pos + 1, length);
+                on_element(std::string(reinterpret_cast<const char*>(p + pos + 1), length));
+                pos += 1 + length;
+            }
+            else if ((encoding & 0xE0) == 0xC0) {
+                require(pos, 2);
+                uint64_t raw = ((static_cast<uint64_t>(encoding & 0x1F) << 8) | p[pos + 1]);
+                int64_t value = (raw >= (1 << 12)) ? static_cast<int64_t>(raw) - (1 << 13) : static_cast<int64_t>(raw);
+                on_element(std::to_string(value));
+                pos += 2;
+            }
+            else if ((encoding & 0xF0) == 0xE0) {
+                require(pos, 2);
+                size_t length = (static_cast<size_t>(encoding & 0x0F) << 8) | p[pos + 1];
+                require(pos + 2, length);
+                on_element(std::string(reinterpret_cast<const char*>(p + pos + 2), length));
+                pos += 2 + length;
+            }
+            else if (encoding == 0xF0) {
+                size_t length = static_cast<uint32_t>(read_signed(pos + 1, 4));
+                require(pos + 5, length);
+                on_element(std::string(reinterpret_cast<const char*>(p + pos + 5), length));
+                pos += 5 + length;
+            }
+            else if (encoding >= 0xF1 && encoding <= 0xF4) {
+                static const int int_sizes[] = {2, 3, 4, 8};
+                int num_bytes = int_sizes[encoding - 0xF1];
+                on_element(std::to_string(read_signed(pos + 1, num_bytes)));
+                pos += 1 + num_bytes;
+            }
+            else {
+                throw std::runtime_error("corrupt listpack");
+            }
+            pos += backlenSize(pos - entry_begin);
+        }
+    }
+
+};  // namespace listpack
+
+#endif  // LISTPACK_HPP
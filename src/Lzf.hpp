@@ -0,0 +1,131 @@
+#ifndef LZF_HPP
+#define LZF_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+/*
+  LZF, the compression used for strings in RDB files (byte compatible with liblzf / redis) :
+  literal run    000lllll <l+1 bytes>              : copy l+1 (1..32) bytes
+  back reference lllooooo [LLLLLLLL] oooooooo      : copy l+2 bytes (3..8, or if l = 7 then L+9 bytes, up to 264)
+                                                     starting offset+1 bytes (1..8192) behind the output position
+*/
+namespace lzf {
+
+    const size_t MAX_LITERAL = 32;
+    const size_t MAX_OFFSET = 1 << 13;
+    const size_t MAX_MATCH = 2 + 7 + 255;
+    const int HASH_LOG = 14;
+
+    inline uint32_t hashTriplet(const uint8_t* p) {
+        uint32_t v = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+        return (v * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    // returns the compressed length, 0 if the output does not fit in out_len bytes (input is not worth compressing)
+    inline size_t compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len) {
+        // position + 1 of the last occurrence of each hashed triplet; never cleared, a candidate is only used after
+        // checking it lies before the current position and its bytes really match
+        static thread_local uint32_t hash_table[1 << HASH_LOG];
+        size_t ip = 0, op = 0;
+        size_t literal_begin = 0;
+
+        auto emit_literals = [&](size_t from, size_t to) {
+            while (from < to) {
+                size_t count = std::min(MAX_LITERAL, to - from);
+                if (op + 1 + count > out_len)
+                    return false;
+                out[op++] = static_cast<uint8_t>(count - 1);
+                memcpy(out + op, in + from, count);
+                op += count;
+                from += count;
+            }
+            return true;
+        };
+
+        while (ip + 2 < in_len) {
+            uint32_t& slot = hash_table[hashTriplet(in + ip)];
+            size_t ref = slot - 1;  // wraps around for an empty slot, rejected by ref < ip
+            slot = static_cast<uint32_t>(ip + 1);
+            if (ref >= ip || ip - ref > MAX_OFFSET || memcmp(in + ref, in + ip, 3) != 0) {
+                ip++;
+                continue;
+            }
+            size_t max_len = std::min(in_len - ip, MAX_MATCH);
+            size_t len = 3;
+            while (len < max_len && in[ref + len] == in[ip + len])
+                len++;
+            if (!emit_literals(literal_begin, ip))
+                return 0;
+            size_t offset = ip - ref - 1;
+            size_t encoded_len = len - 2;
+            if (op + ((encoded_len < 7) ? 2 : 3) > out_len)
+                return 0;
+            if (encoded_len < 7) {
+                out[op++] = static_cast<uint8_t>((offset >> 8) | (encoded_len << 5));
+            }
+            else {
+                out[op++] = static_cast<uint8_t>((offset >> 8) | (7 << 5));
+                out[op++] = static_cast<uint8_t>(encoded_len - 7);
+            }
+            out[op++] = static_cast<uint8_t>(offset & 0xFF);
+            // index the positions covered by the match so later data can refer to them
+            size_t match_end = ip + len;
+            for (ip++; ip < match_end && ip + 2 < in_len; ip++)
+                hash_table[hashTriplet(in + ip)] = static_cast<uint32_t>(ip + 1);
+            ip = match_end;
+            literal_begin = ip;
+        }
+        if (!emit_literals(literal_begin, in_len))
+            return 0;
+        return op;
+    }
+
+    // returns 0 if in decompresses to exactly out_len bytes, -1 if the data is corrupt
+    inline int decompress(const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len) {
+        size_t ip = 0, op = 0;
+        while (ip < in_len) {
+            size_t ctrl = in[ip++];
+            if (ctrl < MAX_LITERAL) {
+                size_t count = ctrl + 1;
+                if (ip + count > in_len || op + count > out_len)
+                    return -1;
+                memcpy(out + op, in + ip, count);
+                ip += count;
+                op += count;
+                continue;
+            }
+            size_t len = ctrl >> 5;
+            if (len == 7) {
+                if (ip >= in_len)
+                    return -1;
+                len += in[ip++];
+            }
+            len += 2;
+            if (ip >= in_len)
+                return -1;
+            size_t offset = ((ctrl & 0x1F) << 8) + in[ip++] + 1;
+            if (offset > op || op + len > out_len)
+                return -1;
+            uint8_t* dest = out + op;
+            const uint8_t* ref = dest - offset;
+            if (offset >= len) {
+                memcpy(dest, ref, len);  // no overlap
+            }
+            else if (offset == 1) {
+                memset(dest, *ref, len);  // run of one byte
+            }
+            else {
+                for (size_t i = 0; i < len; i++)  // overlapping, repeats the last offset bytes
+                    dest[i] = ref[i];
+            }
+            op += len;
+        }
+        return (op == out_len) ? 0 : -1;
+    }
+
+};  // namespace lzf
+
+#endif  // LZF_HPP
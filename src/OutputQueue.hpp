@@ -0,0 +1,87 @@
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "utility.hpp"
+
+/*
+  Pending output of one client connection, flushed when the socket is writable.
+  Buffers are shared (refcounted) so a message fanned out to many clients is serialized once and never copied.
+*/
+class OutputQueue {
+public:
+    void append(std::shared_ptr<const std::string> buffer) {
+        if (buffer->empty())
+            return;
+        pending_bytes += buffer->length();
+        buffers.push_back(std::move(buffer));
+    }
+
+    void append(std::string str) {
+        append(std::make_shared<const std::string>(std::move(str)));
+    }
+
+    bool empty() const {
+        return buffers.empty();
+    }
+
+    size_t size_in_bytes() const {
+        return pending_bytes;
+    }
+
+    // writes as much as the socket accepts without blocking; returns -1 if the connection is broken, 0 otherwise
+    int flush(int socket_fd) {
+        const size_t max_iov = 64;
+        struct iovec iov[max_iov];
+        while (!buffers.empty()) {
+            size_t iov_count = std::min(max_iov, buffers.size());
+            for (size_t i = 0; i < iov_count; i++) {
+                size_t offset = (i == 0) ? front_offset : 0;
+                iov[i].iov_base = const_cast<char*>(buffers[i]->data()) + offset;
+                iov[i].iov_len = buffers[i]->length() - offset;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iov_count;
+            ssize_t num_bytes_written = sendmsg(socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (num_bytes_written < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;  // socket buffer is full, rest is written on POLLOUT
+                DEBUG_LOG(utility::colourize("Error writing to socket: " + std::to_string(socket_fd), utility::cc::RED));
+                return -1;
+            }
+            consume(static_cast<size_t>(num_bytes_written));
+        }
+        return 0;
+    }
+
+private:
+    void consume(size_t num_bytes) {
+        pending_bytes -= num_bytes;
+        while (num_bytes > 0) {
+            size_t remaining = buffers.front()->length() - front_offset;
+            if (num_bytes < remaining) {
+                front_offset += num_bytes;
+                return;
+            }
+            num_bytes -= remaining;
+            buffers.pop_front();
+            front_offset = 0;
+        }
+    }
+
+    std::deque<std::shared_ptr<const std::string>> buffers;
+    size_t front_offset = 0;  // bytes of buffers.front() already written
+    size_t pending_bytes = 0;
+};
+
+#endif  // OUTPUTQUEUE_HPP
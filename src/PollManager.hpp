@@ -14,6 +14,9 @@
 #include <fcntl.h>
 #include "utility.hpp"
 
+#ifndef POLLRDHUP
+#define POLLRDHUP 0  // linux only, elsewhere a peer closing a parked socket shows up as POLLHUP
+#endif
 
 namespace pm {
 
@@ -37,7 +40,7 @@ namespace pm {
             socketDomain = AF_UNSPEC; // AF_INET - for any of IPv4 or IPv6  // default - IPv4
             socketType = SOCK_STREAM;  // default - TCP
             socketProtocol = 0;
-            socketBacklogCount = 5;
+            socketBacklogCount = 511;  // same as redis tcp-backlog, many workers may connect at once
             isSocketNonBlocking = true; // default - non blocking mode
             isReuseSocket = true;
             return 0;
@@ -105,25 +108,28 @@ namespace pm {
             //     printPollFD(pollfdArr[i]);
             
             for(int i = 0; i < pollfdArrSize; i++) {
-                if (pollfdArr[i].revents & (POLLIN | POLLOUT)) {
+                // hang up events are reported even for sockets parked with events = POLLRDHUP so closed peers get cleaned up
+                if (pollfdArr[i].revents & (POLLIN | POLLOUT | POLLRDHUP | POLLHUP | POLLERR)) {
                     if (pollfdArr[i].fd != listenerSocketFD) {
                         // DEBUG_LOG("a socketFD is ready : " + std::to_string(pollfdArr[i].fd));
                         if (_isSocketOpen(pollfdArr[i].fd)) {
                             readyFDsVec.push_back(pollfdArr[i]);  // if the socket can be read from, push to the ready list
                         }
-                        else {
-                            _deleteSocketFDFromPollfdArr(pollfdArr[i].fd);  // delete if the socket cannot be read from
+                        else if (0 == _deleteSocketFDFromPollfdArr(pollfdArr[i].fd)) {
+                            i--;  // delete if the socket cannot be read from, last entry was moved to index i
                         }
                     }
                     else if (/*(pollfdArr[i].fd == listenerSocketFD) &&*/ (pollfdArr[i].revents & POLLIN)) {
-                        // if listener is ready to read, it means a new client connection
+                        // if listener is ready to read, it means new client connections, accept all of them (listener is non blocking)
                         struct sockaddr_storage remoteAddr; // Client address
                         socklen_t addrLen = sizeof(remoteAddr);
                         int newSocketFD = accept(listenerSocketFD, (struct sockaddr*)&remoteAddr, &addrLen);
                         if (newSocketFD == -1) {
-                            DEBUG_LOG(utility::colourize("Error accepting client connection request", utility::cc::RED));
+                            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                DEBUG_LOG(utility::colourize("Error accepting client connection request", utility::cc::RED));
                             continue;  // continue to next socketFD in pollfdArr
                         }
+                        i--;  // visit the listener again for the next pending connection
                         // add the new socket to polling array 
                         if (_addSocketFDToPollfdArr(newSocketFD, POLLIN /*| POLLINOUT*/) != 0) {
                             DEBUG_LOG(utility::colourize("failed to add newSocketFD to pollfdArr", utility::cc::RED));
@@ -173,6 +179,24 @@ namespace pm {
             return _deleteSocketFDFromPollfdArr(socketFD);
         }
 
+        int deleteConnectorSocket() {
+            // closes the connection to the master, eg : once the master hung up
+            int socketFD = connectorSocketFD;
+            connectorSocketFD = -1;  // _deleteSocketFDFromPollfdArr() refuses to delete the connector socket
+            return _deleteSocketFDFromPollfdArr(socketFD);
+        }
+
+        int setSocketFDEvents(int socketFD, short events) {
+            // replaces the events polled for socketFD, eg : POLLRDHUP only to stop reading from a parked client
+            for (int i = 0; i < pollfdArrSize; i++) {
+                if (pollfdArr[i].fd == socketFD) {
+                    pollfdArr[i].events = events;
+                    return 0;
+                }
+            }
+            return -1;
+        }
+
     private:
         // private member functions
         int _createConnectorSocket(const struct SocketSetting& socketSetting) {
@@ -224,6 +248,10 @@ namespace pm {
                 }
 
                 if (connect(connectorSocketFD, p->ai_addr, p->ai_addrlen) == -1) {
+                    if (socketSetting.isSocketNonBlocking && errno == EINPROGRESS) {
+                        // completes in the background : POLLOUT, then SO_ERROR tells whether it succeeded
+                        break;
+                    }
                     DEBUG_LOG(utility::colourize("client: connect failed", utility::cc::RED));
                     close(connectorSocketFD);
                     connectorSocketFD = -1;
@@ -234,6 +262,7 @@ namespace pm {
             }
             
             if (p == NULL) {
+                freeaddrinfo(servinfo);
                 return -1;
             }
 
@@ -245,8 +274,8 @@ namespace pm {
             ss << "client: connecting to : " << remoteIP;
             DEBUG_LOG(utility::colourize(ss.str(), utility::cc::YELLOW));
 
-            servinfo = p = NULL;
             freeaddrinfo(servinfo); // All done with this
+            servinfo = p = NULL;
             
             if (_addSocketFDToPollfdArr(connectorSocketFD, POLLIN | POLLOUT) != 0) {
                 DEBUG_LOG(utility::colourize("failed to add connectorSocketFD=" + std::to_string(connectorSocketFD) + " to pollfdArr", utility::cc::RED));
@@ -355,6 +384,7 @@ namespace pm {
 
             pollfdArr[pollfdArrSize].fd = newSocketFD;
             pollfdArr[pollfdArrSize].events = events;
+            pollfdArr[pollfdArrSize].revents = 0;  // slot may be reused or uninitialised (realloc)
             pollfdArrSize++;
             DEBUG_LOG("added socketFD=" + std::to_string(newSocketFD) + " to pollfdArr, pollfdArrSize=" + std::to_string(pollfdArrSize));
             return 0;
@@ -364,20 +394,19 @@ namespace pm {
             if (pollfdArrSize <= 0 || socketFD == listenerSocketFD || socketFD == connectorSocketFD)
                 return -1;
 
-            DEBUG_LOG(utility::colourize("NOT DELETING SOCKET=" + std::to_string(socketFD), utility::cc::BLUE));
-            // int index = 0;
-            // while(index < pollfdArrSize) {
-            //     if (pollfdArr[index].fd == socketFD)
-            //         break;
-            //     index++;
-            // }
-
-            // if ((index != pollfdArrSize) && _isSocketOpen(pollfdArr[index].fd)) {
-            //     close(pollfdArr[index].fd);
-            // }
+            int index = 0;
+            while(index < pollfdArrSize) {
+                if (pollfdArr[index].fd == socketFD)
+                    break;
+                index++;
+            }
+            if (index == pollfdArrSize)
+                return -1;
 
-            // pollfdArr[index] = pollfdArr[pollfdArrSize-1];
-            // pollfdArrSize--;
+            // closed sockets would otherwise be reported readable (0 bytes) on every poll
+            close(pollfdArr[index].fd);
+            pollfdArr[index] = pollfdArr[pollfdArrSize-1];
+            pollfdArrSize--;
 
             // int temp = (pollfdArrCapacity-pollfdArrSize)/100;
             // if (temp >= 2) {
@@ -386,7 +415,7 @@ namespace pm {
             //     pollfdArr = static_cast<struct pollfd*>(realloc(pollfdArr, (sizeof(struct pollfd) * pollfdArrCapacity)));
             //     DEBUG_LOG("updted pollfdArr and pollfdArrCapacity = " + std::to_string(pollfdArrCapacity));
             // }
-            // DEBUG_LOG(utility::colourize("deleted socketFD=" + std::to_string(socketFD) + ", pollfdArrSize=" + std::to_string(pollfdArrSize), utility::cc::RED));
+            DEBUG_LOG(utility::colourize("deleted socketFD=" + std::to_string(socketFD) + ", pollfdArrSize=" + std::to_string(pollfdArrSize), utility::cc::RED));
             return 0;
         }
 
@@ -0,0 +1,191 @@
+#ifndef PUBSUB_HPP
+#define PUBSUB_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "RespParser.hpp"
+#include "utility.hpp"
+
+/*
+  Glob patterns indexed by their literal prefix (everything before the first * ? [ or \).
+  A channel is only tested against patterns whose prefix is a prefix of the channel, found by walking the trie
+  along the channel name, instead of testing every pattern on every publish.
+*/
+class PatternTrie {
+public:
+    void add(const std::string& pattern) {
+        Node* node = &root;
+        for (char ch : literal_prefix(pattern)) {
+            auto& child = node->children[ch];
+            if (!child)
+                child = std::make_unique<Node>();
+            node = child.get();
+        }
+        node->patterns.insert(pattern);
+    }
+
+    void remove(const std::string& pattern) {
+        std::string prefix = literal_prefix(pattern);
+        std::vector<Node*> path{&root};
+        for (char ch : prefix) {
+            auto it = path.back()->children.find(ch);
+            if (it == path.back()->children.end())
+                return;
+            path.push_back(it->second.get());
+        }
+        path.back()->patterns.erase(pattern);
+        // prune nodes left without patterns and children
+        for (size_t i = prefix.length(); i > 0; i--) {
+            Node* node = path[i];
+            if (!node->patterns.empty() || !node->children.empty())
+                break;
+            path[i - 1]->children.erase(prefix[i - 1]);
+        }
+    }
+
+    // calls on_match for every pattern matching channel
+    void match(const std::string& channel, const std::function<void(const std::string&)>& on_match) const {
+        const Node* node = &root;
+        size_t depth = 0;
+        while (node != nullptr) {
+            for (auto& pattern : node->patterns) {
+                if (utility::globMatch(pattern, channel))
+                    on_match(pattern);
+            }
+            if (depth == channel.length())
+                break;
+            auto it = node->children.find(channel[depth++]);
+            node = (it == node->children.end()) ? nullptr : it->second.get();
+        }
+    }
+
+private:
+    struct Node {
+        std::map<char, std::unique_ptr<Node>> children;
+        std::unordered_set<std::string> patterns;  // patterns whose literal prefix ends here
+    };
+
+    static std::string literal_prefix(const std::string& pattern) {
+        size_t pos = pattern.find_first_of("*?[\\");
+        return pattern.substr(0, pos);
+    }
+
+    Node root;
+};
+
+/*
+  Channel and pattern subscriptions of all clients (keyed by socketFD).
+  publish() serializes each message once and hands the same shared buffer to every receiver.
+*/
+class PubSub {
+public:
+    typedef std::function<void(int, const std::shared_ptr<const std::string>&)> Deliver;
+
+    // subscribe / unsubscribe return true if the subscription set of the client changed
+    bool subscribe(int socket_fd, const std::string& channel) {
+        if (!client_channels[socket_fd].insert(channel).second)
+            return false;
+        channel_subscribers[channel].insert(socket_fd);
+        return true;
+    }
+
+    bool unsubscribe(int socket_fd, const std::string& channel) {
+        auto client_it = client_channels.find(socket_fd);
+        if (client_it == client_channels.end() || client_it->second.erase(channel) == 0)
+            return false;
+        if (client_it->second.empty())
+            client_channels.erase(client_it);
+        auto it = channel_subscribers.find(channel);
+        it->second.erase(socket_fd);
+        if (it->second.empty())
+            channel_subscribers.erase(it);
+        return true;
+    }
+
+    bool psubscribe(int socket_fd, const std::string& pattern) {
+        if (!client_patterns[socket_fd].insert(pattern).second)
+            return false;
+        auto& subscribers = pattern_subscribers[pattern];
+        if (subscribers.empty())
+            pattern_trie.add(pattern);
+        subscribers.insert(socket_fd);
+        return true;
+    }
+
+    bool punsubscribe(int socket_fd, const std::string& pattern) {
+        auto client_it = client_patterns.find(socket_fd);
+        if (client_it == client_patterns.end() || client_it->second.erase(pattern) == 0)
+            return false;
+        if (client_it->second.empty())
+            client_patterns.erase(client_it);
+        auto it = pattern_subscribers.find(pattern);
+        it->second.erase(socket_fd);
+        if (it->second.empty()) {
+            pattern_subscribers.erase(it);
+            pattern_trie.remove(pattern);
+        }
+        return true;
+    }
+
+    std::vector<std::string> get_channels(int socket_fd) const {
+        auto it = client_channels.find(socket_fd);
+        if (it == client_channels.end())
+            return {};
+        return std::vector<std::string>(it->second.begin(), it->second.end());
+    }
+
+    std::vector<std::string> get_patterns(int socket_fd) const {
+        auto it = client_patterns.find(socket_fd);
+        if (it == client_patterns.end())
+            return {};
+        return std::vector<std::string>(it->second.begin(), it->second.end());
+    }
+
+    size_t subscription_count(int socket_fd) const {
+        auto channels_it = client_channels.find(socket_fd);
+        auto patterns_it = client_patterns.find(socket_fd);
+        return ((channels_it == client_channels.end()) ? 0 : channels_it->second.size()) +
+               ((patterns_it == client_patterns.end()) ? 0 : patterns_it->second.size());
+    }
+
+    void remove_client(int socket_fd) {
+        for (auto& channel : get_channels(socket_fd))
+            unsubscribe(socket_fd, channel);
+        for (auto& pattern : get_patterns(socket_fd))
+            punsubscribe(socket_fd, pattern);
+    }
+
+    // returns number of receivers (a client subscribed through several patterns receives one message per pattern)
+    size_t publish(const std::string& channel, const std::string& message, const Deliver& deliver) const {
+        size_t receivers = 0;
+        auto it = channel_subscribers.find(channel);
+        if (it != channel_subscribers.end()) {
+            auto buffer = std::make_shared<const std::string>(resp::RespParser::serialize({"message", channel, message}, resp::RespType::Array));
+            for (int socket_fd : it->second)
+                deliver(socket_fd, buffer);
+            receivers += it->second.size();
+        }
+        pattern_trie.match(channel, [&](const std::string& pattern) {
+            auto& subscribers = pattern_subscribers.at(pattern);
+            auto buffer = std::make_shared<const std::string>(resp::RespParser::serialize({"pmessage", pattern, channel, message}, resp::RespType::Array));
+            for (int socket_fd : subscribers)
+                deliver(socket_fd, buffer);
+            receivers += subscribers.size();
+        });
+        return receivers;
+    }
+
+private:
+    std::unordered_map<std::string, std::unordered_set<int>> channel_subscribers;
+    std::unordered_map<std::string, std::unordered_set<int>> pattern_subscribers;
+    std::unordered_map<int, std::unordered_set<std::string>> client_channels;
+    std::unordered_map<int, std::unordered_set<std::string>> client_patterns;
+    PatternTrie pattern_trie;
+};
+
+#endif  // PUBSUB_HPP
@@ -2,281 +2,916 @@
 #define RDBFILEREADER_HPP
 
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <cstring>
 #include <chrono>
 #include <ctime>
+#include <stdexcept>
+#include <thread>
+#include <future>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "RedisDataStore.hpp"
 #include "RedisCommandCenter.hpp"
+#include "Lzf.hpp"
+#include "Crc64.hpp"
+#include "Listpack.hpp"
+#include "Ziplist.hpp"
+#include "RdbValueType.hpp"
 #include "utility.hpp"
 
-
-enum class ValueType : uint8_t {
-    StringEncoding = 0,
-    ListEncoding = 1,
-    SetEncoding = 2
-};
-
+/*
+  RDB loader working on the whole file as one in-memory buffer : the file is mmap'ed (read in large chunks if
+  mmap is not possible) and decoded with pointer arithmetic, strings are built with a single copy each.
+  Keys are loaded by a pipeline : the main thread indexes entries (only skips over their bytes), worker threads
+  decode chunks of indexed entries into strings, and the main thread bulk inserts decoded chunks in file order.
+  The CRC64 trailer is verified by one more worker, checksumming the mapped file while it is being indexed.
+  An rdb received over a socket (replica full resynchronization) is loaded as a stream instead, see begin_stream().
+*/
 class RdbFileReader {
 public:
-    RdbFileReader() {
+    // progress of readFile(), may be read from other threads while the file loads (eg : INFO while loading in
+    // background); bytes_loaded moves as chunks of entries are handed to the decoding workers
+    struct Progress {
+        std::atomic<uint64_t> bytes_total{0};
+        std::atomic<uint64_t> bytes_loaded{0};
+        std::atomic<uint64_t> keys_loaded{0};
+    };
+
+    explicit RdbFileReader(Progress* progress = nullptr) : progress(progress) {
         reset();
     }
 
-    int readFile(const std::string& filename) {
+    // end_offset (if given) is set to the offset right after the rdb data, where the tail of an append only file
+    // with an rdb preamble starts
+    int readFile(const std::string& filename, uint64_t* end_offset = nullptr) {
         reset();
         this->filename = filename;
-        rdb_file.open(this->filename, std::ios::binary);
-        if (!rdb_file.is_open()) {
+        if (0 != map_file()) {
             DEBUG_LOG("something went wrong, cannot open file : " + filename + "\n");
             return 1;
         }
-        DEBUG_LOG("Reading file : " + filename + "\n");
-        if (0 != read_header_and_metadata())
-            return 1;
-
-        if (0 != read_database())
-            return 1;
+        DEBUG_LOG("Reading file : " + filename + ", size = " + std::to_string(decoder.end - decoder.cursor) + " bytes\n");
+        if (progress != nullptr)
+            progress->bytes_total = decoder.end - decoder.cursor;
+        int status = 0;
+        try {
+            if (0 != read_header_and_metadata() || 0 != read_database())
+                status = 1;
+            if (end_offset != nullptr)
+                *end_offset = decoder.cursor - file_begin;
+        }
+        catch (const std::runtime_error& err) {
+            DEBUG_LOG(utility::colourize("failed to load rdb file " + filename + " : " + err.what(), utility::cc::RED));
+            status = 1;
+        }
+        reset();
+        return status;
+    }
 
-        rdb_file.close();
+    /*
+      Streaming load : the rdb arrives in pieces (payload of a full resynchronization) and is never held whole in
+      memory. Every complete top level item (opcode, or key value pair) of the bytes fed so far is decoded right
+      away into the staged dataset of RedisDataStore; only an item split across pieces stays buffered. The CRC64 is
+      computed as items go by. The caller swaps the staged dataset in (or discards it) once the stream ends.
+    */
+    int begin_stream() {
+        reset();
+        stream = StreamState();
+        stream.is_active = true;
+        redis_data_store_obj.begin_staged_load();
         return 0;
     }
 
-    ~RdbFileReader() {
-        if (rdb_file.is_open()) {
-            rdb_file.close();
+    // consumed is set to the bytes of data taken, all of them unless the rdb ended inside data (the rest follows it
+    // on the link); is_flush tells the end of the rdb is known to be in the bytes fed so far. Returns 1 once the end
+    // of file opcode and checksum were read, 0 if more bytes are needed, -1 if the bytes are not a valid rdb
+    int feed_stream(const uint8_t* data, size_t length, bool is_flush, size_t& consumed) {
+        consumed = 0;
+        if (!stream.is_active)
+            return -1;
+        stream.buffer.insert(stream.buffer.end(), data, data + length);
+        stream.bytes_fed += length;
+        if (!is_flush && stream.buffer.size() < stream.retry_size) {
+            consumed = length;
+            return 0;
+        }
+        int status = 0;
+        try {
+            status = decode_stream_items();
+        }
+        catch (const std::runtime_error& err) {
+            DEBUG_LOG(utility::colourize(std::string("failed to load rdb stream : ") + err.what(), utility::cc::RED));
+            stream.is_active = false;
+            return -1;
+        }
+        if (status == 1) {
+            // bytes after the checksum are not part of the rdb
+            size_t trailing = stream.buffer.size() - stream.end_index;
+            consumed = (length > trailing) ? length - trailing : 0;
+            stream.bytes_fed -= length - consumed;
+            stream.is_active = false;
+            DEBUG_LOG("loaded rdb stream : " + std::to_string(stream.bytes_fed) + " bytes, " + std::to_string(stream.keys_loaded) + " keys");
+        }
+        else {
+            consumed = length;
         }
+        return status;
+    }
+
+    // auxiliary field of the rdb stream, empty if it was not in the bytes decoded so far
+    std::string get_stream_aux_field(const std::string& key) const {
+        auto it = stream.aux_fields.find(key);
+        return (it == stream.aux_fields.end()) ? "" : it->second;
+    }
+
+    uint64_t get_stream_bytes_fed() const {
+        return stream.bytes_fed;
+    }
+
+    ~RdbFileReader() {
+        reset();
     }
 private:
-    // struct File {
-    // public :
-    //     File(const std::string& filename, const std::string) {}
-    //     ~File() {}
-    // private:
-    // }
+    // the decoder ran out of bytes : for a file the file is truncated, for a stream the rest has not arrived yet
+    struct EndOfData : std::runtime_error {
+        EndOfData() : std::runtime_error("unexpected end of rdb file") {}
+    };
+
+    struct StreamState {
+        bool is_active = false;
+        bool is_header_read = false;
+        std::vector<uint8_t> buffer;  // bytes of the item being received (and of the items after it)
+        size_t retry_size = 0;  // an incomplete item is decoded again once the buffer reaches this size
+        size_t end_index = 0;  // in buffer, right after the checksum once the stream ended
+        uint64_t bytes_fed = 0;
+        uint64_t keys_loaded = 0;
+        uint64_t crc = 0;
+        size_t db_index = 0;
+        uint64_t expiry_time_ms = UINT64_MAX;
+        std::unordered_map<std::string, std::string> aux_fields;  // eg : repl-stream-db
+    };
+
     int reset() {
-        cursor_index = 0;
-        filename = "";
-        if (rdb_file.is_open()) {
-            rdb_file.close();
+        if (mapped_data != nullptr) {
+            munmap(mapped_data, mapped_size);
         }
+        mapped_data = nullptr;
+        mapped_size = 0;
+        buffer.clear();
+        buffer.shrink_to_fit();
+        decoder = Decoder();
+        file_begin = nullptr;
+        rdb_version = 0;
+        filename = "";
         return 0;
     }
 
-    int read_header_and_metadata() {
-        uint8_t byte;
-        std::string version;
-        // std::stringstream ss;
-        while(peek_next_byte() != 0xFA) {
-            byte = read_byte();
-            version += byte;
-            // ss.str("");
-            // ss << "byte = " << byte << ", version = " << version << ", cursor_index = " << cursor_index; 
-            // DEBUG_LOG(ss.str());
-        }
-
-        // std::string version(value);
-        if (0 != version.find("REDIS")) {
-            DEBUG_LOG("This file does not follow redis protocol or is not a rdb file, filename : " + filename);
+    int map_file() {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return 1;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
             return 1;
         }
-        DEBUG_LOG("Redis version : " + version);
-        DEBUG_LOG("Reading metadata (string encoded key-value pairs): ");
-        
-        std::string key; 
-        std::string value; 
-        while(peek_next_byte() == 0xFA) {
-            read_byte();  // read 0xFA
-            // read_key_value_pair(key, value);
-            key = read_length_encoded_string();
-            value = read_length_encoded_string();
-            DEBUG_LOG("Key : " + key + ", Value : " + value);
+        if (S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+            void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+                mapped_data = data;
+                mapped_size = file_stat.st_size;
+                decoder.cursor = static_cast<const uint8_t*>(data);
+                decoder.end = decoder.cursor + mapped_size;
+                close(fd);
+                return 0;
+            }
         }
-        DEBUG_LOG("exiting read_header_and_metadata()...");
+        // fallback : read the whole file in large chunks
+        const size_t chunk_size = 1 << 20;
+        size_t total = 0;
+        for (;;) {
+            buffer.resize(total + chunk_size);
+            ssize_t num_bytes_read = read(fd, buffer.data() + total, chunk_size);
+            if (num_bytes_read < 0 && errno == EINTR)
+                continue;
+            if (num_bytes_read <= 0) {
+                buffer.resize(total);
+                close(fd);
+                if (num_bytes_read < 0)
+                    return 1;
+                break;
+            }
+            total += num_bytes_read;
+        }
+        decoder.cursor = buffer.data();
+        decoder.end = decoder.cursor + buffer.size();
         return 0;
     }
 
-    int read_database() {
-        if (0xFE != read_byte()) {
-            DEBUG_LOG("Database section should be here.\n");
-            return 1;
+    // bounds checked decoding over [cursor, end), each worker thread uses its own
+    struct Decoder {
+        const uint8_t* cursor = nullptr;
+        const uint8_t* end = nullptr;
+
+        void ensure_available(uint64_t num_bytes) {
+            if (static_cast<uint64_t>(end - cursor) < num_bytes)
+                throw EndOfData();
         }
 
-        uint32_t database_index = read_size_encoded_number();
-        DEBUG_LOG("database_index = " + std::to_string(database_index));
+        uint8_t peek_next_byte() {
+            ensure_available(1);
+            return *cursor;
+        }
 
-        if (0xFB != read_byte()) {
-            DEBUG_LOG("Hash table size information section should be here.\n");
-            return 1;
+        uint8_t read_byte() {
+            ensure_available(1);
+            return *cursor++;
         }
 
-        std::string key;
-        std::string value;
-        uint32_t count_ht_total = 0;
-        uint32_t count_ht_with_expiry = 0;
+        std::string read_length_encoded_string() {
+            uint8_t byte = peek_next_byte();
+            uint8_t msb = byte >> 6;
+            if (msb != 3) { // msb is 0 or 1 or 2
+                uint64_t length = read_size_encoded_number();
+                ensure_available(length);
+                std::string str(reinterpret_cast<const char*>(cursor), length);
+                cursor += length;
+                return str;
+            }
+            // msb = 3
+            byte = read_byte() & 0x3F;  // last 6 bits
+            if (byte == 0) {
+                return std::to_string(static_cast<int8_t>(read_little_endian_number(1)));
+            }
+            else if (byte == 1) {
+                return std::to_string(static_cast<int16_t>(read_little_endian_number(2)));
+            }
+            else if (byte == 2) {
+                return std::to_string(static_cast<int32_t>(read_little_endian_number(4)));
+            }
+            else if (byte == 3) {  // LZF : compressed length, uncompressed length, compressed bytes
+                uint64_t compressed_length = read_size_encoded_number();
+                uint64_t length = read_size_encoded_number();
+                ensure_available(compressed_length);
+                std::string str(length, '\0');
+                if (0 != lzf::decompress(cursor, compressed_length, reinterpret_cast<uint8_t*>(str.data()), length))
+                    throw std::runtime_error("corrupt LZF compressed string");
+                cursor += compressed_length;
+                return str;
+            }
+            throw std::runtime_error("Invalid string encoding");
+        }
 
-        uint32_t size_hash_table_total = read_size_encoded_number();
-        uint32_t size_hash_table_with_expiry = read_size_encoded_number();
+        // moves past a length encoded string without building it
+        void skip_length_encoded_string() {
+            uint8_t byte = peek_next_byte();
+            if ((byte >> 6) != 3) {
+                uint64_t length = read_size_encoded_number();
+                ensure_available(length);
+                cursor += length;
+                return;
+            }
+            byte = read_byte() & 0x3F;
+            if (byte <= 2) {
+                uint64_t num_bytes = 1ULL << byte;  // 1, 2 or 4 bytes integer
+                ensure_available(num_bytes);
+                cursor += num_bytes;
+            }
+            else if (byte == 3) {  // LZF : compressed length, uncompressed length, compressed bytes
+                uint64_t compressed_length = read_size_encoded_number();
+                read_size_encoded_number();
+                ensure_available(compressed_length);
+                cursor += compressed_length;
+            }
+            else {
+                throw std::runtime_error("Invalid string encoding");
+            }
+        }
 
-        std::stringstream ss;  
-        ss << "size_hash_table_total = " << size_hash_table_total << ", size_hash_table_with_expiry = " << size_hash_table_with_expiry;
-        DEBUG_LOG(ss.str());
+        uint64_t read_size_encoded_number() {
+            uint8_t byte = read_byte();
+            uint8_t msb = byte >> 6;
 
-        for(uint32_t i = 0; i < size_hash_table_total; i++) {
-            uint8_t byte = peek_next_byte();
-            uint64_t expiry_time_ms = UINT64_MAX;
+            if (msb == 0x00) {
+                return byte & 0x3F;  // last 6 bits
+            }
+            if (msb == 0x01) {
+                return (static_cast<uint64_t>(byte & 0x3F) << 8) | read_byte();  // 14 bits
+            }
+            if (byte == 0x80 || byte == 0x81) {  // 32 or 64 bits big endian
+                int num_bytes = (byte == 0x80) ? 4 : 8;
+                ensure_available(num_bytes);
+                uint64_t length = 0;
+                for (int i = 0; i < num_bytes; i++)
+                    length = (length << 8) | cursor[i];
+                cursor += num_bytes;
+                return length;
+            }
+            throw std::runtime_error("Not a number, but string is stored.");
+        }
 
-            count_ht_total++;
-            if (byte == 0xFC) {
-                read_byte();  // read 0xFC
-                expiry_time_ms = read_little_endian_number(8);
-                count_ht_with_expiry++;
+        // moves past the value of a key value pair; returns 1 if value_type is unknown
+        int skip_value(uint8_t value_type) {
+            switch (static_cast<ValueType>(value_type)) {
+                case ValueType::StringEncoding :
+                case ValueType::HashZipmapEncoding :
+                case ValueType::ListZiplistEncoding :
+                case ValueType::SetIntsetEncoding :
+                case ValueType::ZsetZiplistEncoding :
+                case ValueType::HashZiplistEncoding :
+                case ValueType::HashListpackEncoding :
+                case ValueType::ZsetListpackEncoding :
+                case ValueType::SetListpackEncoding :  // a single string (possibly a compact encoded blob)
+                    skip_length_encoded_string();
+                    return 0;
+                case ValueType::ListEncoding :
+                case ValueType::SetEncoding :
+                case ValueType::ListQuicklistEncoding : {  // count, then strings (ziplists for a quicklist)
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++)
+                        skip_length_encoded_string();
+                    return 0;
+                }
+                case ValueType::HashEncoding : {  // count, then field value pairs
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++) {
+                        skip_length_encoded_string();
+                        skip_length_encoded_string();
+                    }
+                    return 0;
+                }
+                case ValueType::ZsetEncoding : {  // count, then member and score as a length prefixed string
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++) {
+                        skip_length_encoded_string();
+                        uint8_t length = read_byte();
+                        if (length < 253) {  // 253, 254 and 255 stand for nan, +inf and -inf
+                            ensure_available(length);
+                            cursor += length;
+                        }
+                    }
+                    return 0;
+                }
+                case ValueType::Zset2Encoding : {  // count, then member and score as a binary double
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++) {
+                        skip_length_encoded_string();
+                        ensure_available(8);
+                        cursor += 8;
+                    }
+                    return 0;
+                }
+                case ValueType::ListQuicklist2Encoding : {  // count, then container type and node
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++) {
+                        read_size_encoded_number();
+                        skip_length_encoded_string();
+                    }
+                    return 0;
+                }
+                case ValueType::StreamListpacksEncoding :
+                case ValueType::StreamListpacks2Encoding :
+                case ValueType::StreamListpacks3Encoding : {  // nodes, metadata, then consumer groups
+                    uint64_t num_nodes = read_size_encoded_number();
+                    for (uint64_t i = 0; i < num_nodes; i++) {
+                        skip_length_encoded_string();  // master ID
+                        skip_length_encoded_string();  // listpack
+                    }
+                    int num_metadata = (value_type == static_cast<uint8_t>(ValueType::StreamListpacksEncoding)) ? 3 : 8;
+                    for (int i = 0; i < num_metadata; i++)
+                        read_size_encoded_number();
+                    uint64_t num_groups = read_size_encoded_number();
+                    for (uint64_t i = 0; i < num_groups; i++) {
+                        skip_length_encoded_string();
+                        read_size_encoded_number();
+                        read_size_encoded_number();
+                        if (value_type != static_cast<uint8_t>(ValueType::StreamListpacksEncoding))
+                            read_size_encoded_number();  // entries read
+                        uint64_t pel_size = read_size_encoded_number();
+                        for (uint64_t j = 0; j < pel_size; j++) {
+                            ensure_available(16 + 8);  // ID and delivery time
+                            cursor += 16 + 8;
+                            read_size_encoded_number();
+                        }
+                        uint64_t num_consumers = read_size_encoded_number();
+                        for (uint64_t j = 0; j < num_consumers; j++) {
+                            skip_length_encoded_string();
+                            uint64_t num_times = (value_type == static_cast<uint8_t>(ValueType::StreamListpacks3Encoding)) ? 2 : 1;
+                            ensure_available(8 * num_times);
+                            cursor += 8 * num_times;
+                            uint64_t consumer_pel_size = read_size_encoded_number();
+                            ensure_available(16 * consumer_pel_size);
+                            cursor += 16 * consumer_pel_size;
+                        }
+                    }
+                    return 0;
+                }
+                default :
+                    return 1;
             }
-            else if (byte == 0xFD) {
-                read_byte();  // read 0xFD
-                expiry_time_ms = read_little_endian_number(4);
-                count_ht_with_expiry++;
+        }
+
+        // decodes a list value of any list encoding
+        std::deque<std::string> read_list(uint8_t value_type) {
+            std::deque<std::string> list;
+            auto on_element = [&list](std::string&& element) {
+                list.push_back(std::move(element));
+            };
+            switch (static_cast<ValueType>(value_type)) {
+                case ValueType::ListEncoding : {
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++)
+                        list.push_back(read_length_encoded_string());
+                    break;
+                }
+                case ValueType::ListZiplistEncoding :
+                    ziplist::decode(read_length_encoded_string(), on_element);
+                    break;
+                case ValueType::ListQuicklistEncoding : {
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++)
+                        ziplist::decode(read_length_encoded_string(), on_element);
+                    break;
+                }
+                case ValueType::ListQuicklist2Encoding : {
+                    uint64_t count = read_size_encoded_number();
+                    for (uint64_t i = 0; i < count; i++) {
+                        uint64_t container = read_size_encoded_number();
+                        if (container == 1)  // plain node, a single large element
+                            list.push_back(read_length_encoded_string());
+                        else if (container == 2)  // packed node, a listpack
+                            listpack::decode(read_length_encoded_string(), on_element);
+                        else
+                            throw std::runtime_error("Invalid quicklist container type");
+                    }
+                    break;
+                }
+                default :
+                    throw std::runtime_error("Not a list value type");
             }
-            else if (byte == static_cast<uint8_t>(ValueType::StringEncoding)) {}
-            else {
-                throw std::runtime_error("\nNot supported valueType for value in key, value pair\n");
+            return list;
+        }
+
+        // decodes a stream value (STREAM_LISTPACKS, _2 or _3) : entries marked deleted in their node are dropped,
+        // consumer groups get their PEL back with the consumer owning each entry
+        RedisStream read_stream(uint8_t value_type) {
+            bool is_v1 = (value_type == static_cast<uint8_t>(ValueType::StreamListpacksEncoding));
+            RedisStream stream;
+            std::vector<std::string> elements;
+            uint64_t num_nodes = read_size_encoded_number();
+            for (uint64_t i = 0; i < num_nodes; i++) {
+                std::string master_key = read_length_encoded_string();
+                if (master_key.length() != 16)
+                    throw std::runtime_error("corrupt stream node key");
+                StreamID master_id = decode_stream_id(reinterpret_cast<const uint8_t*>(master_key.data()));
+                elements.clear();
+                listpack::decode(read_length_encoded_string(), [&elements](std::string&& element) {
+                    elements.push_back(std::move(element));
+                });
+                read_stream_node(master_id, elements, stream);
             }
-            read_key_value_pair(key, value);
-            std::stringstream ss;  
-            ss << "key : " << key << ", val : " << value << ", expiry : " << expiry_time_ms;
-            DEBUG_LOG(ss.str());
-            redis_data_store_obj.set_kv(key, value, expiry_time_ms);
+            uint64_t length = read_size_encoded_number();
+            StreamID last_id;
+            last_id.ms = read_size_encoded_number();
+            last_id.seq = read_size_encoded_number();
+            if (!is_v1) {
+                for (int i = 0; i < 5; i++)  // first ID, max deleted entry ID and entries added are not tracked
+                    read_size_encoded_number();
+            }
+            if (length != stream.size() || last_id < stream.get_last_id())
+                throw std::runtime_error("corrupt stream metadata");
+            stream.set_last_id(last_id);
+
+            uint64_t num_groups = read_size_encoded_number();
+            for (uint64_t i = 0; i < num_groups; i++) {
+                std::string group_name = read_length_encoded_string();
+                StreamID last_delivered_id;
+                last_delivered_id.ms = read_size_encoded_number();
+                last_delivered_id.seq = read_size_encoded_number();
+                if (!is_v1)
+                    read_size_encoded_number();  // entries read
+                if (0 != stream.create_group(group_name, last_delivered_id))
+                    throw std::runtime_error("duplicated stream consumer group");
+                StreamConsumerGroup& group = *stream.get_group(group_name);
+                uint64_t pel_size = read_size_encoded_number();
+                for (uint64_t j = 0; j < pel_size; j++) {
+                    StreamID id = read_stream_id();
+                    StreamPendingEntry& pending_entry = group.pending_entries[id];
+                    pending_entry.delivery_time_ms = read_little_endian_number(8);
+                    pending_entry.delivery_count = read_size_encoded_number();
+                }
+                uint64_t num_consumers = read_size_encoded_number();
+                for (uint64_t j = 0; j < num_consumers; j++) {
+                    std::string consumer_name = read_length_encoded_string();
+                    StreamConsumer& consumer = group.consumers[consumer_name];
+                    consumer.seen_time_ms = read_little_endian_number(8);
+                    if (value_type == static_cast<uint8_t>(ValueType::StreamListpacks3Encoding))
+                        read_little_endian_number(8);  // active time
+                    uint64_t consumer_pel_size = read_size_encoded_number();
+                    for (uint64_t k = 0; k < consumer_pel_size; k++) {
+                        StreamID id = read_stream_id();
+                        auto it = group.pending_entries.find(id);
+                        if (it == group.pending_entries.end() || !it->second.consumer_name.empty())
+                            throw std::runtime_error("corrupt stream consumer PEL");
+                        it->second.consumer_name = consumer_name;
+                        consumer.pending_ids.insert(id);
+                    }
+                }
+                for (auto& [id, pending_entry] : group.pending_entries) {
+                    if (pending_entry.consumer_name.empty())
+                        throw std::runtime_error("stream PEL entry without consumer");
+                }
+            }
+            return stream;
         }
 
-        if (count_ht_total == size_hash_table_total)
-            DEBUG_LOG("read all keys from database file");
+        // appends the live entries of a node listpack (see RdbFileWriter::on_stream()) to stream
+        static void read_stream_node(const StreamID& master_id, const std::vector<std::string>& elements, RedisStream& stream) {
+            size_t index = 0;
+            auto next = [&]() -> const std::string& {
+                if (index >= elements.size())
+                    throw std::runtime_error("corrupt stream node");
+                return elements[index++];
+            };
+            auto next_integer = [&]() {
+                int64_t value = 0;
+                if (!listpack::parseInteger(next(), value))
+                    throw std::runtime_error("corrupt stream node");
+                return value;
+            };
+            int64_t count = next_integer();
+            int64_t deleted_count = next_integer();
+            int64_t num_master_fields = next_integer();
+            if (count < 0 || deleted_count < 0 || num_master_fields < 0)
+                throw std::runtime_error("corrupt stream node");
+            std::vector<std::string> master_fields;
+            for (int64_t i = 0; i < num_master_fields; i++)
+                master_fields.push_back(next());
+            next_integer();  // end of the master entry
+            std::vector<std::string> fields_values;
+            for (int64_t i = 0; i < count + deleted_count; i++) {
+                int64_t flags = next_integer();
+                StreamID id;
+                id.ms = master_id.ms + static_cast<uint64_t>(next_integer());
+                id.seq = master_id.seq + static_cast<uint64_t>(next_integer());
+                fields_values.clear();
+                if (flags & 0x02) {  // same fields as the master entry, values only
+                    for (auto& field : master_fields) {
+                        fields_values.push_back(field);
+                        fields_values.push_back(next());
+                    }
+                }
+                else {
+                    int64_t num_fields = next_integer();
+                    if (num_fields < 0)
+                        throw std::runtime_error("corrupt stream node");
+                    for (int64_t j = 0; j < 2 * num_fields; j++)
+                        fields_values.push_back(next());
+                }
+                next_integer();  // number of elements of the entry, to walk backwards
+                if (flags & 0x01)  // deleted
+                    continue;
+                if (id <= stream.get_last_id())
+                    throw std::runtime_error("stream entries out of order");
+                stream.append(id, fields_values);
+            }
+        }
 
-        if (peek_next_byte() == 0xff)
-            DEBUG_LOG("reached end of rdb file.");
+        StreamID read_stream_id() {
+            ensure_available(16);
+            StreamID id = decode_stream_id(cursor);
+            cursor += 16;
+            return id;
+        }
 
-        return 0;
-    }
+        // 128 bits big endian
+        static StreamID decode_stream_id(const uint8_t* bytes) {
+            StreamID id;
+            for (int i = 0; i < 8; i++) {
+                id.ms = (id.ms << 8) | bytes[i];
+                id.seq = (id.seq << 8) | bytes[8 + i];
+            }
+            return id;
+        }
 
-    int read_key_value_pair(std::string& key, std::string& value) {
-        uint8_t byte = read_byte();
-        // std::stringstream ss;  
-        // ss << "byte = " << byte;
-        // if (byte == 0) DEBUG_LOG("byte is 0"); 
-        // DEBUG_LOG(ss.str());
-        switch(byte) {
-            case static_cast<uint8_t>(ValueType::StringEncoding) :  // value is String encoded
-            // DEBUG_LOG("reading string encoded kv pair");
-            key = read_length_encoded_string();
-            value = read_length_encoded_string();
-            break;
-
-            default :
-            DEBUG_LOG("Currently only supporting ValueType = StringEncoding\n");
-            return 1;
+        uint64_t read_little_endian_number(int num_bytes) {
+            ensure_available(num_bytes);
+            uint64_t number = 0;  // reads max 8 bytes number
+            for(int i = 0; i < num_bytes; i++) {
+                number |= static_cast<uint64_t>(cursor[i]) << (i * 8);
+            }
+            cursor += num_bytes;
+            return number;
         }
-        return 0;
-    }
+    };
 
-    uint8_t peek_next_byte() {
-        std::streampos currentpos = rdb_file.tellg();
-        uint8_t byte = read_byte();
-        cursor_index -= 1;
-        rdb_file.seekg(currentpos);
-        // std::stringstream ss;  
-        // ss << "byte read = \'" << byte << "\'" << ", cursor_index = " << cursor_index;
-        // DEBUG_LOG(ss.str());
-        return byte;
-    }
+    // a key value pair located by the index pass, [begin, end) covers value type, key and value
+    struct IndexedEntry {
+        const uint8_t* begin;
+        const uint8_t* end;
+        uint64_t expiry_time_ms;
+    };
+
+    int read_header_and_metadata() {
+        // "REDIS" followed by 4 version digits
+        const size_t header_length = 9;
+        file_begin = decoder.cursor;
+        decoder.ensure_available(header_length);
+        std::string version(reinterpret_cast<const char*>(decoder.cursor), header_length);
+        decoder.cursor += header_length;
 
-    uint8_t read_byte() {
-        uint8_t byte;
-        rdb_file.read(reinterpret_cast<char*>(&byte), 1);
-        if(rdb_file.gcount() != 1) {
-            DEBUG_LOG("Error reading data from " + filename);
+        if (0 != version.find("REDIS")) {
+            DEBUG_LOG("This file does not follow redis protocol or is not a rdb file, filename : " + filename);
             return 1;
         }
-        cursor_index += 1;
-        return byte;
+        rdb_version = std::atoi(version.c_str() + 5);
+        DEBUG_LOG("Redis version : " + version);
+        DEBUG_LOG("Reading metadata (string encoded key-value pairs): ");
+
+        std::string key;
+        std::string value;
+        while(decoder.peek_next_byte() == 0xFA) {
+            decoder.read_byte();  // read 0xFA
+            key = decoder.read_length_encoded_string();
+            value = decoder.read_length_encoded_string();
+            DEBUG_LOG("Key : " + key + ", Value : " + value);
+        }
+        DEBUG_LOG("exiting read_header_and_metadata()...");
+        return 0;
     }
 
-    std::string read_length_encoded_string() {
-        std::string str;
-        uint8_t byte = peek_next_byte();
-        uint8_t msb = byte >> 6;
-        if (msb != 3) { // msb is 0 or 1 or 2
-            uint32_t length = read_size_encoded_number();
-            for(uint32_t i = 0; i < length; i++) {
-                str += static_cast<char>(read_byte());
+    int read_database() {
+        const bool parallel = std::thread::hardware_concurrency() > 1;
+        // with a single hardware thread, small chunks are decoded on the main thread right after indexing,
+        // while their bytes are still in cache
+        const size_t chunk_size = parallel ? (1 << 16) : (1 << 10);  // entries decoded per task
+        const size_t max_in_flight = parallel ? std::thread::hardware_concurrency() : 0;
+        const auto launch_policy = parallel ? std::launch::async : std::launch::deferred;
+        // the checksum normally covers everything but the last 8 bytes, checked when the end of file is reached
+        const uint8_t* checksummed_end = (decoder.end - file_begin >= 8) ? decoder.end - 8 : decoder.end;
+        std::future<uint64_t> checksum_future = std::async(launch_policy, crc64::update, 0, file_begin, checksummed_end - file_begin);
+        std::deque<std::future<std::vector<LoadedKeyValue>>> in_flight;
+        std::vector<IndexedEntry> chunk;
+        uint64_t count_keys = 0;
+        uint64_t expiry_time_ms = UINT64_MAX;
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        auto submit_chunk = [&]() {
+            if (progress != nullptr) {
+                progress->bytes_loaded.store(decoder.cursor - file_begin, std::memory_order_relaxed);
+                progress->keys_loaded.store(count_keys, std::memory_order_relaxed);
             }
-        }
-        else {  // msb = 3
-            byte = read_byte() & 0x3F;  // last 6 bits
-             if (byte == 0) {
-                str = std::to_string(read_little_endian_number(1));
+            if (chunk.empty())
+                return;
+            in_flight.push_back(std::async(launch_policy, decode_chunk, std::move(chunk), now_ms));
+            chunk = std::vector<IndexedEntry>();
+            chunk.reserve(chunk_size);
+            if (in_flight.size() > max_in_flight) {
+                redis_data_store_obj.bulk_set_kv(in_flight.front().get());
+                in_flight.pop_front();
             }
-            else if (byte == 1) {
-                str = std::to_string(read_little_endian_number(2));
+        };
+        chunk.reserve(chunk_size);
+
+        for (;;) {
+            uint8_t opcode = decoder.read_byte();
+            if (opcode == 0xFF) {  // end of file, followed by 8 bytes checksum
+                DEBUG_LOG("reached end of rdb file.");
+                if (rdb_version >= 5)  // older versions have no checksum
+                    verify_checksum(checksummed_end, checksum_future);
+                break;
             }
-            else if (byte == 2) {
-                str = std::to_string(read_little_endian_number(4));
+            else if (opcode == 0xFE) {  // database selector, keys up to the next one belong to this database
+                uint64_t database_index = decoder.read_size_encoded_number();
+                DEBUG_LOG("database_index = " + std::to_string(database_index));
+                if (database_index >= RedisDataStore::get_database_count())
+                    throw std::runtime_error("database index " + std::to_string(database_index) + " is out of range");
+                // keys decoded so far go to the previous database
+                submit_chunk();
+                while (!in_flight.empty()) {
+                    redis_data_store_obj.bulk_set_kv(in_flight.front().get());
+                    in_flight.pop_front();
+                }
+                redis_data_store_obj.select_db(database_index);
             }
-            else if (byte == 3) {  // LZF compression
-                throw std::runtime_error("\nInvalid, compression is not expected in this project.");
+            else if (opcode == 0xFB) {  // hash table sizes, used to pre-size the keyspace
+                uint64_t size_hash_table_total = decoder.read_size_encoded_number();
+                uint64_t size_hash_table_with_expiry = decoder.read_size_encoded_number();
+                std::stringstream ss;
+                ss << "size_hash_table_total = " << size_hash_table_total << ", size_hash_table_with_expiry = " << size_hash_table_with_expiry;
+                DEBUG_LOG(ss.str());
+                redis_data_store_obj.reserve_keys(size_hash_table_total);
+            }
+            else if (opcode == 0xFA) {  // auxiliary field
+                decoder.skip_length_encoded_string();
+                decoder.skip_length_encoded_string();
+            }
+            else if (opcode == 0xFC) {  // expiry in milliseconds, applies to the next key
+                expiry_time_ms = decoder.read_little_endian_number(8);
+            }
+            else if (opcode == 0xFD) {  // expiry in seconds, applies to the next key
+                expiry_time_ms = decoder.read_little_endian_number(4) * 1000;
+            }
+            else {
+                // opcode is the value type of a key value pair
+                const uint8_t* entry_begin = decoder.cursor - 1;
+                if (0 != skip_key_value_pair(opcode))
+                    throw std::runtime_error("Not supported valueType for value in key, value pair");
+                chunk.push_back({entry_begin, decoder.cursor, expiry_time_ms});
+                expiry_time_ms = UINT64_MAX;
+                count_keys++;
+                if (chunk.size() == chunk_size)
+                    submit_chunk();
             }
         }
-        // std::stringstream ss;  
-        // ss << "Parsed string, length = " << str.length() << ", str = " << str;
-        // DEBUG_LOG(ss.str());
-        return str;
-    }
+        submit_chunk();
+        while (!in_flight.empty()) {
+            redis_data_store_obj.bulk_set_kv(in_flight.front().get());
+            in_flight.pop_front();
+        }
 
-    uint32_t read_size_encoded_number() {
-        uint8_t byte = read_byte();
-        uint8_t msb = byte >> 6;
-        uint32_t length = 0;
+        DEBUG_LOG("read " + std::to_string(count_keys) + " keys from database file");
+        return 0;
+    }
 
-        if (msb == 0x00) {
-            length = byte & 0x3F;  // last 6 bits
-        }
-        else if (msb == 0x01) {
-            length = byte & 0x3F;
-            length = length << 8;
-            length = length | read_byte();  // 14 bits
+    // throws if the checksum following the end of file opcode does not match the file; a stored 0 means the writer
+    // did not compute one
+    void verify_checksum(const uint8_t* checksummed_end, std::future<uint64_t>& checksum_future) {
+        const uint8_t* checksum_begin = decoder.cursor;
+        uint64_t expected = decoder.read_little_endian_number(8);
+        if (expected == 0)
+            return;
+        uint64_t actual = (checksum_begin == checksummed_end) ? checksum_future.get()
+                                                              : crc64::update(0, file_begin, checksum_begin - file_begin);
+        if (actual != expected) {
+            std::stringstream ss;
+            ss << "wrong rdb checksum, expected " << std::hex << expected << ", got " << actual;
+            throw std::runtime_error(ss.str());
         }
-        else if (msb == 0x10) {
-            for (int i = 0; i < 4; i++) {
-                length = length << 8;
-                length = length | read_byte();
+        DEBUG_LOG("rdb checksum verified");
+    }
+
+    // decodes the complete items at the start of stream.buffer and drops their bytes; returns 1 once the rdb ended
+    // (stream.end_index is set), 0 if the last item is incomplete, throws if the bytes are not a valid rdb
+    int decode_stream_items() {
+        const uint8_t* begin = stream.buffer.data();
+        decoder.cursor = begin;
+        decoder.end = begin + stream.buffer.size();
+        std::vector<IndexedEntry> chunk;
+        int status = 0;
+        const uint8_t* item_begin = decoder.cursor;
+        try {
+            for (;;) {
+                item_begin = decoder.cursor;
+                if (!stream.is_header_read) {
+                    decoder.ensure_available(9);
+                    if (0 != memcmp(decoder.cursor, "REDIS", 5))
+                        throw std::runtime_error("not an rdb payload");
+                    rdb_version = std::atoi(std::string(reinterpret_cast<const char*>(decoder.cursor) + 5, 4).c_str());
+                    decoder.cursor += 9;
+                    stream.is_header_read = true;
+                }
+                else {
+                    uint8_t opcode = decoder.read_byte();
+                    if (opcode == 0xFF) {
+                        stream.crc = crc64::update(stream.crc, item_begin, 1);
+                        if (rdb_version >= 5) {
+                            uint64_t expected = decoder.read_little_endian_number(8);
+                            if (expected != 0 && expected != stream.crc) {
+                                std::stringstream ss;
+                                ss << "wrong rdb checksum, expected " << std::hex << expected << ", got " << stream.crc;
+                                throw std::runtime_error(ss.str());
+                            }
+                        }
+                        stream.end_index = decoder.cursor - begin;
+                        status = 1;
+                        break;
+                    }
+                    else if (opcode == 0xFE) {
+                        uint64_t database_index = decoder.read_size_encoded_number();
+                        if (database_index >= RedisDataStore::get_database_count())
+                            throw std::runtime_error("database index " + std::to_string(database_index) + " is out of range");
+                        // keys decoded so far go to the previous database
+                        insert_stream_chunk(chunk);
+                        stream.db_index = database_index;
+                    }
+                    else if (opcode == 0xFB) {
+                        decoder.read_size_encoded_number();
+                        decoder.read_size_encoded_number();
+                    }
+                    else if (opcode == 0xFA) {
+                        std::string key = decoder.read_length_encoded_string();
+                        stream.aux_fields[key] = decoder.read_length_encoded_string();
+                    }
+                    else if (opcode == 0xFC) {
+                        stream.expiry_time_ms = decoder.read_little_endian_number(8);
+                    }
+                    else if (opcode == 0xFD) {
+                        stream.expiry_time_ms = decoder.read_little_endian_number(4) * 1000;
+                    }
+                    else {
+                        if (0 != skip_key_value_pair(opcode))
+                            throw std::runtime_error("Not supported valueType for value in key, value pair");
+                        chunk.push_back({item_begin, decoder.cursor, stream.expiry_time_ms});
+                        stream.expiry_time_ms = UINT64_MAX;
+                        stream.keys_loaded++;
+                    }
+                }
+                stream.crc = crc64::update(stream.crc, item_begin, decoder.cursor - item_begin);
             }
         }
-        else if (msb == 0x11) {
-            std::runtime_error("\nNot a number, but string is stored.");
+        catch (const EndOfData&) {
+            decoder.cursor = item_begin;  // decoded again once more bytes arrived
         }
-        // std::stringstream ss;  
-        // ss << "length = " << length;
-        // DEBUG_LOG(ss.str());
-        return length;
+        // entries point into the buffer, they are decoded before its bytes are dropped
+        insert_stream_chunk(chunk);
+        if (status == 1)
+            return 1;
+        size_t used = item_begin - begin;
+        stream.buffer.erase(stream.buffer.begin(), stream.buffer.begin() + used);
+        // a large item is decoded again only once its buffered bytes doubled, so it costs linear time overall
+        stream.retry_size = 2 * stream.buffer.size();
+        return 0;
+    }
+
+    void insert_stream_chunk(std::vector<IndexedEntry>& chunk) {
+        if (chunk.empty())
+            return;
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        redis_data_store_obj.bulk_set_staged_kv(stream.db_index, decode_chunk(std::move(chunk), now_ms));
+        chunk = std::vector<IndexedEntry>();
     }
 
-    uint64_t read_little_endian_number(int num_bytes) {
-        uint64_t number = 0;  // reads max 8 bytes number
-        for(int i = 0; i < num_bytes; i++) {
-            uint64_t temp = read_byte();
-            temp = temp << (i * 8);
-            number = number | temp;
-        }
-        // std::stringstream ss;  
-        // ss << "num_bytes = " << num_bytes << ", number = " << number;
-        // DEBUG_LOG(ss.str());
-        return number;
+    int skip_key_value_pair(uint8_t value_type) {
+        decoder.skip_length_encoded_string();  // key
+        if (0 != decoder.skip_value(value_type)) {
+            DEBUG_LOG("Not supported value type : " + std::to_string(value_type));
+            return 1;
+        }
+        return 0;
+    }
+
+    // runs on a worker thread; keys already expired are dropped. Lists and streams are decoded, sets, zsets and
+    // hashes keep the bytes following their key as they are in the file
+    static std::vector<LoadedKeyValue> decode_chunk(std::vector<IndexedEntry> entries, uint64_t now_ms) {
+        std::vector<LoadedKeyValue> result;
+        result.reserve(entries.size());
+        for (auto& entry : entries) {
+            if (entry.expiry_time_ms <= now_ms)
+                continue;
+            Decoder entry_decoder{entry.begin, entry.end};
+            uint8_t value_type = entry_decoder.read_byte();
+            LoadedKeyValue loaded;
+            loaded.key = entry_decoder.read_length_encoded_string();
+            loaded.expiry_time_ms = entry.expiry_time_ms;
+            switch (static_cast<ValueType>(value_type)) {
+                case ValueType::StringEncoding :
+                    loaded.value = entry_decoder.read_length_encoded_string();
+                    break;
+                case ValueType::ListEncoding :
+                case ValueType::ListZiplistEncoding :
+                case ValueType::ListQuicklistEncoding :
+                case ValueType::ListQuicklist2Encoding :
+                    loaded.kind = LoadedKeyValue::Kind::List;
+                    loaded.list = entry_decoder.read_list(value_type);
+                    break;
+                case ValueType::StreamListpacksEncoding :
+                case ValueType::StreamListpacks2Encoding :
+                case ValueType::StreamListpacks3Encoding :
+                    loaded.kind = LoadedKeyValue::Kind::Stream;
+                    loaded.stream = entry_decoder.read_stream(value_type);
+                    break;
+                default :
+                    loaded.kind = LoadedKeyValue::Kind::Encoded;
+                    loaded.value_type = value_type;
+                    loaded.value.assign(reinterpret_cast<const char*>(entry_decoder.cursor), entry.end - entry_decoder.cursor);
+                    break;
+            }
+            result.push_back(std::move(loaded));
+        }
+        return result;
     }
 
-    size_t cursor_index;
     std::string filename;
-    std::ifstream rdb_file;
+    void* mapped_data = nullptr;  // set if the file is mmap'ed
+    size_t mapped_size = 0;
+    std::vector<uint8_t> buffer;  // file content if it could not be mmap'ed
+    Decoder decoder;  // main thread decoder over the whole file
+    const uint8_t* file_begin = nullptr;
+    int rdb_version = 0;
+    Progress* progress = nullptr;
+    StreamState stream;
     RedisDataStore redis_data_store_obj;
 };
 
-#endif  // RDBFILEREADER_HPP
\ No newline at end of file
+#endif  // RDBFILEREADER_HPP
@@ -0,0 +1,461 @@
+#ifndef RDBFILEWRITER_HPP
+#define RDBFILEWRITER_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "RedisStream.hpp"
+#include "Lzf.hpp"
+#include "Crc64.hpp"
+#include "Listpack.hpp"
+#include "RdbValueType.hpp"
+#include "utility.hpp"
+
+/*
+  Serializes the keyspace to an RDB (version 11) file : output is buffered and written with large write() calls to
+  a temporary file, which is fsync'ed and renamed over the target so a crash never leaves a truncated snapshot.
+  The CRC64 checksum trailing the file is updated over each buffer right before it is written.
+  writeFile() saves a whole keyspace that is kept consistent by the caller (keyspace lock held, or a forked child);
+  begin(), the visitor callbacks and finish() let the keyspace feed entries incrementally (forkless snapshot).
+  writeToFd() streams the same bytes to an open descriptor instead of a file (diskless replication).
+*/
+class RdbFileWriter {
+public:
+    // called every progress_interval keys with the number of keys written so far
+    typedef std::function<void(uint64_t)> ProgressCallback;
+    static constexpr uint64_t progress_interval = 1024;
+
+    explicit RdbFileWriter(ProgressCallback on_progress = nullptr) : on_progress(std::move(on_progress)) {}
+
+    ~RdbFileWriter() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // returns 0 on success, 1 on failure (the previous file at filename is left untouched)
+    template <typename Store>
+    int writeFile(const std::string& filename, const Store& redis_data_store_obj) {
+        if (0 != begin(filename))
+            return 1;
+        if (0 != redis_data_store_obj.visit_keyspace_unlocked(*this)) {
+            abort();
+            return 1;
+        }
+        return finish();
+    }
+
+    // same as writeFile() to an open descriptor (eg : a pipe), which is left open; nothing is fsync'ed or renamed.
+    // aux_fields are written after the standard metadata (eg : repl-stream-db for a replica loading the snapshot)
+    template <typename Store>
+    int writeToFd(int output_fd, const Store& redis_data_store_obj, const std::vector<std::pair<std::string, std::string>>& aux_fields = {}) {
+        fd = output_fd;
+        buffer.reserve(buffer_size);
+        keys_written = 0;
+        checksum = 0;
+        write_header_and_metadata();
+        for (auto& [key, value] : aux_fields)
+            write_aux_field(key, value);
+        int status = 0;
+        if (0 != redis_data_store_obj.visit_keyspace_unlocked(*this) || 0 != write_end_of_file() || 0 != flush_buffer())
+            status = 1;
+        fd = -1;
+        return status;
+    }
+
+    // opens the temporary file and writes header and metadata; returns 0 on success, 1 on failure
+    int begin(const std::string& filename) {
+        this->filename = filename;
+        temp_filename = filename + ".temp-" + std::to_string(getpid());
+        fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            DEBUG_LOG(utility::colourize("failed to open " + temp_filename + " : " + strerror(errno), utility::cc::RED));
+            return 1;
+        }
+        buffer.reserve(buffer_size);
+        keys_written = 0;
+        checksum = 0;
+        write_header_and_metadata();
+        return 0;
+    }
+
+    // writes the end of file, makes the file durable and renames it over the target; returns 0 on success, 1 on failure
+    int finish() {
+        int status = 0;
+        if (0 != write_end_of_file() || 0 != flush_buffer()) {
+            status = 1;
+        }
+        else if (0 != fsync(fd)) {
+            DEBUG_LOG(utility::colourize("fsync failed for " + temp_filename + " : " + strerror(errno), utility::cc::RED));
+            status = 1;
+        }
+        if (0 != close(fd))
+            status = 1;
+        fd = -1;
+
+        if (status == 0 && 0 != rename(temp_filename.c_str(), filename.c_str())) {
+            DEBUG_LOG(utility::colourize("failed to rename " + temp_filename + " to " + filename + " : " + strerror(errno), utility::cc::RED));
+            status = 1;
+        }
+        if (status != 0) {
+            unlink(temp_filename.c_str());
+            return 1;
+        }
+        fsync_parent_directory(filename);
+        DEBUG_LOG("saved " + std::to_string(keys_written) + " keys to " + filename);
+        return 0;
+    }
+
+    // drops a snapshot started by begin()
+    void abort() {
+        if (fd < 0)
+            return;
+        close(fd);
+        fd = -1;
+        unlink(temp_filename.c_str());
+    }
+
+    uint64_t getKeysWritten() const {
+        return keys_written;
+    }
+
+    // visitor callbacks of RedisDataStore::visit_keyspace_unlocked()
+
+    // keys written next belong to database db_index; a database may get several sections
+    int on_database(uint64_t db_index, uint64_t keys_total, uint64_t expires_total) {
+        write_byte(0xFE);  // database selector
+        write_size_encoded_number(db_index);
+        write_byte(0xFB);  // hash table sizes, used by loaders to pre-size their keyspace
+        write_size_encoded_number(keys_total);
+        write_size_encoded_number(expires_total);
+        return 0;
+    }
+
+    int on_string(const std::string& key, const std::string& value, uint64_t expiry_time_ms) {
+        write_expiry(expiry_time_ms);
+        write_byte(static_cast<uint8_t>(ValueType::StringEncoding));
+        write_string(key);
+        write_string(value);
+        return on_key_written();
+    }
+
+    // lists are saved as a quicklist of listpack nodes, each node holding up to list_node_max_entries elements or
+    // about list_node_max_bytes bytes, like redis does with its default list-max-listpack-size
+    int on_list(const std::string& key, const std::deque<std::string>& list, uint64_t expiry_time_ms) {
+        write_expiry(expiry_time_ms);
+        write_byte(static_cast<uint8_t>(ValueType::ListQuicklist2Encoding));
+        write_string(key);
+        std::vector<std::pair<size_t, size_t>> nodes;  // [begin, end) element ranges
+        size_t node_begin = 0, node_bytes = 0;
+        for (size_t i = 0; i < list.size(); i++) {
+            node_bytes += list[i].length() + listpack_entry_overhead;
+            if (i + 1 - node_begin >= list_node_max_entries || node_bytes >= list_node_max_bytes) {
+                nodes.emplace_back(node_begin, i + 1);
+                node_begin = i + 1;
+                node_bytes = 0;
+            }
+        }
+        if (node_begin < list.size())
+            nodes.emplace_back(node_begin, list.size());
+        write_size_encoded_number(nodes.size());
+        for (auto [begin, end] : nodes) {
+            write_size_encoded_number(quicklist_container_packed);
+            write_string(listpack::encode(list.begin() + begin, list.begin() + end));
+        }
+        return on_key_written();
+    }
+
+    /*
+      streams are saved as STREAM_LISTPACKS_3, the layout redis uses : every node is a listpack starting with a master
+      entry (live count, deleted count, master fields, 0), then each entry as flags, ms and seq deltas against the
+      master ID, the fields unless they are the master fields, the values and the number of elements of the entry.
+      Metadata, consumer groups, their PEL and consumers follow the nodes
+    */
+    int on_stream(const std::string& key, const RedisStream& stream, uint64_t expiry_time_ms) {
+        write_expiry(expiry_time_ms);
+        write_byte(static_cast<uint8_t>(ValueType::StreamListpacks3Encoding));
+        write_string(key);
+        write_size_encoded_number(stream.get_node_count());
+        StreamID first_id;
+        bool is_first_id_set = false;
+        std::vector<std::string> elements;
+        stream.visit_nodes([&](const StreamID& master_id, const std::vector<std::string>& master_fields, const std::vector<StreamEntry>& entries) {
+            uint64_t deleted_count = 0;
+            for (auto& entry : entries) {
+                if (entry.is_deleted) {
+                    deleted_count++;
+                }
+                else if (!is_first_id_set) {
+                    first_id = entry.id;
+                    is_first_id_set = true;
+                }
+            }
+            elements.clear();
+            elements.push_back(std::to_string(entries.size() - deleted_count));
+            elements.push_back(std::to_string(deleted_count));
+            elements.push_back(std::to_string(master_fields.size()));
+            elements.insert(elements.end(), master_fields.begin(), master_fields.end());
+            elements.push_back("0");
+            for (auto& entry : entries) {
+                size_t num_fields = entry.fields_values.size() / 2;
+                bool is_same_fields = (num_fields == master_fields.size());
+                for (size_t i = 0; is_same_fields && i < num_fields; i++)
+                    is_same_fields = (entry.fields_values[2 * i] == master_fields[i]);
+                uint8_t flags = (entry.is_deleted ? stream_flag_deleted : 0) | (is_same_fields ? stream_flag_same_fields : 0);
+                elements.push_back(std::to_string(flags));
+                // deltas wrap around like the unsigned arithmetic of the loader
+                elements.push_back(std::to_string(static_cast<int64_t>(entry.id.ms - master_id.ms)));
+                elements.push_back(std::to_string(static_cast<int64_t>(entry.id.seq - master_id.seq)));
+                if (is_same_fields) {
+                    for (size_t i = 0; i < num_fields; i++)
+                        elements.push_back(entry.fields_values[2 * i + 1]);
+                    elements.push_back(std::to_string(num_fields + 3));
+                }
+                else {
+                    elements.push_back(std::to_string(num_fields));
+                    elements.insert(elements.end(), entry.fields_values.begin(), entry.fields_values.end());
+                    elements.push_back(std::to_string(2 * num_fields + 4));
+                }
+            }
+            write_string(encode_stream_id(master_id));
+            write_string(listpack::encode(elements.begin(), elements.end()));
+            return 0;
+        });
+        StreamID last_id = stream.get_last_id();
+        write_size_encoded_number(stream.size());
+        write_size_encoded_number(last_id.ms);
+        write_size_encoded_number(last_id.seq);
+        write_size_encoded_number(first_id.ms);
+        write_size_encoded_number(first_id.seq);
+        write_size_encoded_number(0);  // max deleted entry ID and entries added are not tracked : 0-0 and the length
+        write_size_encoded_number(0);
+        write_size_encoded_number(stream.size());
+
+        auto& groups = stream.get_groups();
+        write_size_encoded_number(groups.size());
+        for (auto& [group_name, group] : groups) {
+            write_string(group_name);
+            write_size_encoded_number(group.last_delivered_id.ms);
+            write_size_encoded_number(group.last_delivered_id.seq);
+            write_size_encoded_number(UINT64_MAX);  // entries read unknown, redis computes the lag again
+            write_size_encoded_number(group.pending_entries.size());
+            for (auto& [id, pending_entry] : group.pending_entries) {
+                write_raw(encode_stream_id(id));
+                write_little_endian_number(pending_entry.delivery_time_ms, 8);
+                write_size_encoded_number(pending_entry.delivery_count);
+            }
+            write_size_encoded_number(group.consumers.size());
+            for (auto& [consumer_name, consumer] : group.consumers) {
+                write_string(consumer_name);
+                write_little_endian_number(consumer.seen_time_ms, 8);
+                write_little_endian_number(consumer.seen_time_ms, 8);  // active time is not tracked apart
+                write_size_encoded_number(consumer.pending_ids.size());
+                for (auto& id : consumer.pending_ids)
+                    write_raw(encode_stream_id(id));  // the PEL entry is the group's, only the ID is repeated
+            }
+        }
+        return on_key_written();
+    }
+
+    // a set, zset or hash kept in the serialized form it was loaded with, written back unchanged
+    int on_encoded(const std::string& key, uint8_t value_type, const std::string& payload, uint64_t expiry_time_ms) {
+        write_expiry(expiry_time_ms);
+        write_byte(value_type);
+        write_string(key);
+        write_raw(payload);
+        return on_key_written();
+    }
+
+private:
+    void write_header_and_metadata() {
+        write_raw("REDIS0011");
+        write_aux_field("redis-ver", "7.2.0");
+        write_aux_field("redis-bits", std::to_string(sizeof(void*) * 8));
+        write_aux_field("ctime", std::to_string(std::time(nullptr)));
+        write_aux_field("aof-base", "0");
+    }
+
+    int write_end_of_file() {
+        write_byte(0xFF);
+        // checksum covers every byte up to and including 0xFF
+        if (0 != flush_buffer())
+            return -1;
+        write_little_endian_number(checksum, 8);
+        return 0;
+    }
+
+    void write_aux_field(const std::string& key, const std::string& value) {
+        write_byte(0xFA);
+        write_string(key);
+        write_string(value);
+    }
+
+    void write_expiry(uint64_t expiry_time_ms) {
+        if (expiry_time_ms == UINT64_MAX)
+            return;
+        write_byte(0xFC);  // expiry in milliseconds
+        write_little_endian_number(expiry_time_ms, 8);
+    }
+
+    // strings holding a canonical 32 bits integer are stored in integer encoding, longer strings LZF compressed when
+    // that saves at least 4 bytes
+    void write_string(const std::string& str) {
+        int64_t number = 0;
+        if (is_integer_encodable(str, number)) {
+            if (number >= INT8_MIN && number <= INT8_MAX) {
+                write_byte(0xC0);
+                write_little_endian_number(static_cast<uint8_t>(number), 1);
+            }
+            else if (number >= INT16_MIN && number <= INT16_MAX) {
+                write_byte(0xC1);
+                write_little_endian_number(static_cast<uint16_t>(number), 2);
+            }
+            else {
+                write_byte(0xC2);
+                write_little_endian_number(static_cast<uint32_t>(number), 4);
+            }
+            return;
+        }
+        if (str.length() > min_compress_length && 0 == write_compressed_string(str))
+            return;
+        write_size_encoded_number(str.length());
+        write_raw(str);
+    }
+
+    // returns -1 (and writes nothing) if str does not compress well enough
+    int write_compressed_string(const std::string& str) {
+        size_t max_compressed_length = str.length() - 4;
+        if (compress_buffer.size() < max_compressed_length)
+            compress_buffer.resize(max_compressed_length);
+        size_t compressed_length = lzf::compress(reinterpret_cast<const uint8_t*>(str.data()), str.length(),
+                                                 compress_buffer.data(), max_compressed_length);
+        if (compressed_length == 0)
+            return -1;
+        write_byte(0xC3);
+        write_size_encoded_number(compressed_length);
+        write_size_encoded_number(str.length());
+        buffer.append(reinterpret_cast<const char*>(compress_buffer.data()), compressed_length);
+        return 0;
+    }
+
+    // 128 bits big endian, so IDs compare as bytes
+    static std::string encode_stream_id(const StreamID& id) {
+        std::string str(16, '\0');
+        for (int i = 0; i < 8; i++) {
+            str[i] = static_cast<char>(id.ms >> (8 * (7 - i)));
+            str[8 + i] = static_cast<char>(id.seq >> (8 * (7 - i)));
+        }
+        return str;
+    }
+
+    static bool is_integer_encodable(const std::string& str, int64_t& number) {
+        if (str.empty() || str.length() > 11)
+            return false;
+        size_t i = (str[0] == '-') ? 1 : 0;
+        if (i == str.length() || (str[i] == '0' && str.length() > i + 1) || (str == "-0"))
+            return false;  // "-", leading zeros and "-0" would not round trip
+        number = 0;
+        for (; i < str.length(); i++) {
+            if (str[i] < '0' || str[i] > '9')
+                return false;
+            number = number * 10 + (str[i] - '0');
+        }
+        if (str[0] == '-')
+            number = -number;
+        return number >= INT32_MIN && number <= INT32_MAX;
+    }
+
+    void write_size_encoded_number(uint64_t number) {
+        if (number < (1 << 6)) {
+            write_byte(static_cast<uint8_t>(number));
+        }
+        else if (number < (1 << 14)) {
+            write_byte(static_cast<uint8_t>(0x40 | (number >> 8)));
+            write_byte(static_cast<uint8_t>(number & 0xFF));
+        }
+        else {
+            int num_bytes = (number <= UINT32_MAX) ? 4 : 8;  // big endian
+            write_byte((num_bytes == 4) ? 0x80 : 0x81);
+            for (int i = num_bytes - 1; i >= 0; i--)
+                write_byte(static_cast<uint8_t>(number >> (i * 8)));
+        }
+    }
+
+    void write_little_endian_number(uint64_t number, int num_bytes) {
+        for (int i = 0; i < num_bytes; i++)
+            write_byte(static_cast<uint8_t>(number >> (i * 8)));
+    }
+
+    void write_byte(uint8_t byte) {
+        buffer.push_back(static_cast<char>(byte));
+    }
+
+    void write_raw(const std::string& str) {
+        buffer.append(str);
+    }
+
+    int on_key_written() {
+        keys_written++;
+        if (on_progress && keys_written % progress_interval == 0)
+            on_progress(keys_written);
+        if (buffer.size() >= buffer_size)
+            return flush_buffer();
+        return 0;
+    }
+
+    int flush_buffer() {
+        checksum = crc64::update(checksum, reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+        size_t offset = 0;
+        while (offset < buffer.size()) {
+            ssize_t num_bytes_written = write(fd, buffer.data() + offset, buffer.size() - offset);
+            if (num_bytes_written < 0) {
+                if (errno == EINTR)
+                    continue;
+                DEBUG_LOG(utility::colourize(std::string("failed writing rdb file : ") + strerror(errno), utility::cc::RED));
+                return -1;
+            }
+            offset += num_bytes_written;
+        }
+        buffer.clear();
+        return 0;
+    }
+
+    // makes the rename durable, failure only costs durability of the directory entry
+    static void fsync_parent_directory(const std::string& filename) {
+        std::string path = filename;
+        std::string dir = dirname(path.data());
+        int dir_fd = open(dir.c_str(), O_RDONLY);
+        if (dir_fd < 0)
+            return;
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    static constexpr size_t buffer_size = 1 << 20;  // bytes buffered before each write()
+    static constexpr size_t min_compress_length = 20;  // shorter strings are never compressed, same as redis
+    static constexpr size_t list_node_max_entries = 128;
+    static constexpr size_t list_node_max_bytes = 8 << 10;
+    static constexpr size_t listpack_entry_overhead = 2;  // encoding byte and backlen of a short element
+    static constexpr uint64_t quicklist_container_packed = 2;  // node is a listpack (1 would be a single plain element)
+    static constexpr uint8_t stream_flag_deleted = 0x01;
+    static constexpr uint8_t stream_flag_same_fields = 0x02;
+    std::string filename;
+    std::string temp_filename;
+    int fd = -1;
+    std::string buffer;
+    std::vector<uint8_t> compress_buffer;
+    uint64_t keys_written = 0;
+    uint64_t checksum = 0;  // crc64 of the bytes flushed so far
+    ProgressCallback on_progress;
+};
+
+#endif  // RDBFILEWRITER_HPP
@@ -0,0 +1,52 @@
+#ifndef RDBVALUETYPE_HPP
+#define RDBVALUETYPE_HPP
+
+#include <cstdint>
+#include <string>
+
+// value type byte preceding every key in an RDB file
+enum class ValueType : uint8_t {
+    StringEncoding = 0,
+    ListEncoding = 1,
+    SetEncoding = 2,
+    ZsetEncoding = 3,  // scores as decimal strings
+    HashEncoding = 4,
+    Zset2Encoding = 5,  // scores as binary doubles
+    HashZipmapEncoding = 9,
+    ListZiplistEncoding = 10,
+    SetIntsetEncoding = 11,
+    ZsetZiplistEncoding = 12,
+    HashZiplistEncoding = 13,
+    ListQuicklistEncoding = 14,  // nodes are ziplists
+    StreamListpacksEncoding = 15,
+    HashListpackEncoding = 16,
+    ZsetListpackEncoding = 17,
+    ListQuicklist2Encoding = 18,  // nodes are listpacks or plain elements
+    StreamListpacks2Encoding = 19,  // adds first id, max deleted id, entries added and consumer group entries read
+    SetListpackEncoding = 20,
+    StreamListpacks3Encoding = 21  // adds consumer active time
+};
+
+// TYPE of a set, zset or hash value type, "none" for other value types
+inline std::string getValueTypeName(uint8_t value_type) {
+    switch (static_cast<ValueType>(value_type)) {
+        case ValueType::SetEncoding :
+        case ValueType::SetIntsetEncoding :
+        case ValueType::SetListpackEncoding :
+            return "set";
+        case ValueType::ZsetEncoding :
+        case ValueType::Zset2Encoding :
+        case ValueType::ZsetZiplistEncoding :
+        case ValueType::ZsetListpackEncoding :
+            return "zset";
+        case ValueType::HashEncoding :
+        case ValueType::HashZipmapEncoding :
+        case ValueType::HashZiplistEncoding :
+        case ValueType::HashListpackEncoding :
+            return "hash";
+        default :
+            return "none";
+    }
+}
+
+#endif  // RDBVALUETYPE_HPP
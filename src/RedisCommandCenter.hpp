@@ -10,10 +10,25 @@
 #include <chrono>
 #include <ctime>
 #include <cstdint>
+#include <cmath>
+#include <fstream>
+#include <list>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <random>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include "RespParser.hpp"
 #include "RedisDataStore.hpp"
 #include "RdbFileReader.hpp"
+#include "RdbFileWriter.hpp"
 #include "PollManager.hpp"
+#include "PubSub.hpp"
+#include "OutputQueue.hpp"
+#include "AppendOnlyFile.hpp"
+#include "ReplicationBacklog.hpp"
 #include "utility.hpp"
 
 namespace RCC {
@@ -42,21 +57,198 @@ namespace RCC {
     }
 
     static int read_rdb_file() {
-      std::string db_file_path;
-      auto result = getConfigKv("dir");
-      if (result.has_value())
-        db_file_path = *result;
-      result = getConfigKv("dbfilename");
-      if(result)
-        db_file_path += "/" + *result;
       RdbFileReader rdbFileReader;
-      return rdbFileReader.readFile(db_file_path);
+      return rdbFileReader.readFile(getRdbFilePath());
+    }
+
+    // dir/dbfilename, defaults to ./dump.rdb (used by SAVE / BGSAVE when no rdb file was given at startup)
+    static std::string getRdbFilePath() {
+      return getConfigKv("dir").value_or(".") + "/" + getConfigKv("dbfilename").value_or("dump.rdb");
+    }
+
+    // dir/appendfilename, defaults to ./appendonly.aof
+    static std::string getAppendOnlyFilePath() {
+      return getConfigKv("dir").value_or(".") + "/" + getConfigKv("appendfilename").value_or("appendonly.aof");
+    }
+
+    /*
+      The dataset is loaded while the event loop already runs : startLoading() decodes the rdb file (or the rdb
+      preamble of the append only file) on a background thread, meanwhile commands touching the keyspace get
+      -LOADING and INFO reports the progress. checkLoading() (event loop) finishes the load once the thread is done :
+      the commands following an rdb preamble are replayed, then logging to the append only file starts.
+    */
+
+    // filename is empty if there is nothing to load
+    int startLoading(const std::string& filename, bool isAppendOnlyFile, bool isAppendOnly) {
+      loadingStatus.isLoading = true;
+      loadingStatus.filename = filename;
+      loadingStatus.isAppendOnlyFile = isAppendOnlyFile;
+      loadingStatus.isAppendOnly = isAppendOnly;
+      loadingStatus.startTime = std::time(nullptr);
+      loadingStatus.startTimeMs = _getCurrentTimeMs();
+      loadingStatus.tailOffset = 0;
+      if (filename.empty() || (isAppendOnlyFile && !AppendOnlyFile::has_rdb_preamble(filename))) {
+        loadingStatus.isDone = true;  // nothing to decode in background
+        return 0;
+      }
+      loadingStatus.isDone = false;
+      loadingStatus.loader = std::thread([]() {
+        RdbFileReader rdbFileReader(&loadingStatus.progress);
+        loadingStatus.status = rdbFileReader.readFile(loadingStatus.filename, &loadingStatus.tailOffset);
+        loadingStatus.isDone.store(true, std::memory_order_release);
+      });
+      return 0;
+    }
+
+    // returns -1 if the server must not start : the append only file is corrupt or cannot be opened
+    int checkLoading() {
+      if (!loadingStatus.isLoading || !loadingStatus.isDone.load(std::memory_order_acquire))
+        return 0;
+      if (loadingStatus.loader.joinable())
+        loadingStatus.loader.join();
+      loadingStatus.isLoading = false;
+      if (loadingStatus.isAppendOnlyFile) {
+        if (loadingStatus.status != 0) {
+          DEBUG_LOG(utility::colourize("failed to load the rdb preamble of " + loadingStatus.filename, utility::cc::RED));
+          return -1;
+        }
+        if (0 != _replayAppendOnlyFile(loadingStatus.tailOffset))
+          return -1;
+      }
+      else if (!loadingStatus.filename.empty() && loadingStatus.status != 0) {
+        DEBUG_LOG(utility::colourize("starting with an empty dataset, failed to load " + loadingStatus.filename, utility::cc::RED));
+      }
+      if (!loadingStatus.filename.empty()) {
+        DEBUG_LOG("dataset loaded from " + loadingStatus.filename + " in " + std::to_string(_getCurrentTimeMs() - loadingStatus.startTimeMs) + " ms");
+      }
+      std::string errMsg;
+      if (loadingStatus.isAppendOnly && 0 != openAppendOnlyFile(errMsg)) {
+        DEBUG_LOG(utility::colourize("cannot log to the append only file : " + errMsg, utility::cc::RED));
+        return -1;
+      }
+      return 0;
+    }
+
+    // replays the commands of the append only file following its rdb preamble (if any) through the command
+    // pipeline, before the file is opened for logging
+    int _replayAppendOnlyFile(uint64_t tailOffset) {
+      uint64_t numCommands = 0;
+      int replaySocketFD = -1;
+      uint64_t startTimeMs = _getCurrentTimeMs();
+      int status = AppendOnlyFile::load(getAppendOnlyFilePath(), [&](std::vector<std::string>&& argv) {
+        // arguments go in as parsed, values with spaces, CR / LF or binary bytes replay unchanged
+        if (!argv.empty())
+          _processSingleCommand(replaySocketFD, argv);
+      }, numCommands, tailOffset);
+      clientDbIndexes.erase(replaySocketFD);
+      // loading is not a write, replicas get the dataset through their sync
+      replicationStatus.pendingStream.clear();
+      replicationStatus.propagatedDbIndex = -1;
+      if (status != 0) {
+        DEBUG_LOG(utility::colourize("failed to load append only file " + getAppendOnlyFilePath(), utility::cc::RED));
+        return -1;
+      }
+      DEBUG_LOG("replayed " + std::to_string(numCommands) + " commands from " + getAppendOnlyFilePath() + " in " +
+                std::to_string(_getCurrentTimeMs() - startTimeMs) + " ms");
+      return 0;
+    }
+
+    // starts logging write commands, appendfsync is always, everysec (default) or no. A new file starts with an rdb
+    // preamble of the dataset loaded so far (eg : from the rdb file), so it holds everything on the next startup.
+    // Returns -1 with errMsg set if the configuration is invalid or the file cannot be written
+    int openAppendOnlyFile(std::string& errMsg) {
+      AppendOnlyFile::FsyncPolicy policy = AppendOnlyFile::FsyncPolicy::Everysec;
+      std::string policyStr = getConfigKv("appendfsync").value_or("everysec");
+      if (0 != AppendOnlyFile::parse_fsync_policy(policyStr, policy)) {
+        errMsg = "invalid appendfsync policy '" + policyStr + "' (always, everysec or no)";
+        return -1;
+      }
+      int64_t percentage = 0, minSize = 0;
+      if (0 != utility::parseInt64(getConfigKv("auto-aof-rewrite-percentage").value_or("100"), percentage) || percentage < 0 ||
+          0 != utility::parseInt64(getConfigKv("auto-aof-rewrite-min-size").value_or("67108864"), minSize) || minSize < 0) {
+        errMsg = "invalid auto-aof-rewrite-percentage or auto-aof-rewrite-min-size";
+        return -1;
+      }
+      aofRewriteStatus.autoRewritePercentage = percentage;
+      aofRewriteStatus.autoRewriteMinSize = minSize;
+      if (0 != access(getAppendOnlyFilePath().c_str(), F_OK)) {
+        auto keyspaceLock = redis_data_store_obj.lock_keyspace();
+        RdbFileWriter rdbFileWriter;
+        if (0 != rdbFileWriter.writeFile(getAppendOnlyFilePath(), redis_data_store_obj)) {
+          errMsg = "failed to write the rdb preamble of " + getAppendOnlyFilePath();
+          return -1;
+        }
+      }
+      propagatedDbIndex = -1;
+      if (0 != appendOnlyFile.open(getAppendOnlyFilePath(), policy)) {
+        errMsg = "failed to open " + getAppendOnlyFilePath();
+        return -1;
+      }
+      return 0;
+    }
+
+    // keys expired by the monitor thread are deleted on replicas and in the append only file too, must run before
+    // flushAppendOnlyFile() and flushReplicationStream()
+    int propagateExpiredKeys() {
+      auto expiredKeys = redis_data_store_obj.take_expired_keys();
+      if (expiredKeys.empty())
+        return 0;
+      size_t selectedDbIndex = redis_data_store_obj.get_selected_db();
+      for (auto& [dbIndex, key] : expiredKeys) {
+        redis_data_store_obj.select_db(dbIndex);
+        _propagateWriteCommand({"DEL", key});
+      }
+      redis_data_store_obj.select_db(selectedDbIndex);
+      return 0;
+    }
+
+    // the writes of this event loop iteration go out to every replica in one buffer (one write per replica per
+    // iteration, whatever the write rate), must run before flushPendingWrites()
+    int flushReplicationStream() {
+      _flushReplicationStream();
+      // a replica acknowledges its offset every second (and on REPLCONF GETACK)
+      if (replicationStatus.masterLinkState == MasterLinkState::Connected && _getCurrentTimeMs() - replicationStatus.lastAckSentMs >= 1000)
+        _sendAckToMaster();
+      return 0;
+    }
+
+    // group commit of the write commands logged during this event loop iteration, must run before
+    // flushPendingWrites() as replies may be held back until their commands are on disk
+    int flushAppendOnlyFile() {
+      return appendOnlyFile.flush();
     }
 
     static int setMasterInfo() {
       setConfigKv("role", "master");
-      RedisCommandCenter::setConfigKv("master_replid", "8371b4fb1155b71f4a04d3e1bc3e18c4a990aeeb");
-      RedisCommandCenter::setConfigKv("master_repl_offset", "0");
+      replicationStatus.replid = _generateReplid();
+      return 0;
+    }
+
+    // "replica <hard limit bytes> <soft limit bytes> <soft limit seconds>" ("slave" is accepted for replica)
+    static int setClientOutputBufferLimit(const std::string& limitStr) {
+      std::vector<std::string> tokens = utility::split(limitStr, " ");
+      int64_t hardLimit = 0, softLimit = 0, softSeconds = 0;
+      if (tokens.size() != 4 || !(utility::compareCaseInsensitive("replica", tokens[0]) || utility::compareCaseInsensitive("slave", tokens[0])) ||
+          0 != utility::parseInt64(tokens[1], hardLimit) || 0 != utility::parseInt64(tokens[2], softLimit) ||
+          0 != utility::parseInt64(tokens[3], softSeconds) || hardLimit < 0 || softLimit < 0 || softSeconds < 0)
+        return -1;
+      replicationStatus.outputBufferLimit = {static_cast<uint64_t>(hardLimit), static_cast<uint64_t>(softLimit), static_cast<uint64_t>(softSeconds)};
+      return 0;
+    }
+
+    // size of the replication backlog, the history it holds is dropped
+    static int setReplicationBacklogSize(int64_t size) {
+      if (size < 1)
+        return -1;
+      replicationStatus.backlog.resize(static_cast<size_t>(size));
+      return 0;
+    }
+
+    // repl-diskless-sync-delay : seconds a full resynchronization waits for more replicas to share its snapshot
+    static int setReplDisklessSyncDelay(int64_t seconds) {
+      if (seconds < 0)
+        return -1;
+      disklessSyncStatus.delayMs = static_cast<uint64_t>(seconds) * 1000;
       return 0;
     }
 
@@ -77,8 +269,17 @@ namespace RCC {
       DEBUG_LOG(ss.str());
 
       std::vector<std::string> responseStrVec;
-      for (auto& eachCommand : commands) {
-        responseStrVec.push_back(_processSingleCommand(socketFD, eachCommand));
+      for (size_t i = 0; i < commands.size(); i++) {
+        auto blockedIt = blockedClients.find(socketFD);
+        if (blockedIt != blockedClients.end()) {
+          // client got parked by a blocking command, rest of the pipeline runs once it is unblocked
+          blockedIt->second.pendingCommands.insert(blockedIt->second.pendingCommands.end(), commands.begin() + i, commands.end());
+          break;
+        }
+        std::string responseStr = _processSingleCommand(socketFD, commands[i]);
+        _serveClientsBlockedOnReadyKeys();
+        if (blockedClients.count(socketFD) == 0)
+          responseStrVec.push_back(responseStr);
       }
       ss.clear();
       ss << "responseStr : ";
@@ -99,94 +300,292 @@ namespace RCC {
         return -1;
     }
 
+    // replica side, the master link never blocks the event loop : called on every iteration, this starts a non
+    // blocking connect once the reconnect backoff allows it and drops a link stuck connecting or in the handshake,
+    // handleMasterLinkEvents() takes over when the socket is ready. returns -1 if a connection attempt failed right away.
+    // The link only starts once the local dataset is loaded : the master's stream must never get -LOADING, and a full
+    // resync must not be swapped in while the loader thread still inserts keys
     int connectToMasterServer(int& masterConnectorSocketFD, std::string replicaof, pm::PollManager& pollManager) {
+      if (loadingStatus.isLoading)
+        return 0;
+      uint64_t now = _getCurrentTimeMs();
+      MasterLinkState state = replicationStatus.masterLinkState;
+      if (state != MasterLinkState::None && state != MasterLinkState::Connected && now >= replicationStatus.masterLinkDeadlineMs) {
+        DEBUG_LOG(utility::colourize("timed out connecting to master : " + replicaof, utility::cc::RED));
+        _dropMasterLink(masterConnectorSocketFD, pollManager);
+      }
+      if (replicationStatus.masterLinkState != MasterLinkState::None) {
+        _updateMasterLinkEvents(pollManager);
+        return 0;
+      }
+      if (now < replicationStatus.nextConnectAttemptMs)
+        return 0;
+
       std::vector<std::string> hostPortVec = utility::split(replicaof, " ");
-      DEBUG_LOG("hostPortVec[0]=" + hostPortVec[0] + ", hostPortVec[1]=" + hostPortVec[1]);
+      if (hostPortVec.size() < 2) {
+        DEBUG_LOG(utility::colourize("invalid master address : " + replicaof, utility::cc::RED));
+        _scheduleMasterReconnect();
+        return -1;
+      }
       pm::SocketSetting socketSetting;
       socketSetting.socketHostOrIP = hostPortVec[0];
       socketSetting.socketPortOrService = hostPortVec[1];
       socketSetting.socketDomain = AF_INET;
       socketSetting.isReuseSocket = true;
-      socketSetting.isSocketNonBlocking = false;//false;
+      socketSetting.isSocketNonBlocking = true;
       DEBUG_LOG("connector socket setting: " + socketSetting.getSocketSettingsString());
-      // int counter = 0;
-      // while (counter < 3) {
       masterConnectorSocketFD = pollManager.createConnectorSocket(socketSetting);
-        // counter++;
-        // if (masterConnectorSocketFD > 0)
-          // break;
-      // }
-      DEBUG_LOG("masterConnectorSocketFD=" + std::to_string(masterConnectorSocketFD));
       if (masterConnectorSocketFD < 1) {
         DEBUG_LOG("failed to connect to master : " + replicaof);
+        masterConnectorSocketFD = -1;
+        _scheduleMasterReconnect();
         return -1;
       }
-      else {
-        DEBUG_LOG("successfully created master connector socket : " + std::to_string(masterConnectorSocketFD) + ", starting handshake...");
-        if (0 == doReplicaMasterHandshake(masterConnectorSocketFD)) {
-          DEBUG_LOG("successfully done handshake with master");
+      DEBUG_LOG("connecting to master, master connector socket : " + std::to_string(masterConnectorSocketFD));
+      replicationStatus.masterSocketFD = masterConnectorSocketFD;
+      replicationStatus.masterLinkState = MasterLinkState::Connecting;
+      replicationStatus.masterLinkDeadlineMs = now + ReplicationStatus::MASTER_LINK_TIMEOUT_MS;
+      replicationStatus.isMasterLinkPolledForOutput = true;  // the connector socket is polled for POLLIN | POLLOUT
+      return 0;
+    }
+
+    bool isMasterLinkUp() const {
+      return replicationStatus.masterLinkState == MasterLinkState::Connected;
+    }
+
+    // replica side, called when the master link socket is ready : completes the connect, then each handshake reply
+    // (PING, REPLCONF listening-port, REPLCONF capa, PSYNC) sends the next command, then the stream is applied.
+    // returns -1 if nothing was read from the master, masterConnectorSocketFD is -1 once the link is dropped
+    int handleMasterLinkEvents(int& masterConnectorSocketFD, short revents, pm::PollManager& pollManager) {
+      if (replicationStatus.masterLinkState == MasterLinkState::Connecting) {
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if ((revents & (POLLERR | POLLHUP)) || 0 != getsockopt(masterConnectorSocketFD, SOL_SOCKET, SO_ERROR, &error, &errorLength) || error != 0) {
+          DEBUG_LOG(utility::colourize("failed to connect to master : " + std::string(error != 0 ? strerror(error) : "connection refused"), utility::cc::RED));
+          _dropMasterLink(masterConnectorSocketFD, pollManager);
+          return -1;
         }
-        else {
-          DEBUG_LOG("failed to do handshake with master, master connector socket : " + std::to_string(masterConnectorSocketFD));
+        if ((revents & POLLOUT) == 0)
+          return -1;
+        DEBUG_LOG("connected to master, starting handshake...");
+        replicationStatus.masterLinkState = MasterLinkState::ReceivePong;
+        if (0 != _sendToMaster({"PING"})) {
+          _dropMasterLink(masterConnectorSocketFD, pollManager);
           return -1;
         }
+        _updateMasterLinkEvents(pollManager);
+        return -1;
       }
-      return 0;
+      if ((revents & POLLOUT) && 0 != replicationStatus.masterLinkOutput.flush(masterConnectorSocketFD)) {
+        _dropMasterLink(masterConnectorSocketFD, pollManager);
+        return -1;
+      }
+      _updateMasterLinkEvents(pollManager);
+      if ((revents & ~POLLOUT) == 0)
+        return -1;
+      if (replicationStatus.masterLinkState == MasterLinkState::Connected)
+        return receiveCommandsFromMaster(masterConnectorSocketFD, pollManager);
+      return _readHandshakeReplies(masterConnectorSocketFD, pollManager);
     }
 
-    int doReplicaMasterHandshake(int& serverConnectorSocketFD) {
-      return _doReplicaMasterHandshake(serverConnectorSocketFD);
+    int receiveCommandsFromMaster(int& masterConnectorSocketFD, pm::PollManager& pollManager) {
+      // drains what the master sent (up to a cap, so clients are not starved by a long burst) into the link's input
+      // buffer, the socket is non blocking
+      const size_t bufferSize = 16 * 1024;
+      const size_t maxBytesPerCall = 1024 * 1024;
+      char buffer[bufferSize];
+      size_t totalBytes = 0;
+      bool isClosed = false;
+      while (totalBytes < maxBytesPerCall) {
+        ssize_t numBytes = recv(masterConnectorSocketFD, buffer, bufferSize, MSG_DONTWAIT);
+        if (numBytes > 0) {
+          totalBytes += numBytes;
+          if (0 != _applyMasterStream(masterConnectorSocketFD, buffer, numBytes)) {
+            isClosed = true;
+            break;
+          }
+          continue;
+        }
+        if (numBytes < 0 && errno == EINTR)
+          continue;
+        if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        DEBUG_LOG(utility::colourize("Failed to read from master : " + std::string((numBytes == 0) ? "connection closed" : strerror(errno)), utility::cc::RED));
+        isClosed = true;
+        break;
+      }
+      if (isClosed) {
+        // the replid and offset processed so far are kept, the next handshake asks the master to continue from there
+        _dropMasterLink(masterConnectorSocketFD, pollManager);
+        return -1;
+      }
+      return (totalBytes > 0) ? 0 : -1;
     }
 
-    bool canReadFromSocket(int socketFD) {
-            // returns true if socket is open else returns false
-            if (socketFD < 0)
-                return false;  // socket is invalid or closed
+    // applies bytes of the replication stream : the rdb payload following +FULLRESYNC is loaded, then every complete
+    // command in the link's input buffer is processed and counted in the replication offset (which the next PSYNC
+    // continues from and REPLCONF ACK reports), an incomplete command stays buffered until the rest arrives.
+    // returns -1 if the stream is not valid RESP (the link has to be dropped)
+    int _applyMasterStream(int masterConnectorSocketFD, const char* data, size_t length) {
+      std::string& input = replicationStatus.masterLinkInput;
+      input.append(data, length);
+      size_t position = 0;
+      int status = 0;
+      std::vector<std::string> commandVec;
+      std::string relayedStream;  // relayed as is to the replicas of this replica, same bytes and offsets
+      while (position < input.length()) {
+        if (replicationStatus.isAwaitingRdbPayload) {
+          size_t headerEnd = input.find("\r\n", position);
+          if (headerEnd == std::string::npos)
+            break;  // "$<length>" not complete yet
+          if (0 != _beginRdbPayload(input.substr(position, headerEnd - position))) {
+            status = -1;
+            break;
+          }
+          position = headerEnd + 2;
+          continue;
+        }
+        if (replicationStatus.rdbPayloadReader) {
+          int payloadStatus = _loadRdbPayload(input, position);
+          if (payloadStatus < 0) {
+            status = -1;
+            break;
+          }
+          if (payloadStatus == 0)
+            break;  // rest of the payload is still in flight
+          continue;
+        }
 
-            const int bufferSize = 1024; 
-            char buffer[bufferSize];
-            size_t result = recv(socketFD, &buffer, bufferSize, MSG_PEEK | MSG_DONTWAIT);
-            DEBUG_LOG(utility::colourize(utility::printExact("socketFD="+std::to_string(socketFD)+", buffer="+std::string(buffer)), utility::cc::BLUE));
-            if ( (result == -1) && (errno == EBADF)) {
-                return false;  // socket is closed
-            }
-            return true;  // socket is open
+        size_t frameLength = 0;
+        int frameStatus = resp::RespParser::parseCommandFrame(input.data() + position, input.length() - position, commandVec, frameLength);
+        if (frameStatus == 0)
+          break;  // rest of the command is still in flight
+        if (frameStatus < 0) {
+          DEBUG_LOG(utility::colourize("protocol error in replication stream : " + utility::printExact(input.substr(position, 64)), utility::cc::RED));
+          status = -1;
+          break;
+        }
+        if (!commandVec.empty()) {
+          int socketFD = masterConnectorSocketFD;
+          std::string responseStr = _processSingleCommand(socketFD, commandVec);
+          _serveClientsBlockedOnReadyKeys();
+          DEBUG_LOG("processed command from master (no reply is sent), responseStr : " + utility::printExact(responseStr));
+          if (utility::compareCaseInsensitive("SELECT", commandVec[0]))
+            replicationStatus.propagatedDbIndex = static_cast<int64_t>(_getClientDbIndex(socketFD));
         }
+        // counted once processed : the ack sent by REPLCONF GETACK covers the stream before the GETACK itself
+        replicationStatus.backlog.feed(input.data() + position, frameLength);
+        if (!replicaClients.empty())
+          relayedStream.append(input.data() + position, frameLength);
+        position += frameLength;
+      }
+      input.erase(0, position);
+      if (!relayedStream.empty())
+        _relayReplicationStream(relayedStream);
+      return status;
+    }
 
-    int receiveCommandsFromMaster(int& masterConnectorSocketFD, pm::PollManager& pollManager) {
-      
-      if (!canReadFromSocket(masterConnectorSocketFD)) {
+    // header of the rdb payload of a full resynchronization : "$<length>" or "$EOF:<40 bytes mark>" (diskless master)
+    int _beginRdbPayload(const std::string& header) {
+      replicationStatus.isAwaitingRdbPayload = false;
+      replicationStatus.rdbPayloadBytesLeft = -1;
+      replicationStatus.rdbPayloadEofMark.clear();
+      replicationStatus.isRdbPayloadLoaded = false;
+      int64_t payloadLength = 0;
+      if (header.compare(0, 5, "$EOF:") == 0 && header.length() == 5 + 40) {
+        replicationStatus.rdbPayloadEofMark = header.substr(5);
+      }
+      else if (header.length() < 2 || header[0] != '$' || 0 != utility::parseInt64(header.substr(1), payloadLength) || payloadLength < 0) {
+        DEBUG_LOG(utility::colourize("unexpected rdb payload header from master : " + utility::printExact(header), utility::cc::RED));
         return -1;
       }
       else {
-        DEBUG_LOG(utility::colourize("Data available from master", utility::cc::BLUE));
+        replicationStatus.rdbPayloadBytesLeft = payloadLength;
       }
-      
-      const uint16_t bufferSize = 1024;  // 1KB buffer to use when reading from or writing to socket
-      char buffer[bufferSize];
+      DEBUG_LOG("receiving rdb payload from master : " + utility::printExact(header));
+      replicationStatus.rdbPayloadReader = std::make_unique<RdbFileReader>();
+      replicationStatus.rdbPayloadReader->begin_stream();
+      return 0;
+    }
 
-      int numBytes = utility::readFromSocketFD(masterConnectorSocketFD, buffer, bufferSize);
-      if (numBytes == 0) {  // if 0 bytes read, it means connection closed
-        DEBUG_LOG("Failed to read message from socket : connection closed\n");
-        // pollManager.deleteSocketFDFromPollfdArr(masterConnectorSocketFD);
-        replicaSocketFDSet.erase(masterConnectorSocketFD);
-        return 0;
+    // feeds the payload bytes of input from position to the rdb stream loader; returns 1 once the payload ended and the
+    // new dataset is in place, 0 if more bytes are needed, -1 if the payload is not valid
+    int _loadRdbPayload(const std::string& input, size_t& position) {
+      auto& status = replicationStatus;
+      size_t available = input.length() - position;
+      const std::string& eofMark = status.rdbPayloadEofMark;
+      if (!status.isRdbPayloadLoaded) {
+        size_t length = available;
+        bool isFlush = false;
+        if (eofMark.empty()) {
+          length = std::min<uint64_t>(available, status.rdbPayloadBytesLeft);
+          isFlush = (length == static_cast<uint64_t>(status.rdbPayloadBytesLeft));
+        }
+        else {
+          isFlush = (input.find(eofMark, position) != std::string::npos);
+        }
+        size_t consumed = 0;
+        int loadStatus = status.rdbPayloadReader->feed_stream(reinterpret_cast<const uint8_t*>(input.data()) + position, length, isFlush, consumed);
+        position += consumed;
+        available -= consumed;
+        if (eofMark.empty())
+          status.rdbPayloadBytesLeft -= consumed;
+        if (loadStatus < 0 || (loadStatus == 0 && isFlush && eofMark.empty())) {
+          DEBUG_LOG(utility::colourize("failed to load the rdb payload from master", utility::cc::RED));
+          _abortRdbPayload();
+          return -1;
+        }
+        if (loadStatus == 0)
+          return 0;
+        status.isRdbPayloadLoaded = true;
       }
-      else if (numBytes < 0) {
-        DEBUG_LOG("Failed to read message from socket = " + std::to_string(masterConnectorSocketFD));
-        return -1;
-      } 
-
-      // parsing the buffer for commands
-      respParser.resetParser(buffer);
-      std::vector<std::string> command;
-      respParser.parseCommands(command); 
-      // process the commands
-      std::vector<std::string> responseStrVec = processCommands(masterConnectorSocketFD, command);
-      for (auto& responseStr : responseStrVec) {
-        DEBUG_LOG("processed commands one by one (not sending response to master only updating ), respective responseStr : " + utility::printExact(responseStr))
+      // after the rdb : the EOF mark, or payload bytes the rdb did not use
+      if (!eofMark.empty()) {
+        if (available < eofMark.length())
+          return 0;
+        if (0 != input.compare(position, eofMark.length(), eofMark)) {
+          DEBUG_LOG(utility::colourize("rdb payload from master is not followed by its EOF mark", utility::cc::RED));
+          _abortRdbPayload();
+          return -1;
+        }
+        position += eofMark.length();
       }
-      return 0;
+      else if (status.rdbPayloadBytesLeft > 0) {
+        size_t skipped = std::min<uint64_t>(available, status.rdbPayloadBytesLeft);
+        position += skipped;
+        status.rdbPayloadBytesLeft -= skipped;
+        if (status.rdbPayloadBytesLeft > 0)
+          return 0;
+      }
+      DEBUG_LOG("rdb payload from master loaded (" + std::to_string(status.rdbPayloadReader->get_stream_bytes_fed()) + " bytes), swapping the dataset in");
+      redis_data_store_obj.swap_in_staged_databases();
+      // the stream following the snapshot runs in the database selected at its offset : a master sends a SELECT
+      // first anyway, a replica relaying its own master's stream cannot and tells it with repl-stream-db
+      int64_t streamDbIndex = -1;
+      if (0 != utility::parseInt64(status.rdbPayloadReader->get_stream_aux_field("repl-stream-db"), streamDbIndex) ||
+          streamDbIndex < 0 || static_cast<uint64_t>(streamDbIndex) >= RedisDataStore::get_database_count())
+        streamDbIndex = -1;
+      status.propagatedDbIndex = streamDbIndex;
+      clientDbIndexes[status.masterSocketFD] = static_cast<size_t>(std::max<int64_t>(streamDbIndex, 0));
+      status.rdbPayloadReader.reset();
+      status.isRdbPayloadLoaded = false;
+      // the append only file logged the previous dataset, its rewrite starts from the new one
+      if (appendOnlyFile.is_open()) {
+        if (aofRewriteStatus.childPid != -1 || _isBackgroundSaveInProgress())
+          aofRewriteStatus.isScheduled = true;
+        else
+          _startAppendOnlyFileRewrite();
+      }
+      return 1;
+    }
+
+    // the master link went down (or sent a bad payload) during a full resynchronization, the live dataset is kept
+    void _abortRdbPayload() {
+      if (replicationStatus.rdbPayloadReader)
+        redis_data_store_obj.discard_staged_databases();
+      replicationStatus.rdbPayloadReader.reset();
+      replicationStatus.isAwaitingRdbPayload = false;
+      replicationStatus.isRdbPayloadLoaded = false;
     }
 
     int clientHandler(int currentSocketFD, pm::PollManager& pollManager) {
@@ -196,8 +595,13 @@ namespace RCC {
       int numBytes = utility::readFromSocketFD(currentSocketFD, buffer, bufferSize);
       if (numBytes == 0) {  // if 0 bytes read, it means connection closed
         DEBUG_LOG("Failed to read message from socket : connection closed\n");
+        _unblockClient(currentSocketFD, std::nullopt);
+        pubSub.remove_client(currentSocketFD);
+        clientOutputQueues.erase(currentSocketFD);
+        clientsWithPendingWrites.erase(currentSocketFD);
+        clientDbIndexes.erase(currentSocketFD);
+        replicaClients.erase(currentSocketFD);
         pollManager.deleteSocketFDFromPollfdArr(currentSocketFD);
-        replicaSocketFDSet.erase(currentSocketFD);
         return 0;
       }
       else if (numBytes < 0) {
@@ -238,7 +642,9 @@ namespace RCC {
       // process the commands
       std::vector<std::string> responseStrVec = processCommands(currentSocketFD, command);
       for (auto& responseStr : responseStrVec) {
-        numBytes = utility::writeToSocketFD(currentSocketFD, buffer, bufferSize, responseStr);
+        if (responseStr.empty())
+          continue;  // command without reply (eg : REPLCONF ACK)
+        numBytes = _sendToClient(currentSocketFD, responseStr);
         if (numBytes < 0) {
           DEBUG_LOG("Failed to write message to socket.\n");
           return -1;
@@ -246,39 +652,348 @@ namespace RCC {
         else if (numBytes == 0) {  // if 0 bytes, it means connection closed
           DEBUG_LOG("Failed to write message to socket(" + std::to_string(currentSocketFD) + ") : connection closed\n");
           // pollManager.deleteSocketFDFromPollfdArr(currentSocketFD);
-          replicaSocketFDSet.erase(currentSocketFD);
+          replicaClients.erase(currentSocketFD);
           return 0;
         }
       }
+      _updateSocketEvents(currentSocketFD, pollManager);
+      _resumeUnblockedClients(pollManager);
       // } // while loop to process all tokens (even multiple commands)
       // close(currentSocketFD);  // PollManager should close connection
       return 0;
     }
 
-  private:
+    int getPollTimeoutMs(int maxTimeoutMs) {
+      // a forkless BGSAVE writes buckets on every event loop iteration, a forked one is checked at least every 100 ms
+      if (snapshotStatus.isForkless && redis_data_store_obj.is_incremental_snapshot_writing())
+        return 0;
+      if (snapshotStatus.isForkless || loadingStatus.isLoading || disklessSyncStatus.childPid != -1)
+        maxTimeoutMs = std::min(maxTimeoutMs, 10);  // also forwards the snapshot of a diskless sync from its pipe
+      if (snapshotStatus.childPid != -1 || aofRewriteStatus.childPid != -1 || aofRewriteStatus.isScheduled || appendOnlyFile.has_pending_writes() ||
+          _isDisklessSyncRequested())
+        maxTimeoutMs = std::min(maxTimeoutMs, 100);  // also retries an append only file write postponed by a running fsync
+      // poll() must wake up in time for the next connection attempt to the master and the earliest blocked client timeout
+      bool isReconnectPending = getConfigKv("role").value_or("master") != "master" && replicationStatus.masterLinkState == MasterLinkState::None;
+      if (blockedClientTimers.empty() && !isReconnectPending)
+        return maxTimeoutMs;
+      uint64_t now = _getCurrentTimeMs();
+      uint64_t deadline = blockedClientTimers.empty() ? UINT64_MAX : blockedClientTimers.begin()->first;
+      if (isReconnectPending)
+        deadline = std::min(deadline, replicationStatus.nextConnectAttemptMs);
+      if (deadline <= now)
+        return 0;
+      return static_cast<int>(std::min<uint64_t>(deadline - now, maxTimeoutMs));
+    }
 
-    int sendCommandToAllReplicas(const std::string& commandRespStr) {
-      const int bufferSize = 1024;
-      char buffer[bufferSize];
-      int retryCount = 3;
-      int numBytes;
-      for (int replicaSocketFD : replicaSocketFDSet) {
-        // send single command to all replicas
-        numBytes = utility::writeToSocketFD(replicaSocketFD, buffer, bufferSize, commandRespStr, retryCount);
-        if (numBytes > 0) {
-          DEBUG_LOG("successfully sent " + std::to_string(numBytes) + " bytes to socket=" + std::to_string(replicaSocketFD) + ", command : " + utility::printExact(commandRespStr));
-        }
-        else if (numBytes == 0){
-          DEBUG_LOG("writing to replica socket(" + std::to_string(replicaSocketFD) + ") during handshake failed : connection closed");
-          return -1;
-        }
-        else {  // numBytes is -ve
-          DEBUG_LOG("writing to replica socket(" + std::to_string(replicaSocketFD) + ") during handshake failed");
+    // called when socketFD is writable (POLLOUT), only polled for while it has queued output
+    int flushClientOutput(int socketFD, pm::PollManager& pollManager) {
+      if (_isClientOutputHeld(socketFD)) {
+        _updateSocketEvents(socketFD, pollManager);  // stays in clientsWithPendingWrites, sent once the file is synced
+        return 0;
+      }
+      auto it = clientOutputQueues.find(socketFD);
+      if (it != clientOutputQueues.end() && 0 != it->second.flush(socketFD)) {
+        it->second = OutputQueue();  // connection is broken, clientHandler cleans up on the next read
+      }
+      if (it != clientOutputQueues.end() && it->second.empty())
+        clientOutputQueues.erase(it);
+      clientsWithPendingWrites.erase(socketFD);
+      _updateSocketEvents(socketFD, pollManager);
+      return 0;
+    }
+
+    // writes output queued during this event loop iteration (eg : published messages), once per client
+    int flushPendingWrites(pm::PollManager& pollManager) {
+      std::vector<int> socketFDs(clientsWithPendingWrites.begin(), clientsWithPendingWrites.end());
+      for (int socketFD : socketFDs)
+        flushClientOutput(socketFD, pollManager);
+      return 0;
+    }
+
+    int handleBlockedClientsTimeout(pm::PollManager& pollManager) {
+      uint64_t now = _getCurrentTimeMs();
+      while (!blockedClientTimers.empty() && blockedClientTimers.begin()->first <= now) {
+        int socketFD = blockedClientTimers.begin()->second;
+        const BlockedClient& client = blockedClients[socketFD];
+        if (client.waitOffset.has_value()) {
+          // WAIT replies with the replicas which acknowledged in time
+          _unblockClient(socketFD, resp::RespParser::serialize({std::to_string(_countReplicasAcked(*client.waitOffset))}, resp::RespType::Integer));
+          continue;
         }
+        bool isMove = client.destKey.has_value();
+        _unblockClient(socketFD, isMove ? resp::RespConstants::NULL_BULK_STRING : resp::RespConstants::NULL_ARRAY);
       }
+      _resumeUnblockedClients(pollManager);
       return 0;
     }
 
+    // collects the progress of a running BGSAVE child and reaps it once it exits, or advances a forkless BGSAVE;
+    // also reaps the BGREWRITEAOF child and starts scheduled or automatic append only file rewrites, and runs the
+    // snapshots of diskless full resynchronizations
+    int checkBackgroundSave() {
+      int status = _checkBackgroundSaveChild();
+      _checkAppendOnlyFileRewrite();
+      _checkDisklessSync();
+      return status;
+    }
+
+  private:
+
+    int _checkBackgroundSaveChild() {
+      if (snapshotStatus.isForkless) {
+        bool isDone = false;
+        int status = redis_data_store_obj.advance_incremental_snapshot(forklessSnapshotBucketsPerStep, isDone, snapshotStatus.keysProcessed);
+        if (isDone)
+          _finishBackgroundSave(status == 0);
+        return status;
+      }
+      if (snapshotStatus.childPid == -1)
+        return 0;
+      uint64_t keysProcessed = 0;
+      while (read(snapshotStatus.progressPipeFD, &keysProcessed, sizeof(keysProcessed)) == sizeof(keysProcessed))
+        snapshotStatus.keysProcessed = keysProcessed;
+
+      int waitStatus = 0;
+      pid_t pid = waitpid(snapshotStatus.childPid, &waitStatus, WNOHANG);
+      if (pid == 0)
+        return 0;  // still saving
+      bool isOk = (pid == snapshotStatus.childPid) && WIFEXITED(waitStatus) && WEXITSTATUS(waitStatus) == 0;
+      close(snapshotStatus.progressPipeFD);
+      snapshotStatus.progressPipeFD = -1;
+      snapshotStatus.childPid = -1;
+      _finishBackgroundSave(isOk);
+      return isOk ? 0 : -1;
+    }
+
+    // SAVE / BGSAVE state, reported by INFO persistence
+    struct SnapshotStatus {
+      pid_t childPid = -1;  // BGSAVE child, -1 if none is running
+      bool isForkless = false;  // a forkless BGSAVE is running
+      int progressPipeFD = -1;  // read end of a non blocking pipe, the child writes the number of keys saved so far
+      uint64_t startTimeMs = 0;
+      uint64_t keysTotal = 0;
+      uint64_t keysProcessed = 0;
+      int64_t lastSaveTime = std::time(nullptr);  // unix time of the last successful save (startup if none)
+      bool isLastBgsaveOk = true;
+      int64_t lastBgsaveDurationSec = -1;
+      uint64_t saveCount = 0;
+    };
+
+    // client-output-buffer-limit replica <hard limit bytes> <soft limit bytes> <soft limit seconds>, 0 disables a limit
+    struct OutputBufferLimit {
+      uint64_t hardLimitBytes = 256 << 20;
+      uint64_t softLimitBytes = 64 << 20;
+      uint64_t softLimitSeconds = 60;
+    };
+
+    // replica side, the master link from the non blocking connect to the replication stream
+    enum class MasterLinkState : uint8_t {
+      None,  // no link, the next connection attempt waits for the reconnect backoff
+      Connecting,
+      ReceivePong,
+      ReceivePortReply,  // REPLCONF listening-port
+      ReceiveCapaReply,  // REPLCONF capa
+      ReceivePsyncReply,
+      Connected  // the rdb payload or the stream follows
+    };
+
+    // replication id and stream history (master : the stream it produces, replica : the stream it processed),
+    // reported by INFO replication
+    struct ReplicationStatus {
+      std::string replid;  // empty on a replica which never synced
+      std::string replid2 = std::string(40, '0');  // previous replid, valid for PSYNC up to secondReplOffset
+      int64_t secondReplOffset = -1;
+      ReplicationBacklog backlog;
+      uint64_t numFullResyncs = 0;
+      uint64_t numPartialResyncs = 0;
+      uint64_t numPartialResyncErrors = 0;
+      // replica side, the rdb payload following +FULLRESYNC ("$<length>\r\n<rdb>" or "$EOF:<mark>\r\n<rdb><mark>")
+      // is not part of the stream : it is loaded into a staged dataset, swapped in once complete
+      bool isAwaitingRdbPayload = false;
+      std::unique_ptr<RdbFileReader> rdbPayloadReader;  // set while the payload is received
+      int64_t rdbPayloadBytesLeft = -1;  // -1 with an EOF mark
+      std::string rdbPayloadEofMark;
+      bool isRdbPayloadLoaded = false;  // the rdb ended, only the EOF mark (or unused payload bytes) is left
+      std::string masterLinkInput;  // bytes received from the master not processed yet (incomplete command or rdb header)
+      OutputBufferLimit outputBufferLimit;
+      uint64_t numOutputBufferLimitDisconnections = 0;
+      // master side, writes of the current event loop iteration not fed to the stream yet
+      std::string pendingStream;
+      int64_t propagatedDbIndex = -1;  // database of the last command in the stream (produced or received), -1 before the first one
+      bool isGetAckRequested = false;
+      // replica side, the master link : connected, then handshake, without blocking (see connectToMasterServer())
+      static const uint64_t MASTER_LINK_TIMEOUT_MS = 60 * 1000;  // connect, or wait for a handshake reply
+      static const uint64_t MIN_RECONNECT_DELAY_MS = 100;
+      static const uint64_t MAX_RECONNECT_DELAY_MS = 5000;
+      int masterSocketFD = -1;
+      MasterLinkState masterLinkState = MasterLinkState::None;
+      uint64_t masterLinkDeadlineMs = 0;
+      uint64_t nextConnectAttemptMs = 0;
+      uint64_t reconnectDelayMs = 0;  // wait before the attempt following the next failure
+      OutputQueue masterLinkOutput;  // handshake commands and REPLCONF ACK not written yet
+      bool isMasterLinkPolledForOutput = false;
+      uint64_t lastAckSentMs = 0;
+    };
+
+    // diskless full resynchronization in progress (see _startDisklessSync())
+    struct DisklessSyncStatus {
+      pid_t childPid = -1;  // child writing the snapshot into the pipe, -1 if none is running
+      int pipeFD = -1;  // read end, non blocking
+      std::string eofMark;  // ends the snapshot on the replica links
+      uint64_t delayMs = 5000;
+      uint64_t bytesSent = 0;
+    };
+
+    // background loading state, reported by INFO persistence
+    struct LoadingStatus {
+      bool isLoading = false;  // until checkLoading() finished the load
+      std::string filename;
+      bool isAppendOnlyFile = false;  // commands following the rdb preamble are replayed once it is loaded
+      bool isAppendOnly = false;  // logging to the append only file starts once loading is done
+      int64_t startTime = 0;  // unix time
+      uint64_t startTimeMs = 0;
+      std::thread loader;
+      std::atomic<bool> isDone{false};  // set by the loader thread, status and tailOffset are valid then
+      int status = 0;
+      uint64_t tailOffset = 0;
+      RdbFileReader::Progress progress;
+    };
+
+    // BGREWRITEAOF state, reported by INFO persistence
+    struct AofRewriteStatus {
+      pid_t childPid = -1;  // child writing the rdb preamble of the new file, -1 if none is running
+      bool isScheduled = false;  // requested while a BGSAVE child was running
+      std::string baseFilename;  // written by the child
+      uint64_t startTimeMs = 0;
+      bool isLastRewriteOk = true;
+      int64_t lastRewriteDurationSec = -1;
+      uint64_t autoRewritePercentage = 100;  // growth since the last rewrite that triggers one, 0 disables
+      uint64_t autoRewriteMinSize = 64 << 20;
+    };
+
+    // a client parked by BLPOP / BRPOP / BLMOVE until one of its keys gets an element or its timeout fires
+    struct BlockedClient {
+      size_t dbIndex = 0;  // database of keys (and destKey)
+      std::vector<std::string> keys;
+      std::vector<std::list<int>::iterator> queuePositions;  // position of the client in each key's wait queue
+      bool isPopLeft = true;
+      std::optional<std::string> destKey;  // set for BLMOVE
+      bool isPushLeft = true;
+      uint64_t deadlineMs = 0;  // 0 means block forever
+      std::vector<std::string> pendingCommands;  // pipelined after the blocking command
+      std::optional<uint64_t> waitOffset;  // set for WAIT : replication offset replicas must acknowledge (no keys)
+      int64_t waitNumReplicas = 0;
+    };
+
+    struct UnblockedClient {
+      int socketFD;
+      std::string reply;
+      std::vector<std::string> pendingCommands;
+    };
+
+    // an entry of the write command table, source keys are argument indexes as in the redis command table (negative
+    // ones count from the end) : a command only removing from its source keys changes nothing if none of them exists
+    struct WriteCommand {
+      std::string name;
+      std::string subcommand = "";  // empty if every form of the command writes
+      int firstSourceKey = 0;  // 0 if the command may write whichever keys exist
+      int lastSourceKey = 0;
+    };
+
+    // a connection which announced itself with REPLCONF (handshake) or completed PSYNC (online), online replicas
+    // are fed the replication stream through their output queue and acknowledge it with REPLCONF ACK <offset>
+    enum class FullSyncState : uint8_t {
+      None,
+      WaitingSnapshot,  // asked for a full resync, waits for the next diskless snapshot to start
+      SendingSnapshot  // receives the snapshot, the stream produced meanwhile follows it
+    };
+
+    struct ReplicaClient {
+      bool isOnline = false;
+      FullSyncState fullSyncState = FullSyncState::None;
+      uint64_t fullSyncRequestMs = 0;
+      std::string streamDuringFullSync;  // stream after the offset of its snapshot, sent right after it
+      std::string listeningPort;
+      uint64_t softLimitReachedMs = 0;  // since when its output is over the soft limit, 0 if it is not
+      uint64_t ackOffset = 0;  // replication offset the replica processed
+      uint64_t ackTimeMs = 0;
+    };
+
+    // appends to the replication stream : the backlog and the output buffer of every replica, written by the event
+    // loop (flushPendingWrites()) so a slow replica never delays the client which sent the write
+    void _feedReplicationStream(const std::string& commandRespStr) {
+      // a replica only counts (and relays) the stream received from its master (in _applyMasterStream())
+      if (getConfigKv("role").value_or("master") != "master")
+        return;
+      // every byte of the replication stream advances the master offset, replicas reconnecting continue from the backlog
+      replicationStatus.backlog.feed(commandRespStr);
+      _relayReplicationStream(commandRespStr);
+    }
+
+    // sends bytes of the stream, already in the backlog, to every replica (a replica relays its master's stream this
+    // way to its own replicas : chained replication, they share the replid and offsets of the master)
+    void _relayReplicationStream(const std::string& commandRespStr) {
+      if (replicaClients.empty())
+        return;  // no replica, not even in handshake
+      auto buffer = std::make_shared<const std::string>(commandRespStr);
+      std::vector<int> overLimitReplicas;
+      for (auto& [replicaSocketFD, replica] : replicaClients) {
+        if (replica.fullSyncState == FullSyncState::SendingSnapshot)
+          replica.streamDuringFullSync += commandRespStr;
+        else if (replica.isOnline)
+          _enqueueOutput(replicaSocketFD, buffer);
+        else
+          continue;
+        if (_isReplicaOutputOverLimit(replicaSocketFD, replica))
+          overLimitReplicas.push_back(replicaSocketFD);
+      }
+      for (int replicaSocketFD : overLimitReplicas)
+        _disconnectReplica(replicaSocketFD);
+    }
+
+    // client-output-buffer-limit replica : over the hard limit, or over the soft limit for softLimitSeconds
+    bool _isReplicaOutputOverLimit(int replicaSocketFD, ReplicaClient& replica) {
+      auto it = clientOutputQueues.find(replicaSocketFD);
+      uint64_t pendingBytes = (it == clientOutputQueues.end()) ? 0 : it->second.size_in_bytes();
+      pendingBytes += replica.streamDuringFullSync.length();
+      const auto& limit = replicationStatus.outputBufferLimit;
+      if (limit.hardLimitBytes != 0 && pendingBytes >= limit.hardLimitBytes)
+        return true;
+      if (limit.softLimitBytes == 0 || pendingBytes < limit.softLimitBytes) {
+        replica.softLimitReachedMs = 0;
+        return false;
+      }
+      uint64_t now = _getCurrentTimeMs();
+      if (replica.softLimitReachedMs == 0)
+        replica.softLimitReachedMs = now;
+      return (now - replica.softLimitReachedMs) >= limit.softLimitSeconds * 1000;
+    }
+
+    // drops a replica which cannot keep up, it reconnects and resyncs (partially if the backlog still covers it);
+    // the socket is shut down here and cleaned up by clientHandler() on the next read
+    void _disconnectReplica(int replicaSocketFD) {
+      auto it = clientOutputQueues.find(replicaSocketFD);
+      DEBUG_LOG(utility::colourize("disconnecting replica " + std::to_string(replicaSocketFD) + " : client-output-buffer-limit replica reached with " +
+                                   std::to_string(it == clientOutputQueues.end() ? 0 : it->second.size_in_bytes()) + " bytes pending", utility::cc::RED));
+      replicaClients.erase(replicaSocketFD);
+      if (it != clientOutputQueues.end())
+        it->second = OutputQueue();  // frees the pending stream
+      shutdown(replicaSocketFD, SHUT_RDWR);
+      replicationStatus.numOutputBufferLimitDisconnections++;
+    }
+
+    // drops every replica (of this replica), they reconnect and resync; cleaned up by clientHandler() on the next read
+    void _disconnectReplicas(const std::string& reason) {
+      for (auto& [replicaSocketFD, replica] : replicaClients) {
+        DEBUG_LOG(utility::colourize("disconnecting replica " + std::to_string(replicaSocketFD) + " : " + reason, utility::cc::RED));
+        auto it = clientOutputQueues.find(replicaSocketFD);
+        if (it != clientOutputQueues.end())
+          it->second = OutputQueue();
+        shutdown(replicaSocketFD, SHUT_RDWR);
+      }
+      replicaClients.clear();
+    }
+
     // int _doReplicaMasterHandshake(int& serverConnectorSocketFD, resp::RespParser& respParser) {
     //   std::vector<std::string> handShakeCommands{"PING", "REPLCONF listening-port", "REPLCONF capa", "PSYNC ? -1"};
     //   std::vector<std::string> expectedResultVec{"PONG", "OK", "OK", "FULLRESYNC abcdefghijklmnopqrstuvwxyz1234567890ABCD 0"};
@@ -359,93 +1074,174 @@ namespace RCC {
     //   return 0;
     // }
 
-    int _doReplicaMasterHandshake(int& serverConnectorSocketFD) {
-      std::vector<std::string> handShakeCommands{"PING", "REPLCONF listening-port", "REPLCONF capa", "PSYNC ? -1"};
-      std::vector<std::string> expectedResultVec{"PONG", "OK", "OK", "FULLRESYNC abcdefghijklmnopqrstuvwxyz1234567890ABCD 0"};
-      
-      auto listeningPortNumber = getConfigKv("listening-port");
-      if (listeningPortNumber.has_value())
-        handShakeCommands[1] += " " + (*listeningPortNumber);
-
-      auto capa = getConfigKv("capa");
-      if (capa.has_value())
-        handShakeCommands[2] += " " + (*capa);
-  
-      std::ostringstream respStrHandShakeCommandsToSend;
-      std::ostringstream respStrExpectedHandShakeResponse;
-      std::vector<std::string> commandVec;
-
-      const uint16_t bufferSize = 1024;  // 1KB buffer to use when reading from or writing to socket
+    // reads what the master sent during the handshake, each reply line answers the last command sent : PING, REPLCONF
+    // listening-port, REPLCONF capa, then PSYNC, whose reply may be followed right away by the rdb payload (+FULLRESYNC)
+    // or the missed stream (+CONTINUE). returns -1 if nothing was read, drops the link if the master hung up or
+    // replied unexpectedly
+    int _readHandshakeReplies(int& masterConnectorSocketFD, pm::PollManager& pollManager) {
+      const size_t bufferSize = 16 * 1024;
       char buffer[bufferSize];
-      const int retryCount = 3;
-      int numBytes;
-      std::string singleCommandToSend;
-
-      for (int i = 0; i < handShakeCommands.size(); i++) {
-        commandVec = utility::split(handShakeCommands[i], " ");
-        singleCommandToSend = resp::RespParser::serialize(commandVec, resp::RespType::Array);
-        
-        // send single command
-        numBytes = utility::writeToSocketFD(serverConnectorSocketFD, buffer, bufferSize, singleCommandToSend, retryCount);
-        if (numBytes > 0) {
-          // DEBUG_LOG("successfully sent command : \"" + handShakeCommands[i] + "\"");
-        }
-        else if (numBytes == 0){
-          DEBUG_LOG("writing to socket during handshake failed : connection closed");
-          return -1;
-        }
-        else {  // numBytes is -ve
-          DEBUG_LOG("writing to socket during handshake failed");
-        }
+      ssize_t numBytes;
+      do {
+        numBytes = recv(masterConnectorSocketFD, buffer, bufferSize, MSG_DONTWAIT);
+      } while (numBytes < 0 && errno == EINTR);
+      if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return -1;
+      if (numBytes <= 0) {
+        DEBUG_LOG(utility::colourize("Failed to read from master during handshake : " + std::string((numBytes == 0) ? "connection closed" : strerror(errno)), utility::cc::RED));
+        _dropMasterLink(masterConnectorSocketFD, pollManager);
+        return -1;
+      }
 
-        // reading response
-        numBytes = utility::readFromSocketFD(serverConnectorSocketFD, buffer, bufferSize, retryCount);
-        if (numBytes > 0) {
-          DEBUG_LOG("successfully read reply for handShakeCommand=\"" + handShakeCommands[i] + "\", reply = " + utility::printExact(buffer));
-        }
-        else if (numBytes == 0) {
-          DEBUG_LOG("Error reading from socket : connection closed\n");
+      std::string& input = replicationStatus.masterLinkInput;
+      input.append(buffer, numBytes);
+      size_t lineEnd;
+      while (replicationStatus.masterLinkState != MasterLinkState::Connected && (lineEnd = input.find("\r\n")) != std::string::npos) {
+        std::string line = input.substr(0, lineEnd);
+        input.erase(0, lineEnd + 2);
+        if (0 != _handleHandshakeReply(line)) {
+          DEBUG_LOG("error occurred while replica master handshake - response not as expected, response : " + utility::printExact(line));
+          _dropMasterLink(masterConnectorSocketFD, pollManager);
           return -1;
         }
-        else {  // numBytes is -ve
-          DEBUG_LOG("error while reading from socket");
+      }
+      if (replicationStatus.masterLinkState != MasterLinkState::Connected) {
+        if (input.length() > 64 * 1024) {
+          DEBUG_LOG(utility::colourize("handshake reply from master too long", utility::cc::RED));
+          _dropMasterLink(masterConnectorSocketFD, pollManager);
+          return -1;
         }
+        _updateMasterLinkEvents(pollManager);
+        return 0;
+      }
 
-        // checking if response is expected 
-        std::string response(buffer);
-        commandVec = utility::split(expectedResultVec[i], " ");
-        std::string expectedResponse = resp::RespParser::serialize(commandVec, resp::RespType::SimpleString);
-        bool isExpectedResponse = false;
-        if (i != 3) {
-          if (response == expectedResponse) {
-            isExpectedResponse = true;
-          }
-          else {
-            isExpectedResponse = false;
-          }
+      // the bytes following the PSYNC reply belong to the stream
+      DEBUG_LOG("successfully done handshake with master");
+      replicationStatus.reconnectDelayMs = 0;
+      std::string rest;
+      rest.swap(input);
+      if (!rest.empty() && 0 != _applyMasterStream(masterConnectorSocketFD, rest.data(), rest.length())) {
+        _dropMasterLink(masterConnectorSocketFD, pollManager);
+        return -1;
+      }
+      _sendAckToMaster();
+      _updateMasterLinkEvents(pollManager);
+      return 0;
+    }
+
+    // checks one handshake reply and sends the next command, the link is Connected once PSYNC is answered
+    int _handleHandshakeReply(const std::string& line) {
+      replicationStatus.masterLinkDeadlineMs = _getCurrentTimeMs() + ReplicationStatus::MASTER_LINK_TIMEOUT_MS;
+      switch (replicationStatus.masterLinkState) {
+        case MasterLinkState::ReceivePong: {
+          if (line != "+PONG")
+            return -1;
+          std::vector<std::string> command{"REPLCONF", "listening-port"};
+          auto listeningPortNumber = getConfigKv("listening-port");
+          if (listeningPortNumber.has_value())
+            command.push_back(*listeningPortNumber);
+          replicationStatus.masterLinkState = MasterLinkState::ReceivePortReply;
+          return _sendToMaster(command);
         }
-        else /*i==3 - PSYNC command*/ {
-          std::vector<std::string> responseVec = utility::split(response, " ");
-          std::ostringstream oss;
-          for (int i = 0; i < responseVec.size(); i++)
-            oss << "responseVec["<< i << "]=\"" << responseVec[i] << "\", "; 
-          DEBUG_LOG("case 3 : PSYNC COMMAND comparing : " + oss.str());
-          isExpectedResponse = utility::compareCaseInsensitive("+FULLRESYNC", responseVec[0]);
-          isExpectedResponse = isExpectedResponse && (responseVec[1].length() == 40);
-          isExpectedResponse = isExpectedResponse && (responseVec.size() >= 3);
+        case MasterLinkState::ReceivePortReply: {
+          if (line != "+OK")
+            return -1;
+          std::vector<std::string> command{"REPLCONF", "capa"};
+          auto capa = getConfigKv("capa");
+          if (capa.has_value())
+            command.push_back(*capa);
+          replicationStatus.masterLinkState = MasterLinkState::ReceiveCapaReply;
+          return _sendToMaster(command);
         }
-
-        if (isExpectedResponse) {
-          // DEBUG_LOG("got reply to handShakeCommand as expected, handShakeCommand=\"" + handShakeCommands[i] + "\"");
+        case MasterLinkState::ReceiveCapaReply: {
+          if (line != "+OK")
+            return -1;
+          // after a disconnection, ask the master to continue the stream right after the last byte processed
+          std::vector<std::string> command{"PSYNC", "?", "-1"};
+          if (!replicationStatus.replid.empty())
+            command = {"PSYNC", replicationStatus.replid, std::to_string(replicationStatus.backlog.get_master_offset() + 1)};
+          replicationStatus.masterLinkState = MasterLinkState::ReceivePsyncReply;
+          return _sendToMaster(command);
         }
-        else {
-          DEBUG_LOG("error occurred while replica master handshake - response not as expected, response : " + utility::printExact(response));
+        case MasterLinkState::ReceivePsyncReply:
+          break;
+        default:
           return -1;
+      }
+
+      std::vector<std::string> responseVec = utility::split(line, " ");
+      int64_t offset = 0;
+      if (responseVec.size() >= 3 && utility::compareCaseInsensitive("+FULLRESYNC", responseVec[0]) &&
+          responseVec[1].length() == 40 && 0 == utility::parseInt64(responseVec[2], offset)) {
+        replicationStatus.replid = responseVec[1];
+        replicationStatus.replid2 = std::string(40, '0');
+        replicationStatus.secondReplOffset = -1;
+        replicationStatus.backlog.reset(static_cast<uint64_t>(offset));
+        _abortRdbPayload();
+        replicationStatus.isAwaitingRdbPayload = true;
+        // the dataset and the stream of the replicas of this replica no longer follow, they resync from the new ones
+        _disconnectReplicas("master link did a full resync");
+        DEBUG_LOG("full resync with master, replid = " + responseVec[1] + ", offset = " + std::to_string(offset));
+      }
+      else if (responseVec.size() >= 1 && utility::compareCaseInsensitive("+CONTINUE", responseVec[0])) {
+        if (responseVec.size() >= 2 && responseVec[1].length() == 40 && responseVec[1] != replicationStatus.replid) {
+          // master changed its replid, the history up to here is still valid under the previous one
+          replicationStatus.replid2 = replicationStatus.replid;
+          replicationStatus.secondReplOffset = static_cast<int64_t>(replicationStatus.backlog.get_master_offset() + 1);
+          replicationStatus.replid = responseVec[1];
+          // the replicas of this replica learn the new replid when they reconnect (partial resync under replid2)
+          _disconnectReplicas("master replid changed");
         }
+        // the continued stream runs in the database it last selected
+        clientDbIndexes[replicationStatus.masterSocketFD] = static_cast<size_t>(std::max<int64_t>(replicationStatus.propagatedDbIndex, 0));
+        DEBUG_LOG("partial resync with master, continuing from offset " + std::to_string(replicationStatus.backlog.get_master_offset() + 1));
       }
+      else {
+        return -1;
+      }
+      replicationStatus.masterLinkState = MasterLinkState::Connected;
       return 0;
     }
 
+    // queues a command on the master link and writes what the socket accepts, the rest goes out on POLLOUT
+    int _sendToMaster(const std::vector<std::string>& command) {
+      if (replicationStatus.masterSocketFD == -1)
+        return -1;
+      replicationStatus.masterLinkOutput.append(resp::RespParser::serialize(command, resp::RespType::Array));
+      return replicationStatus.masterLinkOutput.flush(replicationStatus.masterSocketFD);
+    }
+
+    // POLLOUT is only polled for while the master link has queued output (or is connecting)
+    void _updateMasterLinkEvents(pm::PollManager& pollManager) {
+      if (replicationStatus.masterSocketFD == -1 || replicationStatus.masterLinkState == MasterLinkState::Connecting)
+        return;
+      bool isPolledForOutput = !replicationStatus.masterLinkOutput.empty();
+      if (isPolledForOutput == replicationStatus.isMasterLinkPolledForOutput)
+        return;
+      pollManager.setSocketFDEvents(replicationStatus.masterSocketFD, isPolledForOutput ? (POLLIN | POLLOUT) : POLLIN);
+      replicationStatus.isMasterLinkPolledForOutput = isPolledForOutput;
+    }
+
+    // closes the master link, the replid and offset processed so far are kept for the PSYNC of the next attempt
+    void _dropMasterLink(int& masterConnectorSocketFD, pm::PollManager& pollManager) {
+      clientDbIndexes.erase(replicationStatus.masterSocketFD);
+      pollManager.deleteConnectorSocket();
+      masterConnectorSocketFD = -1;
+      replicationStatus.masterSocketFD = -1;
+      replicationStatus.masterLinkState = MasterLinkState::None;
+      replicationStatus.masterLinkInput.clear();
+      replicationStatus.masterLinkOutput = OutputQueue();
+      _abortRdbPayload();
+      _scheduleMasterReconnect();
+    }
+
+    // exponential backoff between connection attempts, reset once a handshake completes
+    void _scheduleMasterReconnect() {
+      replicationStatus.nextConnectAttemptMs = _getCurrentTimeMs() + replicationStatus.reconnectDelayMs;
+      replicationStatus.reconnectDelayMs = std::clamp<uint64_t>(replicationStatus.reconnectDelayMs * 2,
+          ReplicationStatus::MIN_RECONNECT_DELAY_MS, ReplicationStatus::MAX_RECONNECT_DELAY_MS);
+    }
+
     // int _doReplicaMasterHandshake(int& serverConnectorSocketFD, resp::RespParser& respParser) {
     //   std::vector<std::string> handShakeCommands{"PING", "REPLCONF listening-port", "REPLCONF capa", "PSYNC ? -1"};
     //   const std::string receiveDataType = "simple_string";
@@ -513,17 +1309,51 @@ namespace RCC {
 
 
     std::string _processSingleCommand(int& socketFD, const std::string& command) {
-      std::stringstream ss;
       // for (auto& c : commandVec)
       // ss << "\"" << command << "\" | ";
       // DEBUG_LOG("before command = " + ss.str());
-      std::vector<std::string> commandVec = utility::split(command, " ");
-      ss.clear();
+      return _processSingleCommand(socketFD, utility::split(command, " "));
+    }
+
+    // binary safe entry point, arguments are already split (eg : framed from the replication stream)
+    std::string _processSingleCommand(int& socketFD, const std::vector<std::string>& commandVec) {
+      std::stringstream ss;
       for (auto& c : commandVec)
         ss << "\"" << c << "\" | ";
       DEBUG_LOG("after commandVec = " + ss.str() + "commandVec.size()=" + std::to_string(commandVec.size()));
       // commandVec = utility::split(commandVec, " 
 
+      // every command runs against the database selected by its client
+      redis_data_store_obj.select_db(_getClientDbIndex(socketFD));
+
+      // while the dataset loads in background, only commands not touching it run
+      if (loadingStatus.isLoading) {
+        static const std::vector<std::string> loadingCommands{"PING", "ECHO", "INFO", "CONFIG", "SELECT", "SUBSCRIBE", "UNSUBSCRIBE", "PSUBSCRIBE", "PUNSUBSCRIBE", "PUBLISH"};
+        if (std::none_of(loadingCommands.begin(), loadingCommands.end(), [&](const std::string& c) { return utility::compareCaseInsensitive(c, commandVec[0]); })) {
+          return resp::RespParser::serialize({"LOADING Redis is loading the dataset in memory"}, resp::RespType::SimpleError);
+        }
+      }
+
+      // writes are refused while the append only file cannot be written, except the stream from the master
+      if (appendOnlyFile.is_open() && !appendOnlyFile.get_is_last_write_ok() && socketFD != replicationStatus.masterSocketFD) {
+        const WriteCommand* writeCommand = _findWriteCommand(commandVec);
+        if (writeCommand != nullptr && !_isNoOpWriteCommand(*writeCommand, commandVec)) {
+          return resp::RespParser::serialize({"MISCONF Errors writing to the AOF file, see the server logs"}, resp::RespType::SimpleError);
+        }
+      }
+
+      // RESP2 clients with subscriptions may only manage them (and PING)
+      if (pubSub.subscription_count(socketFD) > 0) {
+        static const std::vector<std::string> allowedCommands{"SUBSCRIBE", "UNSUBSCRIBE", "PSUBSCRIBE", "PUNSUBSCRIBE", "PING", "QUIT", "RESET"};
+        if (utility::compareCaseInsensitive("PING", commandVec[0])) {
+          return resp::RespParser::serialize({"pong", (commandVec.size() > 1) ? commandVec[1] : ""}, resp::RespType::Array);
+        }
+        if (std::none_of(allowedCommands.begin(), allowedCommands.end(), [&](const std::string& c) { return utility::compareCaseInsensitive(c, commandVec[0]); })) {
+          std::string errStr = "ERR Can't execute '" + commandVec[0] + "': only (P|S)SUBSCRIBE / (P|S)UNSUBSCRIBE / PING / QUIT / RESET are allowed in this context";
+          return resp::RespParser::serialize({errStr}, resp::RespType::SimpleError);
+        }
+      }
+
       // commandVec PING
       if (utility::compareCaseInsensitive("PING", commandVec[0])) {
         return _commandPING();
@@ -540,6 +1370,14 @@ namespace RCC {
       else if (utility::compareCaseInsensitive("GET", commandVec[0])) {
         return _commandGET(commandVec);
       }
+      // command DEL key [key ...]
+      else if (utility::compareCaseInsensitive("DEL", commandVec[0])) {
+        return _commandDEL(commandVec);
+      }
+      // command WAIT numreplicas timeout
+      else if (utility::compareCaseInsensitive("WAIT", commandVec[0])) {
+        return _commandWAIT(socketFD, commandVec);
+      }
       // command CONFIG GET
       else if (commandVec.size() >= 2 && 
               utility::compareCaseInsensitive("CONFIG", commandVec[0]) &&
@@ -555,22 +1393,180 @@ namespace RCC {
       else if (utility::compareCaseInsensitive("INFO", commandVec[0])) {
         return _commandINFO(commandVec);
       }
+      // command SAVE
+      else if (utility::compareCaseInsensitive("SAVE", commandVec[0])) {
+        return _commandSAVE(commandVec);
+      }
+      // command BGSAVE
+      else if (utility::compareCaseInsensitive("BGSAVE", commandVec[0])) {
+        return _commandBGSAVE(commandVec);
+      }
+      // command BGREWRITEAOF
+      else if (utility::compareCaseInsensitive("BGREWRITEAOF", commandVec[0])) {
+        return _commandBGREWRITEAOF(commandVec);
+      }
+      // command SELECT
+      else if (utility::compareCaseInsensitive("SELECT", commandVec[0])) {
+        return _commandSELECT(socketFD, commandVec);
+      }
+      // command MOVE
+      else if (utility::compareCaseInsensitive("MOVE", commandVec[0])) {
+        return _commandMOVE(commandVec);
+      }
+      // command SWAPDB
+      else if (utility::compareCaseInsensitive("SWAPDB", commandVec[0])) {
+        return _commandSWAPDB(commandVec);
+      }
+      // command FLUSHDB
+      else if (utility::compareCaseInsensitive("FLUSHDB", commandVec[0])) {
+        return _commandFLUSHDB(commandVec);
+      }
       // command REPLCONF listening-port <replicaListenerPort>, REPLCONF capa psync2
       else if (utility::compareCaseInsensitive("REPLCONF", commandVec[0])) {
-        return _commandREPLCONF(commandVec);
+        return _commandREPLCONF(socketFD, commandVec);
       }
       // command PSYNC ? -1
       else if (utility::compareCaseInsensitive("PSYNC", commandVec[0])) {
         return _commandPSYNC(socketFD, commandVec);
       }
-      // Invalid command
-      else {
-        std::string errStr("err invalid command : " + commandVec[0]);
-        return resp::RespParser::serialize({errStr}, resp::RespType::SimpleError);
+      // command TYPE key
+      else if (utility::compareCaseInsensitive("TYPE", commandVec[0])) {
+        return _commandTYPE(commandVec);
       }
-    }
-
-    // std::vector<std::string> _commandPING() {
+      // command XADD key [NOMKSTREAM] [MAXLEN|MINID [=|~] threshold] *|id field value [field value ...]
+      else if (utility::compareCaseInsensitive("XADD", commandVec[0])) {
+        return _commandXADD(commandVec);
+      }
+      // command XRANGE key start end [COUNT count], XREVRANGE key end start [COUNT count]
+      else if (utility::compareCaseInsensitive("XRANGE", commandVec[0])) {
+        return _commandXRANGE(commandVec, false);
+      }
+      else if (utility::compareCaseInsensitive("XREVRANGE", commandVec[0])) {
+        return _commandXRANGE(commandVec, true);
+      }
+      // command XLEN key
+      else if (utility::compareCaseInsensitive("XLEN", commandVec[0])) {
+        return _commandXLEN(commandVec);
+      }
+      // command XTRIM key MAXLEN|MINID [=|~] threshold
+      else if (utility::compareCaseInsensitive("XTRIM", commandVec[0])) {
+        return _commandXTRIM(commandVec);
+      }
+      // command XGROUP CREATE key group id|$ [MKSTREAM], XGROUP DESTROY key group
+      else if (utility::compareCaseInsensitive("XGROUP", commandVec[0])) {
+        return _commandXGROUP(commandVec);
+      }
+      // command XREADGROUP GROUP group consumer [COUNT count] [NOACK] STREAMS key [key ...] id [id ...]
+      else if (utility::compareCaseInsensitive("XREADGROUP", commandVec[0])) {
+        return _commandXREADGROUP(commandVec);
+      }
+      // command XACK key group id [id ...]
+      else if (utility::compareCaseInsensitive("XACK", commandVec[0])) {
+        return _commandXACK(commandVec);
+      }
+      // command SETBIT key offset value, GETBIT key offset
+      else if (utility::compareCaseInsensitive("SETBIT", commandVec[0])) {
+        return _commandSETBIT(commandVec);
+      }
+      else if (utility::compareCaseInsensitive("GETBIT", commandVec[0])) {
+        return _commandGETBIT(commandVec);
+      }
+      // command BITCOUNT key [start end [BYTE|BIT]]
+      else if (utility::compareCaseInsensitive("BITCOUNT", commandVec[0])) {
+        return _commandBITCOUNT(commandVec);
+      }
+      // command BITPOS key bit [start [end [BYTE|BIT]]]
+      else if (utility::compareCaseInsensitive("BITPOS", commandVec[0])) {
+        return _commandBITPOS(commandVec);
+      }
+      // command BITOP AND|OR|XOR|NOT destkey key [key ...]
+      else if (utility::compareCaseInsensitive("BITOP", commandVec[0])) {
+        return _commandBITOP(commandVec);
+      }
+      // command BITFIELD key [GET type offset] [SET type offset value] [INCRBY type offset increment] [OVERFLOW WRAP|SAT|FAIL]
+      else if (utility::compareCaseInsensitive("BITFIELD", commandVec[0])) {
+        return _commandBITFIELD(commandVec);
+      }
+      // command PFADD key [element [element ...]]
+      else if (utility::compareCaseInsensitive("PFADD", commandVec[0])) {
+        return _commandPFADD(commandVec);
+      }
+      // command PFCOUNT key [key ...]
+      else if (utility::compareCaseInsensitive("PFCOUNT", commandVec[0])) {
+        return _commandPFCOUNT(commandVec);
+      }
+      // command PFMERGE destkey [sourcekey [sourcekey ...]]
+      else if (utility::compareCaseInsensitive("PFMERGE", commandVec[0])) {
+        return _commandPFMERGE(commandVec);
+      }
+      // command LPUSH key element [element ...]
+      else if (utility::compareCaseInsensitive("LPUSH", commandVec[0])) {
+        return _commandPUSH(commandVec, true);
+      }
+      // command RPUSH key element [element ...]
+      else if (utility::compareCaseInsensitive("RPUSH", commandVec[0])) {
+        return _commandPUSH(commandVec, false);
+      }
+      // command LPOP key [count]
+      else if (utility::compareCaseInsensitive("LPOP", commandVec[0])) {
+        return _commandPOP(commandVec, true);
+      }
+      // command RPOP key [count]
+      else if (utility::compareCaseInsensitive("RPOP", commandVec[0])) {
+        return _commandPOP(commandVec, false);
+      }
+      // command LLEN key
+      else if (utility::compareCaseInsensitive("LLEN", commandVec[0])) {
+        return _commandLLEN(commandVec);
+      }
+      // command LRANGE key start stop
+      else if (utility::compareCaseInsensitive("LRANGE", commandVec[0])) {
+        return _commandLRANGE(commandVec);
+      }
+      // command LMOVE source destination LEFT|RIGHT LEFT|RIGHT
+      else if (utility::compareCaseInsensitive("LMOVE", commandVec[0])) {
+        return _commandLMOVE(socketFD, commandVec, false);
+      }
+      // command BLPOP key [key ...] timeout
+      else if (utility::compareCaseInsensitive("BLPOP", commandVec[0])) {
+        return _commandBPOP(socketFD, commandVec, true);
+      }
+      // command BRPOP key [key ...] timeout
+      else if (utility::compareCaseInsensitive("BRPOP", commandVec[0])) {
+        return _commandBPOP(socketFD, commandVec, false);
+      }
+      // command BLMOVE source destination LEFT|RIGHT LEFT|RIGHT timeout
+      else if (utility::compareCaseInsensitive("BLMOVE", commandVec[0])) {
+        return _commandLMOVE(socketFD, commandVec, true);
+      }
+      // command SUBSCRIBE channel [channel ...]
+      else if (utility::compareCaseInsensitive("SUBSCRIBE", commandVec[0])) {
+        return _commandSUBSCRIBE(socketFD, commandVec, false);
+      }
+      // command PSUBSCRIBE pattern [pattern ...]
+      else if (utility::compareCaseInsensitive("PSUBSCRIBE", commandVec[0])) {
+        return _commandSUBSCRIBE(socketFD, commandVec, true);
+      }
+      // command UNSUBSCRIBE [channel [channel ...]]
+      else if (utility::compareCaseInsensitive("UNSUBSCRIBE", commandVec[0])) {
+        return _commandUNSUBSCRIBE(socketFD, commandVec, false);
+      }
+      // command PUNSUBSCRIBE [pattern [pattern ...]]
+      else if (utility::compareCaseInsensitive("PUNSUBSCRIBE", commandVec[0])) {
+        return _commandUNSUBSCRIBE(socketFD, commandVec, true);
+      }
+      // command PUBLISH channel message
+      else if (utility::compareCaseInsensitive("PUBLISH", commandVec[0])) {
+        return _commandPUBLISH(commandVec);
+      }
+      // Invalid command
+      else {
+        std::string errStr("err invalid command : " + commandVec[0]);
+        return resp::RespParser::serialize({errStr}, resp::RespType::SimpleError);
+      }
+    }
+
+    // std::vector<std::string> _commandPING() {
     //   std::vector<std::string> reply;
     //   reply.push_back(resp::RespParser::serialize({"PONG"}, "simple_string"));
     //   return reply;
@@ -602,24 +1598,42 @@ namespace RCC {
         return resp::RespParser::serialize({response}, resp::RespType::SimpleError);
       }
 
-      std::string sss = resp::RespParser::serialize(commandVec, resp::RespType::Array);
-      DEBUG_LOG(utility::printExact(sss));
-      if (0 == sendCommandToAllReplicas(sss)) {
-        DEBUG_LOG("successfully sent command to all replicas");
-      }
-      else {
-        DEBUG_LOG("failed to send command to all replicas");
-      }
 
       resp::RespType dataType;
-      uint64_t expiry_time_ms = UINT64_MAX;
-      if (5 == commandVec.size() && utility::compareCaseInsensitive("PX", commandVec[3])) {
-        expiry_time_ms = std::stol(commandVec[4]);
+      // SET key value [EX seconds | PX milliseconds | EXAT unix-time-seconds | PXAT unix-time-milliseconds]
+      uint64_t expiry_time_ms = UINT64_MAX;  // absolute
+      if (commandVec.size() != 3 && commandVec.size() != 5) {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
       }
-      
+      if (5 == commandVec.size()) {
+        const std::string& option = commandVec[3];
+        bool isSeconds = utility::compareCaseInsensitive("EX", option) || utility::compareCaseInsensitive("EXAT", option);
+        bool isAbsolute = utility::compareCaseInsensitive("EXAT", option) || utility::compareCaseInsensitive("PXAT", option);
+        if (!isSeconds && !isAbsolute && !utility::compareCaseInsensitive("PX", option)) {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+        int64_t time = 0;
+        if (0 != utility::parseInt64(commandVec[4], time)) {
+          return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+        }
+        uint64_t nowMs = _getUnixTimeMs();
+        if (time <= 0 || (isSeconds && time > INT64_MAX / 1000) ||
+            (!isAbsolute && static_cast<uint64_t>(isSeconds ? time * 1000 : time) > INT64_MAX - nowMs)) {
+          return resp::RespParser::serialize({"ERR invalid expire time in 'set' command"}, resp::RespType::SimpleError);
+        }
+        expiry_time_ms = static_cast<uint64_t>(isSeconds ? time * 1000 : time) + (isAbsolute ? 0 : nowMs);
+      }
+
       if (0 == redis_data_store_obj.set_kv(commandVec[1], commandVec[2], expiry_time_ms)) {
         response = "OK";
         dataType = resp::RespType::SimpleString;
+        if (expiry_time_ms != UINT64_MAX) {
+          // logged with the absolute expiry, so replaying the command later (or on a replica) does not extend it
+          _propagateWriteCommand({"SET", commandVec[1], commandVec[2], "PXAT", std::to_string(expiry_time_ms)});
+        }
+        else {
+          _propagateWriteCommand(commandVec);
+        }
       }
       else {
         response = "Error while storing key value pair.";
@@ -635,6 +1649,10 @@ namespace RCC {
         return resp::RespParser::serialize({response}, resp::RespType::SimpleError);
       }
       
+      std::string keyType = redis_data_store_obj.get_key_type(command[1]);
+      if (keyType != "string" && keyType != "none") {
+        return resp::RespParser::serialize({"WRONGTYPE Operation against a key holding the wrong kind of value"}, resp::RespType::SimpleError);
+      }
       auto result = redis_data_store_obj.get_kv(command[1]);
       if (result.has_value()) {
         response = *result;
@@ -646,6 +1664,17 @@ namespace RCC {
       return response;
     }
 
+    std::string _commandDEL(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'del' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> keys(commandVec.begin() + 1, commandVec.end());
+      size_t numDeleted = redis_data_store_obj.delete_keys(keys);
+      if (numDeleted > 0)
+        _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(numDeleted)}, resp::RespType::Integer);
+    }
+
     std::string _commandCONFIG_GET(const std::vector<std::string>& command) {
       std::string response;
       if (command.size() < 3) {
@@ -704,10 +1733,14 @@ namespace RCC {
       for(auto& e : reply) 
         ss << e << ",| ";
       DEBUG_LOG(ss.str());
-      return resp::RespParser::serialize(reply, resp::RespType::BulkString);
+      // sections are separated by an empty line
+      std::string info;
+      for (auto& section : reply)
+        info += (info.empty() ? "" : "\r\n\r\n") + section;
+      return resp::RespParser::serialize({info}, resp::RespType::BulkString);
     }
     
-    std::string _commandREPLCONF(const std::vector<std::string>& command) {
+    std::string _commandREPLCONF(int& socketFD, const std::vector<std::string>& command) {
       std::string response;
       
       if (command.size() < 3) {
@@ -715,9 +1748,26 @@ namespace RCC {
         return resp::RespParser::serialize({response}, resp::RespType::SimpleError);
       }
 
-      if (utility::compareCaseInsensitive("listening-port", command[1])) {
+      if (utility::compareCaseInsensitive("ACK", command[1])) {
+        // REPLCONF ACK <offset> from a replica, never answered
+        int64_t offset = 0;
+        auto it = replicaClients.find(socketFD);
+        if (it != replicaClients.end() && 0 == utility::parseInt64(command[2], offset) && offset >= 0) {
+          it->second.ackOffset = std::max(it->second.ackOffset, static_cast<uint64_t>(offset));
+          it->second.ackTimeMs = _getCurrentTimeMs();
+          _serveClientsWaitingForAcks();
+        }
+        return "";
+      }
+      else if (utility::compareCaseInsensitive("GETACK", command[1])) {
+        // sent by the master in the replication stream, answered with REPLCONF ACK <offset> on the master link
+        _sendAckToMaster();
+        return "";
+      }
+      else if (utility::compareCaseInsensitive("listening-port", command[1])) {
         // save port
         setConfigKv("replica_listening-port", command[2]);
+        replicaClients[socketFD].listeningPort = command[2];
         DEBUG_LOG("replica is listening at port - " + command[2]);
       }
       else if (utility::compareCaseInsensitive("capa", command[1])) {
@@ -729,6 +1779,95 @@ namespace RCC {
       return resp::RespParser::serialize({response}, resp::RespType::SimpleString);
     }
 
+    // WAIT numreplicas timeout : replies with the number of replicas which acknowledged every write made before it,
+    // once numreplicas did or after timeout milliseconds (0 waits forever); the client is parked meanwhile
+    std::string _commandWAIT(int& socketFD, const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'wait' command"}, resp::RespType::SimpleError);
+      }
+      if (getConfigKv("role").value_or("master") != "master") {
+        return resp::RespParser::serialize({"ERR WAIT cannot be used with replica instances. Please also note that since Redis 4.0 if a replica is configured to be writable (which is not the default) writes to replicas are just local and are not propagated."}, resp::RespType::SimpleError);
+      }
+      int64_t numReplicas = 0, timeoutMs = 0;
+      if (0 != utility::parseInt64(commandVec[1], numReplicas) || 0 != utility::parseInt64(commandVec[2], timeoutMs)) {
+        return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+      }
+      if (timeoutMs < 0) {
+        return resp::RespParser::serialize({"ERR timeout is negative"}, resp::RespType::SimpleError);
+      }
+      // writes of this event loop iteration are part of what must be acknowledged
+      _flushReplicationStream();
+      BlockedClient client;
+      client.waitOffset = replicationStatus.backlog.get_master_offset();
+      client.waitNumReplicas = numReplicas;
+      size_t numAcked = _countReplicasAcked(*client.waitOffset);
+      if (numReplicas <= 0 || numAcked >= static_cast<size_t>(numReplicas)) {
+        return resp::RespParser::serialize({std::to_string(numAcked)}, resp::RespType::Integer);
+      }
+      if (timeoutMs > 0)
+        client.deadlineMs = _getCurrentTimeMs() + static_cast<uint64_t>(timeoutMs);
+      _blockClient(socketFD, std::move(client));
+      replicationStatus.isGetAckRequested = true;  // REPLCONF GETACK * goes out with the next flush of the stream
+      return "";
+    }
+
+    size_t _countReplicasAcked(uint64_t offset) {
+      return std::count_if(replicaClients.begin(), replicaClients.end(), [&](const auto& entry) {
+        return entry.second.isOnline && entry.second.ackOffset >= offset;
+      });
+    }
+
+    size_t _countOnlineReplicas() {
+      return _countReplicasAcked(0);
+    }
+
+    // unparks WAIT clients whose offset enough replicas acknowledged
+    void _serveClientsWaitingForAcks() {
+      std::vector<std::pair<int, size_t>> servedClients;
+      for (auto& [socketFD, client] : blockedClients) {
+        if (!client.waitOffset.has_value())
+          continue;
+        size_t numAcked = _countReplicasAcked(*client.waitOffset);
+        if (numAcked >= static_cast<size_t>(client.waitNumReplicas))
+          servedClients.emplace_back(socketFD, numAcked);
+      }
+      for (auto& [socketFD, numAcked] : servedClients)
+        _unblockClient(socketFD, resp::RespParser::serialize({std::to_string(numAcked)}, resp::RespType::Integer));
+    }
+
+    static std::string _getPeerIp(int socketFD) {
+      struct sockaddr_storage address;
+      socklen_t addressLength = sizeof(address);
+      char ip[INET6_ADDRSTRLEN] = "?";
+      if (0 == getpeername(socketFD, reinterpret_cast<struct sockaddr*>(&address), &addressLength)) {
+        if (address.ss_family == AF_INET)
+          inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(&address)->sin_addr, ip, sizeof(ip));
+        else if (address.ss_family == AF_INET6)
+          inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(&address)->sin6_addr, ip, sizeof(ip));
+      }
+      return ip;
+    }
+
+    void _setReplicaOnline(int socketFD) {
+      ReplicaClient& replica = replicaClients[socketFD];
+      replica.isOnline = true;
+      replica.softLimitReachedMs = 0;
+      replica.ackOffset = 0;
+      replica.ackTimeMs = _getCurrentTimeMs();
+    }
+
+    // replica side, REPLCONF ACK <offset processed> on the master link
+    int _sendAckToMaster() {
+      if (replicationStatus.masterLinkState != MasterLinkState::Connected)
+        return -1;
+      replicationStatus.lastAckSentMs = _getCurrentTimeMs();
+      if (0 != _sendToMaster({"REPLCONF", "ACK", std::to_string(replicationStatus.backlog.get_master_offset())})) {
+        DEBUG_LOG("failed to send REPLCONF ACK to master");
+        return -1;
+      }
+      return 0;
+    }
+
     std::string _commandPSYNC(int& socketFD, const std::vector<std::string>& command) {
       std::string response;
 
@@ -737,84 +1876,1559 @@ namespace RCC {
         return resp::RespParser::serialize({response}, resp::RespType::SimpleError);
       }
 
-      // get master replication id; generate replid if not present
-      auto masterReplid = getConfigKv("master_replid").value_or("8371b4fb1155b71f4a04d3e1b<random-replid>");
+      // a replica serves its own replicas the stream of its master, from the point its dataset is at
+      if (getConfigKv("role").value_or("master") != "master" &&
+          (!isMasterLinkUp() || replicationStatus.isAwaitingRdbPayload || replicationStatus.rdbPayloadReader)) {
+        return resp::RespParser::serialize({"NOMASTERLINK Can't SYNC while not connected with my master"}, resp::RespType::SimpleError);
+      }
 
-      // get master replication offset; assign default "0" if not present
-      auto masterReplOffset = getConfigKv("master_repl_offset").value_or("0");
+      // writes propagated earlier in this event loop iteration belong before the offset the replica starts from
+      _flushReplicationStream();
+
+      // PSYNC <replid> <offset> : the replica continues from the backlog if it still holds every byte after offset - 1
+      int64_t psyncOffset = -1;
+      if (0 == _canPartialResync(command[1], command[2], psyncOffset)) {
+        response = resp::RespParser::serialize({"CONTINUE " + replicationStatus.replid}, resp::RespType::SimpleString);
+        replicationStatus.backlog.copy_from(static_cast<uint64_t>(psyncOffset), response);
+        _setReplicaOnline(socketFD);
+        replicationStatus.numPartialResyncs++;
+        DEBUG_LOG("partial resync of replica " + std::to_string(socketFD) + " from offset " + command[2]);
+        return response;
+      }
+      if ("?" != command[1])
+        replicationStatus.numPartialResyncErrors++;
+
+      // full resync : +FULLRESYNC and the snapshot follow once the next diskless sync starts (_checkDisklessSync())
+      ReplicaClient& replica = replicaClients[socketFD];
+      replica.isOnline = false;
+      replica.fullSyncState = FullSyncState::WaitingSnapshot;
+      replica.fullSyncRequestMs = _getCurrentTimeMs();
+      replica.streamDuringFullSync.clear();
+      DEBUG_LOG("full resync of replica " + std::to_string(socketFD) + " waits for the next diskless snapshot");
+      return "";
+    }
 
-      std::vector<std::string> reply;
-      response = "FULLRESYNC " + masterReplid + " " + masterReplOffset;
-      // reply.push_back(resp::RespParser::serialize({response}, resp::RespType::SimpleString));
-      response  = resp::RespParser::serialize({response}, resp::RespType::SimpleString);
-
-      // generate rdb file if PSYNC ? -1 
-      if ("?" == command[1]) {
-        // std::string rdbFileName = "rdbFile_" + masterReplid;
-        // _generateRDBFile(RDB_FILE_DIR + rdbFileName);
-
-        // std::ifstream rdbFile(RDB_FILE_DIR + rdbFileName, std::ios::binary);
-        // if (!rdbFile) {
-        //   response = "failed to open file : " + utility::printExact(rdbFileName);
-        //   DEBUG_LOG(response);
-        //   reply.push_back(resp::RespParser::serialize({response}, resp::RespType::SimpleError));
-        // }
-        // get the file size
-        // rdbFile.seekg(0, std::ios::end);
-        // std::streamsize fileSize = rdbFile.tellg();
-        // rdbFile.seekg(0, std::ios::beg);
-        // DEBUG_LOG("opened file in binary mode : " + utility::printExact(rdbFileName) + ", fileSize = " + std::to_string(fileSize));
-
-        // std::ostringstream rdbFileContent;
-        std::string rdbFileContent = generateEmptyRdbFileContent();
-        rdbFileContent = "$" + std::to_string(rdbFileContent.length()) + "\r\n" + rdbFileContent;
-        // const std::size_t bufferSize = 4096;
-        // char buffer[bufferSize];
-        // while (rdbFile.read(buffer, bufferSize)) {
-        //     rdbFileContent.write(buffer, rdbFile.gcount());
-        //     // DEBUG_LOG("rdbFile.gcount()=" + std::to_string(rdbFile.gcount()));
-        //     // for (int i = 0; i < rdbFile.gcount(); i++)
-        //     //   rdbFileContent << buffer[i];
-        // }
-        // DEBUG_LOG("closing rdb file : " + utility::printExact(rdbFileName));
-        // rdbFile.close();
-        // reply.push_back(rdbFileContent.str());
-        DEBUG_LOG("file content : " + utility::printExact(rdbFileContent));
-        response += rdbFileContent;
-      }
-      // return reply;
-
-      // if reached here, it means master is connected with the replica which sent : 1) PING 2) REPLCONF ... 3) REPLCONF ... 4) PSYNC ? -1
-      // so add it to replicaSocketFDSet
-      replicaSocketFDSet.insert(socketFD);
-      std::ostringstream oss; 
-      oss << "replicaSocketFDSet = {";
-      for (auto& fd : replicaSocketFDSet) {
-        oss << fd << ", ";
-      }
-      oss << "}";
-      DEBUG_LOG(oss.str());
-      DEBUG_LOG("returning PSYNC response = " + utility::printExact(response));
-      return response;
+    /*
+      Diskless full resynchronization : once the first replica waiting for one waited repl-diskless-sync-delay (so
+      replicas connecting close together share the snapshot), a forked child serializes its copy-on-write keyspace
+      into a pipe. Every waiting replica gets +FULLRESYNC with the offset of the fork, then the event loop forwards
+      the pipe to all of them as "$EOF:<mark>\r\n<rdb><mark>" : nothing touches the disk and the size is not known
+      upfront. The pipe is read only while every replica drained its output, so the slowest one paces the child.
+      The stream produced meanwhile is kept per replica and follows the snapshot.
+    */
+
+    bool _isDisklessSyncRequested() {
+      return std::any_of(replicaClients.begin(), replicaClients.end(), [](const auto& entry) {
+        return entry.second.fullSyncState == FullSyncState::WaitingSnapshot;
+      });
+    }
+
+    void _checkDisklessSync() {
+      if (disklessSyncStatus.childPid != -1) {
+        _forwardDisklessSnapshot();
+        return;
+      }
+      uint64_t earliestRequestMs = UINT64_MAX;
+      for (auto& [replicaSocketFD, replica] : replicaClients)
+        if (replica.fullSyncState == FullSyncState::WaitingSnapshot)
+          earliestRequestMs = std::min(earliestRequestMs, replica.fullSyncRequestMs);
+      if (earliestRequestMs == UINT64_MAX || _getCurrentTimeMs() - earliestRequestMs < disklessSyncStatus.delayMs)
+        return;
+      _startDisklessSync();
+    }
+
+    int _startDisklessSync() {
+      // writes of this event loop iteration belong before the offset of the snapshot
+      _flushReplicationStream();
+      int pipeFDs[2];
+      if (0 != pipe2(pipeFDs, O_CLOEXEC)) {
+        DEBUG_LOG(utility::colourize("pipe() failed for diskless sync : " + std::string(strerror(errno)), utility::cc::RED));
+        return -1;
+      }
+      fcntl(pipeFDs[0], F_SETFL, O_NONBLOCK);  // the child writes blocking, paced by the parent reading
+      fcntl(pipeFDs[1], F_SETPIPE_SZ, 1 << 20);  // best effort, fewer wake ups of the child
+      pid_t pid = -1;
+      do {
+        // same as BGSAVE : no thread is inside the store while forking
+        auto keyspaceLock = redis_data_store_obj.lock_keyspace();
+        pid = fork();
+        if (pid == 0) {
+          close(pipeFDs[0]);
+          RdbFileWriter rdbFileWriter;
+          std::vector<std::pair<std::string, std::string>> auxFields;
+          if (replicationStatus.propagatedDbIndex >= 0)
+            auxFields.emplace_back("repl-stream-db", std::to_string(replicationStatus.propagatedDbIndex));
+          // a snapshot missing part of the dataset would leave the replicas diverged : the parent sees the failed
+          // status once the pipe ends, and drops the replicas instead of sending them the EOF mark
+          int status = rdbFileWriter.writeToFd(pipeFDs[1], redis_data_store_obj, auxFields);
+          if (status != 0) {
+            DEBUG_LOG(utility::colourize("writing the diskless snapshot failed after " + std::to_string(rdbFileWriter.getKeysWritten()) + " keys", utility::cc::RED));
+          }
+          _exit(status == 0 ? 0 : 1);
+        }
+      } while(false);
+      close(pipeFDs[1]);
+      if (pid < 0) {
+        close(pipeFDs[0]);
+        DEBUG_LOG(utility::colourize("fork() failed for diskless sync : " + std::string(strerror(errno)), utility::cc::RED));
+        return -1;  // retried on the next event loop iteration
+      }
+      disklessSyncStatus.childPid = pid;
+      disklessSyncStatus.pipeFD = pipeFDs[0];
+      disklessSyncStatus.eofMark = _generateReplid();  // 40 random characters
+      disklessSyncStatus.bytesSent = 0;
+
+      std::string header = resp::RespParser::serialize({"FULLRESYNC " + replicationStatus.replid + " " + std::to_string(replicationStatus.backlog.get_master_offset())}, resp::RespType::SimpleString) +
+                           "$EOF:" + disklessSyncStatus.eofMark + "\r\n";
+      auto buffer = std::make_shared<const std::string>(header);
+      size_t numReplicas = 0;
+      for (auto& [replicaSocketFD, replica] : replicaClients) {
+        if (replica.fullSyncState != FullSyncState::WaitingSnapshot)
+          continue;
+        replica.fullSyncState = FullSyncState::SendingSnapshot;
+        _enqueueOutput(replicaSocketFD, buffer);
+        replicationStatus.numFullResyncs++;
+        numReplicas++;
+      }
+      // the stream a master produces after the snapshot selects its database, a replica relays its master's as is
+      if (getConfigKv("role").value_or("master") == "master")
+        replicationStatus.propagatedDbIndex = -1;
+      DEBUG_LOG("diskless sync started by pid " + std::to_string(pid) + " for " + std::to_string(numReplicas) + " replica(s)");
+      return 0;
+    }
+
+    // forwards what the child wrote so far to the replicas receiving the snapshot, finishes the sync at the end of it
+    void _forwardDisklessSnapshot() {
+      const size_t maxPendingBytes = 1 << 20;  // output of a replica above which the pipe is not read
+      const size_t maxBytesPerCall = 8 << 20;
+      std::vector<int> receivers;
+      for (auto& [replicaSocketFD, replica] : replicaClients)
+        if (replica.fullSyncState == FullSyncState::SendingSnapshot)
+          receivers.push_back(replicaSocketFD);
+      if (receivers.empty()) {
+        DEBUG_LOG("every replica of the diskless sync disconnected, stopping it");
+        _finishDisklessSync(false);
+        return;
+      }
+      std::vector<char> buffer(256 << 10);
+      size_t forwardedBytes = 0;
+      while (forwardedBytes < maxBytesPerCall) {
+        for (int replicaSocketFD : receivers) {
+          auto it = clientOutputQueues.find(replicaSocketFD);
+          if (it != clientOutputQueues.end() && it->second.size_in_bytes() >= maxPendingBytes)
+            return;  // read again once the slowest replica took it
+        }
+        ssize_t numBytes = read(disklessSyncStatus.pipeFD, buffer.data(), buffer.size());
+        if (numBytes < 0 && errno == EINTR)
+          continue;
+        if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          return;
+        if (numBytes < 0) {
+          DEBUG_LOG(utility::colourize("reading the diskless snapshot failed : " + std::string(strerror(errno)), utility::cc::RED));
+          _finishDisklessSync(false);
+          return;
+        }
+        if (numBytes == 0) {
+          // end of the snapshot, the child is exiting and its status tells if the snapshot is complete
+          int waitStatus = 0;
+          bool isOk = waitpid(disklessSyncStatus.childPid, &waitStatus, 0) == disklessSyncStatus.childPid &&
+                      WIFEXITED(waitStatus) && WEXITSTATUS(waitStatus) == 0;
+          if (!isOk) {
+            DEBUG_LOG(utility::colourize("diskless snapshot child " + std::to_string(disklessSyncStatus.childPid) +
+                                         " did not complete the snapshot (wait status " + std::to_string(waitStatus) + ")", utility::cc::RED));
+          }
+          disklessSyncStatus.childPid = -1;
+          _finishDisklessSync(isOk);
+          return;
+        }
+        auto chunk = std::make_shared<const std::string>(buffer.data(), numBytes);
+        for (int replicaSocketFD : receivers)
+          _enqueueOutput(replicaSocketFD, chunk);
+        disklessSyncStatus.bytesSent += numBytes;
+        forwardedBytes += numBytes;
+      }
+    }
+
+    // successful : the replicas get the EOF mark and the stream produced meanwhile, and are online from there;
+    // otherwise they are disconnected and resync when they reconnect
+    void _finishDisklessSync(bool isOk) {
+      if (disklessSyncStatus.childPid != -1) {
+        kill(disklessSyncStatus.childPid, SIGKILL);
+        waitpid(disklessSyncStatus.childPid, nullptr, 0);
+      }
+      close(disklessSyncStatus.pipeFD);
+      disklessSyncStatus.pipeFD = -1;
+      disklessSyncStatus.childPid = -1;
+      auto eofMark = std::make_shared<const std::string>(disklessSyncStatus.eofMark);
+      std::vector<int> failedReplicas;
+      for (auto& [replicaSocketFD, replica] : replicaClients) {
+        if (replica.fullSyncState != FullSyncState::SendingSnapshot)
+          continue;
+        if (!isOk) {
+          failedReplicas.push_back(replicaSocketFD);
+          continue;
+        }
+        _enqueueOutput(replicaSocketFD, eofMark);
+        clientOutputQueues[replicaSocketFD].append(std::move(replica.streamDuringFullSync));
+        replica.streamDuringFullSync = std::string();
+        replica.fullSyncState = FullSyncState::None;
+        _setReplicaOnline(replicaSocketFD);
+      }
+      for (int replicaSocketFD : failedReplicas) {
+        DEBUG_LOG(utility::colourize("diskless sync failed, disconnecting replica " + std::to_string(replicaSocketFD), utility::cc::RED));
+        replicaClients.erase(replicaSocketFD);
+        shutdown(replicaSocketFD, SHUT_RDWR);
+      }
+      DEBUG_LOG("diskless sync " + std::string(isOk ? "done" : "failed") + ", " + std::to_string(disklessSyncStatus.bytesSent) + " bytes of snapshot sent");
+    }
+
+    // returns 0 if the backlog covers the stream the replica asks for, under the current or the previous replid
+    int _canPartialResync(const std::string& replid, const std::string& offsetStr, int64_t& offset) {
+      if (0 != utility::parseInt64(offsetStr, offset) || offset < 0)
+        return -1;
+      bool isSameHistory = (replid == replicationStatus.replid) ||
+                           (replid == replicationStatus.replid2 && offset <= replicationStatus.secondReplOffset);
+      if (!isSameHistory || !replicationStatus.backlog.contains(static_cast<uint64_t>(offset)))
+        return -1;
+      return 0;
+    }
+
+    std::string _commandTYPE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"few arguments provided for TYPE command."}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({redis_data_store_obj.get_key_type(commandVec[1])}, resp::RespType::SimpleString);
+    }
+
+    std::string _serializeStreamEntries(const std::vector<StreamEntry>& entries) {
+      // every entry is serialized as [id, [field1, value1, ...]]
+      std::vector<std::string> serializedEntries;
+      serializedEntries.reserve(entries.size());
+      for (auto& entry : entries) {
+        std::string serializedId = resp::RespParser::serialize({entry.id.to_string()}, resp::RespType::BulkString);
+        std::string serializedFields = entry.is_deleted ? resp::RespConstants::NULL_ARRAY : resp::RespParser::serialize(entry.fields_values, resp::RespType::Array);
+        serializedEntries.push_back(resp::RespParser::serializeNestedArray({serializedId, serializedFields}));
+      }
+      return resp::RespParser::serializeNestedArray(serializedEntries);
+    }
+
+    int _parseStreamTrimSpec(const std::vector<std::string>& commandVec, size_t& index, StreamTrimSpec& trimSpec, std::string& errMsg) {
+      // parses MAXLEN|MINID [=|~] threshold [LIMIT count] starting at commandVec[index], index is moved past it
+      if (utility::compareCaseInsensitive("MAXLEN", commandVec[index])) {
+        trimSpec.strategy = StreamTrimSpec::Strategy::MaxLen;
+      }
+      else if (utility::compareCaseInsensitive("MINID", commandVec[index])) {
+        trimSpec.strategy = StreamTrimSpec::Strategy::MinId;
+      }
+      else {
+        errMsg = "ERR syntax error";
+        return -1;
+      }
+      index++;
+      if (index < commandVec.size() && (commandVec[index] == "=" || commandVec[index] == "~")) {
+        trimSpec.is_approx = (commandVec[index] == "~");
+        index++;
+      }
+      if (index >= commandVec.size()) {
+        errMsg = "ERR syntax error";
+        return -1;
+      }
+      int status = (trimSpec.strategy == StreamTrimSpec::Strategy::MaxLen)
+                    ? StreamID::parse_number(commandVec[index], trimSpec.maxlen)
+                    : StreamID::parse(commandVec[index], trimSpec.minid);
+      if (0 != status) {
+        errMsg = "ERR value is not an integer or out of range";
+        return -1;
+      }
+      index++;
+      if (index + 1 < commandVec.size() && utility::compareCaseInsensitive("LIMIT", commandVec[index])) {
+        // LIMIT only bounds the work of approximate trimming, which already stops at node boundaries
+        index += 2;
+      }
+      return 0;
+    }
+
+    std::string _commandXADD(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 5) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xadd' command"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      StreamTrimSpec trimSpec;
+      bool isNoMkStream = false;
+      size_t index = 2;
+      while (index < commandVec.size()) {
+        if (utility::compareCaseInsensitive("NOMKSTREAM", commandVec[index])) {
+          isNoMkStream = true;
+          index++;
+        }
+        else if (utility::compareCaseInsensitive("MAXLEN", commandVec[index]) || utility::compareCaseInsensitive("MINID", commandVec[index])) {
+          if (0 != _parseStreamTrimSpec(commandVec, index, trimSpec, errMsg)) {
+            return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+          }
+        }
+        else {
+          break;
+        }
+      }
+      // commandVec[index] is the id, followed by field value pairs
+      if (index + 3 > commandVec.size() || (commandVec.size() - index - 1) % 2 != 0) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xadd' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> fieldsValues(commandVec.begin() + index + 1, commandVec.end());
+      std::optional<std::string> resultId;
+      if (0 != redis_data_store_obj.xadd(commandVec[1], commandVec[index], fieldsValues, trimSpec, isNoMkStream, resultId, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      if (!resultId.has_value()) {
+        return resp::RespConstants::NULL_BULK_STRING;
+      }
+      // logged with the generated id, an auto generated one would differ when replayed
+      std::vector<std::string> generatedIdCommandVec = commandVec;
+      generatedIdCommandVec[index] = *resultId;
+      _propagateWriteCommand(generatedIdCommandVec);
+      return resp::RespParser::serialize({*resultId}, resp::RespType::BulkString);
+    }
+
+    std::string _commandXRANGE(const std::vector<std::string>& commandVec, bool isReverse) {
+      if (commandVec.size() != 4 && commandVec.size() != 6) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + commandVec[0] + "' command"}, resp::RespType::SimpleError);
+      }
+      // XREVRANGE takes end before start
+      std::string startStr = isReverse ? commandVec[3] : commandVec[2];
+      std::string endStr = isReverse ? commandVec[2] : commandVec[3];
+      bool isStartExclusive = !startStr.empty() && startStr[0] == '(';
+      bool isEndExclusive = !endStr.empty() && endStr[0] == '(';
+      StreamID start, end;
+      if (0 != StreamID::parse(isStartExclusive ? startStr.substr(1) : startStr, start, 0) ||
+          0 != StreamID::parse(isEndExclusive ? endStr.substr(1) : endStr, end, UINT64_MAX)) {
+        return resp::RespParser::serialize({"ERR Invalid stream ID specified as stream command argument"}, resp::RespType::SimpleError);
+      }
+      if ((isStartExclusive && !start.increment()) || (isEndExclusive && !end.decrement())) {
+        return resp::RespParser::serialize({"ERR invalid start or end ID, the interval is empty"}, resp::RespType::SimpleError);
+      }
+      uint64_t count = 0;
+      if (commandVec.size() == 6) {
+        if (!utility::compareCaseInsensitive("COUNT", commandVec[4])) {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+        if (0 != StreamID::parse_number(commandVec[5], count)) {
+          return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+        }
+        if (count == 0) {
+          return resp::RespParser::serializeNestedArray({});
+        }
+      }
+      std::string errMsg;
+      std::vector<StreamEntry> entries;
+      if (0 != redis_data_store_obj.xrange(commandVec[1], start, end, count, isReverse, entries, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return _serializeStreamEntries(entries);
+    }
+
+    std::string _commandXLEN(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xlen' command"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      uint64_t length = 0;
+      if (0 != redis_data_store_obj.xlen(commandVec[1], length, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(length)}, resp::RespType::Integer);
+    }
+
+    std::string _commandXTRIM(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 4) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xtrim' command"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      StreamTrimSpec trimSpec;
+      size_t index = 2;
+      if (0 != _parseStreamTrimSpec(commandVec, index, trimSpec, errMsg) || index != commandVec.size()) {
+        return resp::RespParser::serialize({errMsg.empty() ? "ERR syntax error" : errMsg}, resp::RespType::SimpleError);
+      }
+      uint64_t removed = 0;
+      if (0 != redis_data_store_obj.xtrim(commandVec[1], trimSpec, removed, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(removed)}, resp::RespType::Integer);
+    }
+
+    std::string _commandXGROUP(const std::vector<std::string>& commandVec) {
+      std::string errMsg;
+      if (commandVec.size() >= 5 && utility::compareCaseInsensitive("CREATE", commandVec[1])) {
+        bool isMkStream = (commandVec.size() == 6 && utility::compareCaseInsensitive("MKSTREAM", commandVec[5]));
+        if (commandVec.size() > 6 || (commandVec.size() == 6 && !isMkStream)) {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+        if (0 != redis_data_store_obj.xgroup_create(commandVec[2], commandVec[3], commandVec[4], isMkStream, errMsg)) {
+          return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+        }
+        _propagateWriteCommand(commandVec);
+        return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+      }
+      else if (commandVec.size() == 4 && utility::compareCaseInsensitive("DESTROY", commandVec[1])) {
+        int destroyed = 0;
+        if (0 != redis_data_store_obj.xgroup_destroy(commandVec[2], commandVec[3], destroyed, errMsg)) {
+          return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+        }
+        _propagateWriteCommand(commandVec);
+        return resp::RespParser::serialize({std::to_string(destroyed)}, resp::RespType::Integer);
+      }
+      return resp::RespParser::serialize({"ERR unknown subcommand or wrong number of arguments for 'XGROUP' command"}, resp::RespType::SimpleError);
+    }
+
+    std::string _commandXREADGROUP(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 7 || !utility::compareCaseInsensitive("GROUP", commandVec[1])) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xreadgroup' command"}, resp::RespType::SimpleError);
+      }
+      const std::string& groupName = commandVec[2];
+      const std::string& consumerName = commandVec[3];
+      uint64_t count = 0;
+      bool isNoAck = false;
+      size_t index = 4;
+      while (index < commandVec.size() && !utility::compareCaseInsensitive("STREAMS", commandVec[index])) {
+        if (utility::compareCaseInsensitive("COUNT", commandVec[index]) && index + 1 < commandVec.size()) {
+          if (0 != StreamID::parse_number(commandVec[index + 1], count)) {
+            return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+          }
+          index += 2;
+        }
+        else if (utility::compareCaseInsensitive("NOACK", commandVec[index])) {
+          isNoAck = true;
+          index++;
+        }
+        else if (utility::compareCaseInsensitive("BLOCK", commandVec[index])) {
+          return resp::RespParser::serialize({"ERR BLOCK option is not supported"}, resp::RespType::SimpleError);
+        }
+        else {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+      }
+      index++;  // skip STREAMS
+      size_t numArgs = (index <= commandVec.size()) ? commandVec.size() - index : 0;
+      if (numArgs == 0 || numArgs % 2 != 0) {
+        return resp::RespParser::serialize({"ERR Unbalanced 'xreadgroup' list of streams: for each stream key an ID or '>' must be specified."}, resp::RespType::SimpleError);
+      }
+      size_t numKeys = numArgs / 2;
+      std::vector<std::string> serializedStreams;
+      for (size_t i = 0; i < numKeys; i++) {
+        const std::string& key = commandVec[index + i];
+        const std::string& idStr = commandVec[index + numKeys + i];
+        std::string errMsg;
+        std::vector<StreamEntry> entries;
+        if (0 != redis_data_store_obj.xreadgroup(key, groupName, consumerName, idStr, count, isNoAck, entries, errMsg)) {
+          return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+        }
+        if (entries.empty() && idStr == ">") {
+          continue;
+        }
+        std::string serializedKey = resp::RespParser::serialize({key}, resp::RespType::BulkString);
+        serializedStreams.push_back(resp::RespParser::serializeNestedArray({serializedKey, _serializeStreamEntries(entries)}));
+      }
+      if (serializedStreams.empty()) {
+        return resp::RespConstants::NULL_ARRAY;
+      }
+      // delivering entries changes the pending entries lists, replaying the command delivers the same entries
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serializeNestedArray(serializedStreams);
+    }
+
+    std::string _commandXACK(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 4) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'xack' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<StreamID> ids;
+      for (size_t i = 3; i < commandVec.size(); i++) {
+        StreamID id;
+        if (0 != StreamID::parse(commandVec[i], id)) {
+          return resp::RespParser::serialize({"ERR Invalid stream ID specified as stream command argument"}, resp::RespType::SimpleError);
+        }
+        ids.push_back(id);
+      }
+      std::string errMsg;
+      uint64_t acked = 0;
+      if (0 != redis_data_store_obj.xack(commandVec[1], commandVec[2], ids, acked, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(acked)}, resp::RespType::Integer);
+    }
+
+    int _parseBitOffset(const std::string& str, uint64_t& bitOffset) {
+      // bitmaps are limited to 512MB like redis : offset < 2^32
+      int64_t number = 0;
+      if (0 != utility::parseInt64(str, number) || number < 0 || number >= (1LL << 32)) {
+        return -1;
+      }
+      bitOffset = static_cast<uint64_t>(number);
+      return 0;
+    }
+
+    std::string _commandSETBIT(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 4) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'setbit' command"}, resp::RespType::SimpleError);
+      }
+      uint64_t bitOffset = 0;
+      if (0 != _parseBitOffset(commandVec[2], bitOffset)) {
+        return resp::RespParser::serialize({"ERR bit offset is not an integer or out of range"}, resp::RespType::SimpleError);
+      }
+      if (commandVec[3] != "0" && commandVec[3] != "1") {
+        return resp::RespParser::serialize({"ERR bit is not an integer or out of range"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      int oldBit = 0;
+      if (0 != redis_data_store_obj.setbit(commandVec[1], bitOffset, commandVec[3] == "1", oldBit, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(oldBit)}, resp::RespType::Integer);
+    }
+
+    std::string _commandGETBIT(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'getbit' command"}, resp::RespType::SimpleError);
+      }
+      uint64_t bitOffset = 0;
+      if (0 != _parseBitOffset(commandVec[2], bitOffset)) {
+        return resp::RespParser::serialize({"ERR bit offset is not an integer or out of range"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      int bit = 0;
+      if (0 != redis_data_store_obj.getbit(commandVec[1], bitOffset, bit, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(bit)}, resp::RespType::Integer);
+    }
+
+    int _parseBitUnit(const std::string& str, bool& isBitUnit) {
+      if (utility::compareCaseInsensitive("BIT", str)) {
+        isBitUnit = true;
+        return 0;
+      }
+      if (utility::compareCaseInsensitive("BYTE", str)) {
+        isBitUnit = false;
+        return 0;
+      }
+      return -1;
+    }
+
+    std::string _commandBITCOUNT(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 2 && commandVec.size() != 4 && commandVec.size() != 5) {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+      }
+      std::optional<std::pair<int64_t, int64_t>> range;
+      bool isBitUnit = false;
+      if (commandVec.size() >= 4) {
+        int64_t start = 0, end = 0;
+        if (0 != utility::parseInt64(commandVec[2], start) || 0 != utility::parseInt64(commandVec[3], end)) {
+          return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+        }
+        if (commandVec.size() == 5 && 0 != _parseBitUnit(commandVec[4], isBitUnit)) {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+        range = std::make_pair(start, end);
+      }
+      std::string errMsg;
+      uint64_t count = 0;
+      if (0 != redis_data_store_obj.bitcount(commandVec[1], range, isBitUnit, count, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(count)}, resp::RespType::Integer);
+    }
+
+    std::string _commandBITPOS(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 3 || commandVec.size() > 6) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'bitpos' command"}, resp::RespType::SimpleError);
+      }
+      if (commandVec[2] != "0" && commandVec[2] != "1") {
+        return resp::RespParser::serialize({"ERR The bit argument must be 1 or 0."}, resp::RespType::SimpleError);
+      }
+      std::optional<int64_t> start, end;
+      bool isBitUnit = false;
+      int64_t number = 0;
+      for (size_t i = 3; i < commandVec.size() && i < 5; i++) {
+        if (0 != utility::parseInt64(commandVec[i], number)) {
+          return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+        }
+        (i == 3 ? start : end) = number;
+      }
+      if (commandVec.size() == 6 && 0 != _parseBitUnit(commandVec[5], isBitUnit)) {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      int64_t pos = -1;
+      if (0 != redis_data_store_obj.bitpos(commandVec[1], commandVec[2] == "1", start, end, isBitUnit, pos, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(pos)}, resp::RespType::Integer);
+    }
+
+    std::string _commandBITOP(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 4) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'bitop' command"}, resp::RespType::SimpleError);
+      }
+      bitops::BitOp op;
+      if (utility::compareCaseInsensitive("AND", commandVec[1])) op = bitops::BitOp::AND;
+      else if (utility::compareCaseInsensitive("OR", commandVec[1])) op = bitops::BitOp::OR;
+      else if (utility::compareCaseInsensitive("XOR", commandVec[1])) op = bitops::BitOp::XOR;
+      else if (utility::compareCaseInsensitive("NOT", commandVec[1])) op = bitops::BitOp::NOT;
+      else {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+      }
+      if (op == bitops::BitOp::NOT && commandVec.size() != 4) {
+        return resp::RespParser::serialize({"ERR BITOP NOT must be called with a single source key."}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> srcKeys(commandVec.begin() + 3, commandVec.end());
+      std::string errMsg;
+      uint64_t resultLength = 0;
+      if (0 != redis_data_store_obj.bitop(op, commandVec[2], srcKeys, resultLength, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(resultLength)}, resp::RespType::Integer);
+    }
+
+    int _parseBitfieldTypeAndOffset(const std::string& typeStr, const std::string& offsetStr, bitops::BitfieldOp& op, std::string& errMsg) {
+      // type : i<bits> or u<bits>, offset : <bit offset> or #<index> (multiplied by bits)
+      int64_t bits = 0;
+      if (typeStr.length() < 2 || (typeStr[0] != 'i' && typeStr[0] != 'u' && typeStr[0] != 'I' && typeStr[0] != 'U') ||
+          0 != utility::parseInt64(typeStr.substr(1), bits)) {
+        errMsg = "ERR Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.";
+        return -1;
+      }
+      op.isSigned = (typeStr[0] == 'i' || typeStr[0] == 'I');
+      if (bits < 1 || (op.isSigned && bits > 64) || (!op.isSigned && bits > 63)) {
+        errMsg = "ERR Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.";
+        return -1;
+      }
+      op.bits = static_cast<uint8_t>(bits);
+      bool isMultiplied = !offsetStr.empty() && offsetStr[0] == '#';
+      uint64_t offset = 0;
+      if (0 != _parseBitOffset(isMultiplied ? offsetStr.substr(1) : offsetStr, offset)) {
+        errMsg = "ERR bit offset is not an integer or out of range";
+        return -1;
+      }
+      op.offset = isMultiplied ? offset * op.bits : offset;
+      if (op.offset + op.bits > (1ULL << 32)) {
+        errMsg = "ERR bit offset is not an integer or out of range";
+        return -1;
+      }
+      return 0;
+    }
+
+    std::string _commandBITFIELD(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'bitfield' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<bitops::BitfieldOp> ops;
+      bitops::Overflow overflow = bitops::Overflow::WRAP;
+      std::string errMsg;
+      size_t index = 2;
+      while (index < commandVec.size()) {
+        const std::string& subcommand = commandVec[index];
+        bitops::BitfieldOp op{};
+        op.overflow = overflow;
+        if (utility::compareCaseInsensitive("OVERFLOW", subcommand) && index + 1 < commandVec.size()) {
+          if (utility::compareCaseInsensitive("WRAP", commandVec[index + 1])) overflow = bitops::Overflow::WRAP;
+          else if (utility::compareCaseInsensitive("SAT", commandVec[index + 1])) overflow = bitops::Overflow::SAT;
+          else if (utility::compareCaseInsensitive("FAIL", commandVec[index + 1])) overflow = bitops::Overflow::FAIL;
+          else {
+            return resp::RespParser::serialize({"ERR Invalid OVERFLOW type specified"}, resp::RespType::SimpleError);
+          }
+          index += 2;
+          continue;
+        }
+        else if (utility::compareCaseInsensitive("GET", subcommand) && index + 2 < commandVec.size()) {
+          op.type = bitops::BitfieldOp::Type::GET;
+          index += 3;
+        }
+        else if ((utility::compareCaseInsensitive("SET", subcommand) || utility::compareCaseInsensitive("INCRBY", subcommand)) && index + 3 < commandVec.size()) {
+          op.type = utility::compareCaseInsensitive("SET", subcommand) ? bitops::BitfieldOp::Type::SET : bitops::BitfieldOp::Type::INCRBY;
+          if (0 != utility::parseInt64(commandVec[index + 3], op.value)) {
+            return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+          }
+          index += 4;
+        }
+        else {
+          return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+        }
+        // type and offset are always the 2 arguments after the subcommand
+        size_t typeIndex = (op.type == bitops::BitfieldOp::Type::GET) ? index - 2 : index - 3;
+        if (0 != _parseBitfieldTypeAndOffset(commandVec[typeIndex], commandVec[typeIndex + 1], op, errMsg)) {
+          return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+        }
+        ops.push_back(op);
+      }
+
+      std::vector<std::optional<int64_t>> results;
+      if (0 != redis_data_store_obj.bitfield(commandVec[1], ops, results, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      if (std::any_of(ops.begin(), ops.end(), [](const bitops::BitfieldOp& op) { return op.type != bitops::BitfieldOp::Type::GET; }))
+        _propagateWriteCommand(commandVec);
+      std::vector<std::string> serializedResults;
+      for (auto& result : results) {
+        serializedResults.push_back(result.has_value() ? resp::RespParser::serialize({std::to_string(*result)}, resp::RespType::Integer)
+                                                       : resp::RespConstants::NULL_BULK_STRING);
+      }
+      return resp::RespParser::serializeNestedArray(serializedResults);
+    }
+
+    std::string _commandPFADD(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'pfadd' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> elements(commandVec.begin() + 2, commandVec.end());
+      std::string errMsg;
+      int updated = 0;
+      if (0 != redis_data_store_obj.pfadd(commandVec[1], elements, updated, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({std::to_string(updated)}, resp::RespType::Integer);
+    }
+
+    std::string _commandPFCOUNT(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'pfcount' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> keys(commandVec.begin() + 1, commandVec.end());
+      std::string errMsg;
+      uint64_t count = 0;
+      if (0 != redis_data_store_obj.pfcount(keys, count, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(count)}, resp::RespType::Integer);
+    }
+
+    std::string _commandPFMERGE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'pfmerge' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> srcKeys(commandVec.begin() + 2, commandVec.end());
+      std::string errMsg;
+      if (0 != redis_data_store_obj.pfmerge(commandVec[1], srcKeys, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+    }
+
+    std::string _commandPUSH(const std::vector<std::string>& commandVec, bool isLeft) {
+      if (commandVec.size() < 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + std::string(isLeft ? "lpush" : "rpush") + "' command"}, resp::RespType::SimpleError);
+      }
+      std::vector<std::string> values(commandVec.begin() + 2, commandVec.end());
+      std::string errMsg;
+      uint64_t length = 0;
+      if (0 != redis_data_store_obj.list_push(commandVec[1], values, isLeft, length, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      _propagateWriteCommand(commandVec);
+      _signalKeyAsReady(commandVec[1]);
+      return resp::RespParser::serialize({std::to_string(length)}, resp::RespType::Integer);
+    }
+
+    std::string _commandPOP(const std::vector<std::string>& commandVec, bool isLeft) {
+      if (commandVec.size() != 2 && commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + std::string(isLeft ? "lpop" : "rpop") + "' command"}, resp::RespType::SimpleError);
+      }
+      int64_t count = 1;
+      if (commandVec.size() == 3 && (0 != utility::parseInt64(commandVec[2], count) || count < 0)) {
+        return resp::RespParser::serialize({"ERR value is out of range, must be positive"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      std::vector<std::string> values;
+      if (0 != redis_data_store_obj.list_pop(commandVec[1], isLeft, static_cast<uint64_t>(count), values, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      if (!values.empty())
+        _propagateWriteCommand(commandVec);
+      if (commandVec.size() == 2) {
+        return values.empty() ? resp::RespConstants::NULL_BULK_STRING : resp::RespParser::serialize({values[0]}, resp::RespType::BulkString);
+      }
+      if (values.empty() && count > 0) {
+        return resp::RespConstants::NULL_ARRAY;  // key does not exist
+      }
+      return resp::RespParser::serialize(values, resp::RespType::Array);
+    }
+
+    std::string _commandLLEN(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'llen' command"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      uint64_t length = 0;
+      if (0 != redis_data_store_obj.llen(commandVec[1], length, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({std::to_string(length)}, resp::RespType::Integer);
+    }
+
+    std::string _commandLRANGE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 4) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'lrange' command"}, resp::RespType::SimpleError);
+      }
+      int64_t start = 0, end = 0;
+      if (0 != utility::parseInt64(commandVec[2], start) || 0 != utility::parseInt64(commandVec[3], end)) {
+        return resp::RespParser::serialize({"ERR value is not an integer or out of range"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      std::vector<std::string> values;
+      if (0 != redis_data_store_obj.lrange(commandVec[1], start, end, values, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize(values, resp::RespType::Array);
+    }
+
+    int _parseListSide(const std::string& str, bool& isLeft) {
+      if (utility::compareCaseInsensitive("LEFT", str)) {
+        isLeft = true;
+        return 0;
+      }
+      if (utility::compareCaseInsensitive("RIGHT", str)) {
+        isLeft = false;
+        return 0;
+      }
+      return -1;
+    }
+
+    int _parseBlockingTimeout(const std::string& str, uint64_t& deadlineMs, std::string& errMsg) {
+      // timeout is in seconds (may be fractional), 0 blocks forever
+      char* end = nullptr;
+      errno = 0;
+      double seconds = std::strtod(str.c_str(), &end);
+      if (str.empty() || *end != '\0' || errno == ERANGE || std::isnan(seconds) || seconds > 1e12) {
+        errMsg = "ERR timeout is not a float or out of range";
+        return -1;
+      }
+      if (seconds < 0) {
+        errMsg = "ERR timeout is negative";
+        return -1;
+      }
+      deadlineMs = 0;
+      if (seconds > 0)
+        deadlineMs = _getCurrentTimeMs() + std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(seconds * 1000)));
+      return 0;
+    }
+
+    std::string _commandLMOVE(int& socketFD, const std::vector<std::string>& commandVec, bool isBlocking) {
+      if (commandVec.size() != (isBlocking ? 6 : 5)) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + std::string(isBlocking ? "blmove" : "lmove") + "' command"}, resp::RespType::SimpleError);
+      }
+      BlockedClient client;
+      client.keys.push_back(commandVec[1]);
+      client.destKey = commandVec[2];
+      if (0 != _parseListSide(commandVec[3], client.isPopLeft) || 0 != _parseListSide(commandVec[4], client.isPushLeft)) {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+      }
+      std::string errMsg;
+      if (isBlocking && 0 != _parseBlockingTimeout(commandVec[5], client.deadlineMs, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      std::string reply;
+      if (0 == _tryServeBlockedClient(client, commandVec[1], reply))
+        return reply;
+      if (!isBlocking)
+        return resp::RespConstants::NULL_BULK_STRING;
+      _blockClient(socketFD, std::move(client));
+      return "";
+    }
+
+    std::string _commandBPOP(int& socketFD, const std::vector<std::string>& commandVec, bool isLeft) {
+      if (commandVec.size() < 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + std::string(isLeft ? "blpop" : "brpop") + "' command"}, resp::RespType::SimpleError);
+      }
+      BlockedClient client;
+      client.isPopLeft = isLeft;
+      std::string errMsg;
+      if (0 != _parseBlockingTimeout(commandVec.back(), client.deadlineMs, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      // keys are tried in the order given, the first non empty list is served right away
+      for (size_t i = 1; i + 1 < commandVec.size(); i++) {
+        std::string reply;
+        if (0 == _tryServeBlockedClient(client, commandVec[i], reply))
+          return reply;
+        if (std::find(client.keys.begin(), client.keys.end(), commandVec[i]) == client.keys.end())
+          client.keys.push_back(commandVec[i]);
+      }
+      _blockClient(socketFD, std::move(client));
+      return "";
+    }
+
+    // returns 0 if client got its reply (element or error) from key, -1 if key has no element to give
+    int _tryServeBlockedClient(const BlockedClient& client, const std::string& key, std::string& reply) {
+      std::string errMsg;
+      if (client.destKey.has_value()) {
+        std::optional<std::string> value;
+        if (0 != redis_data_store_obj.lmove(key, *client.destKey, client.isPopLeft, client.isPushLeft, value, errMsg)) {
+          reply = resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+          return 0;
+        }
+        if (!value.has_value())
+          return -1;
+        _propagateWriteCommand({"LMOVE", key, *client.destKey, client.isPopLeft ? "LEFT" : "RIGHT", client.isPushLeft ? "LEFT" : "RIGHT"});
+        _signalKeyAsReady(*client.destKey);
+        reply = resp::RespParser::serialize({*value}, resp::RespType::BulkString);
+        return 0;
+      }
+      std::vector<std::string> values;
+      if (0 != redis_data_store_obj.list_pop(key, client.isPopLeft, 1, values, errMsg)) {
+        reply = resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+        return 0;
+      }
+      if (values.empty())
+        return -1;
+      _propagateWriteCommand({client.isPopLeft ? "LPOP" : "RPOP", key});
+      reply = resp::RespParser::serialize({key, values[0]}, resp::RespType::Array);
+      return 0;
+    }
+
+    int _blockClient(int socketFD, BlockedClient&& client) {
+      client.dbIndex = redis_data_store_obj.get_selected_db();
+      for (auto& key : client.keys) {
+        std::list<int>& queue = blockingKeys[{client.dbIndex, key}];
+        client.queuePositions.push_back(queue.insert(queue.end(), socketFD));
+      }
+      if (client.deadlineMs != 0)
+        blockedClientTimers.insert({client.deadlineMs, socketFD});
+      blockedClients[socketFD] = std::move(client);
+      return 0;
+    }
+
+    // removes socketFD from every wait queue, reply (if any) is sent by _resumeUnblockedClients
+    int _unblockClient(int socketFD, const std::optional<std::string>& reply) {
+      auto it = blockedClients.find(socketFD);
+      if (it == blockedClients.end())
+        return -1;
+      BlockedClient& client = it->second;
+      for (size_t i = 0; i < client.keys.size(); i++) {
+        auto queueIt = blockingKeys.find({client.dbIndex, client.keys[i]});
+        queueIt->second.erase(client.queuePositions[i]);
+        if (queueIt->second.empty())
+          blockingKeys.erase(queueIt);
+      }
+      if (client.deadlineMs != 0)
+        blockedClientTimers.erase({client.deadlineMs, socketFD});
+      if (reply.has_value())
+        unblockedClients.push_back({socketFD, *reply, std::move(client.pendingCommands)});
+      blockedClients.erase(it);
+      return 0;
+    }
+
+    // key of the selected database
+    void _signalKeyAsReady(const std::string& key) {
+      _signalKeyAsReady(redis_data_store_obj.get_selected_db(), key);
+    }
+
+    void _signalKeyAsReady(size_t dbIndex, const std::string& key) {
+      std::pair<size_t, std::string> dbKey{dbIndex, key};
+      if (blockingKeys.count(dbKey) != 0 && std::find(readyKeys.begin(), readyKeys.end(), dbKey) == readyKeys.end())
+        readyKeys.push_back(std::move(dbKey));
+    }
+
+    // hands elements pushed to ready keys to waiting clients, longest waiting first
+    void _serveClientsBlockedOnReadyKeys() {
+      size_t selectedDbIndex = redis_data_store_obj.get_selected_db();
+      while (!readyKeys.empty()) {
+        auto dbKey = readyKeys.front();
+        readyKeys.pop_front();
+        redis_data_store_obj.select_db(dbKey.first);  // served in the database the client blocked in
+        auto queueIt = blockingKeys.find(dbKey);
+        while (queueIt != blockingKeys.end()) {
+          int socketFD = queueIt->second.front();
+          std::string reply;
+          if (0 != _tryServeBlockedClient(blockedClients[socketFD], dbKey.second, reply))
+            break;  // list is empty again
+          _unblockClient(socketFD, reply);
+          queueIt = blockingKeys.find(dbKey);
+        }
+      }
+      redis_data_store_obj.select_db(selectedDbIndex);
+    }
+
+    // sends replies to unblocked clients, starts polling them again and runs their pipelined commands
+    void _resumeUnblockedClients(pm::PollManager& pollManager) {
+      while (!unblockedClients.empty()) {
+        UnblockedClient client = std::move(unblockedClients.front());
+        unblockedClients.pop_front();
+        if (_sendToClient(client.socketFD, client.reply) <= 0) {
+          DEBUG_LOG("Failed to write message to unblocked socket(" + std::to_string(client.socketFD) + ")");
+        }
+        if (!client.pendingCommands.empty()) {
+          for (auto& responseStr : processCommands(client.socketFD, client.pendingCommands)) {
+            _sendToClient(client.socketFD, responseStr);
+          }
+        }
+        _updateSocketEvents(client.socketFD, pollManager);
+      }
+    }
+
+    // replies go through the output queue while it is not empty, to stay ordered after queued messages; with
+    // appendfsync always they are also queued while logged commands are not on disk yet (sent by flushPendingWrites())
+    // a reply is never waited on : what the socket does not take right away is queued and written on POLLOUT
+    int _sendToClient(int socketFD, const std::string& responseStr) {
+      auto it = clientOutputQueues.find(socketFD);
+      // replies to a replica (eg : +CONTINUE and the backlog) are queued like the stream following them
+      if (it == clientOutputQueues.end() && (appendOnlyFile.is_reply_deferred() || replicaClients.count(socketFD) != 0)) {
+        _enqueueOutput(socketFD, std::make_shared<const std::string>(responseStr));
+        return static_cast<int>(responseStr.length());
+      }
+      if (it == clientOutputQueues.end()) {
+        OutputQueue outputQueue;
+        outputQueue.append(responseStr);
+        if (0 != outputQueue.flush(socketFD))
+          return -1;
+        if (!outputQueue.empty()) {
+          clientOutputQueues.emplace(socketFD, std::move(outputQueue));
+          clientsWithPendingWrites.insert(socketFD);
+        }
+        return static_cast<int>(responseStr.length());
+      }
+      it->second.append(responseStr);
+      clientsWithPendingWrites.insert(socketFD);
+      return static_cast<int>(responseStr.length());
+    }
+
+    void _enqueueOutput(int socketFD, const std::shared_ptr<const std::string>& buffer) {
+      clientOutputQueues[socketFD].append(buffer);
+      clientsWithPendingWrites.insert(socketFD);
+    }
+
+    void _updateSocketEvents(int socketFD, pm::PollManager& pollManager) {
+      // a parked client is only watched for hang up (POLLRDHUP), queued output adds POLLOUT
+      short events = (blockedClients.count(socketFD) != 0) ? POLLRDHUP : POLLIN;
+      if (clientOutputQueues.count(socketFD) != 0 && !_isClientOutputHeld(socketFD))
+        events |= POLLOUT;
+      pollManager.setSocketFDEvents(socketFD, events);
+    }
+
+    // with appendfsync always, replies wait for the commands they answer to be on disk : after a failed write or
+    // fsync they stay queued until a retry (every event loop iteration) succeeds. The stream to replicas is not held
+    bool _isClientOutputHeld(int socketFD) const {
+      return appendOnlyFile.is_reply_deferred() && replicaClients.count(socketFD) == 0;
+    }
+
+    std::string _commandSUBSCRIBE(int& socketFD, const std::vector<std::string>& commandVec, bool isPattern) {
+      std::string kind = isPattern ? "psubscribe" : "subscribe";
+      if (commandVec.size() < 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for '" + kind + "' command"}, resp::RespType::SimpleError);
+      }
+      std::string reply;
+      for (size_t i = 1; i < commandVec.size(); i++) {
+        if (isPattern)
+          pubSub.psubscribe(socketFD, commandVec[i]);
+        else
+          pubSub.subscribe(socketFD, commandVec[i]);
+        reply += _serializeSubscriptionReply(kind, commandVec[i], pubSub.subscription_count(socketFD));
+      }
+      return reply;
+    }
+
+    std::string _commandUNSUBSCRIBE(int& socketFD, const std::vector<std::string>& commandVec, bool isPattern) {
+      std::string kind = isPattern ? "punsubscribe" : "unsubscribe";
+      // without arguments the client leaves all its channels (or patterns)
+      std::vector<std::string> names(commandVec.begin() + 1, commandVec.end());
+      if (names.empty())
+        names = isPattern ? pubSub.get_patterns(socketFD) : pubSub.get_channels(socketFD);
+      if (names.empty())
+        return _serializeSubscriptionReply(kind, std::nullopt, pubSub.subscription_count(socketFD));
+      std::string reply;
+      for (auto& name : names) {
+        if (isPattern)
+          pubSub.punsubscribe(socketFD, name);
+        else
+          pubSub.unsubscribe(socketFD, name);
+        reply += _serializeSubscriptionReply(kind, name, pubSub.subscription_count(socketFD));
+      }
+      return reply;
+    }
+
+    std::string _commandPUBLISH(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'publish' command"}, resp::RespType::SimpleError);
+      }
+      size_t receivers = pubSub.publish(commandVec[1], commandVec[2], [this](int socketFD, const std::shared_ptr<const std::string>& buffer) {
+        _enqueueOutput(socketFD, buffer);
+      });
+      return resp::RespParser::serialize({std::to_string(receivers)}, resp::RespType::Integer);
+    }
+
+    std::string _commandSAVE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 1) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'save' command"}, resp::RespType::SimpleError);
+      }
+      if (_isBackgroundSaveInProgress()) {
+        return resp::RespParser::serialize({"ERR Background save already in progress"}, resp::RespType::SimpleError);
+      }
+      int status = 0;
+      do {
+        // blocks the server (and the expiry thread) until the snapshot is on disk
+        auto keyspaceLock = redis_data_store_obj.lock_keyspace();
+        RdbFileWriter rdbFileWriter;
+        status = rdbFileWriter.writeFile(getRdbFilePath(), redis_data_store_obj);
+      } while(false);
+      if (status != 0) {
+        return resp::RespParser::serialize({"ERR failed to save the rdb file, see server logs"}, resp::RespType::SimpleError);
+      }
+      snapshotStatus.lastSaveTime = std::time(nullptr);
+      snapshotStatus.saveCount++;
+      return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+    }
+
+    std::string _commandBGSAVE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 1) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'bgsave' command"}, resp::RespType::SimpleError);
+      }
+      if (_isBackgroundSaveInProgress()) {
+        return resp::RespParser::serialize({"ERR Background save already in progress"}, resp::RespType::SimpleError);
+      }
+      if (aofRewriteStatus.childPid != -1) {
+        return resp::RespParser::serialize({"ERR Another child process is active (AOF?): can't BGSAVE right now"}, resp::RespType::SimpleError);
+      }
+      if (getConfigKv("snapshot-mode").value_or("fork") == "forkless") {
+        if (0 != redis_data_store_obj.start_incremental_snapshot(getRdbFilePath())) {
+          return resp::RespParser::serialize({"ERR Background save failed to start"}, resp::RespType::SimpleError);
+        }
+        snapshotStatus.isForkless = true;
+        snapshotStatus.keysTotal = redis_data_store_obj.get_incremental_snapshot_keys_total();
+        snapshotStatus.startTimeMs = _getCurrentTimeMs();
+        snapshotStatus.keysProcessed = 0;
+        DEBUG_LOG("forkless background saving started");
+        return resp::RespParser::serialize({"Background saving started"}, resp::RespType::SimpleString);
+      }
+      int pipeFDs[2];
+      if (0 != pipe2(pipeFDs, O_NONBLOCK | O_CLOEXEC)) {
+        return resp::RespParser::serialize({"ERR Background save failed to start"}, resp::RespType::SimpleError);
+      }
+      std::string rdbFilePath = getRdbFilePath();
+      pid_t pid = -1;
+      do {
+        // no thread is inside the store while forking, so the child gets a consistent copy-on-write keyspace
+        auto keyspaceLock = redis_data_store_obj.lock_keyspace();
+        snapshotStatus.keysTotal = redis_data_store_obj.count_keys_unlocked();
+        pid = fork();
+        if (pid == 0) {
+          // child : only this thread exists here, the keyspace is read without locking and the process leaves
+          // through _exit() so no destructor (eg : of the expiry thread) runs
+          close(pipeFDs[0]);
+          int progressPipeFD = pipeFDs[1];
+          RdbFileWriter rdbFileWriter([progressPipeFD](uint64_t keysWritten) {
+            // progress is best effort, dropped if the parent does not drain the pipe
+            if (write(progressPipeFD, &keysWritten, sizeof(keysWritten)) < 0) {}
+          });
+          int status = rdbFileWriter.writeFile(rdbFilePath, redis_data_store_obj);
+          _exit(status == 0 ? 0 : 1);
+        }
+      } while(false);
+      close(pipeFDs[1]);
+      if (pid < 0) {
+        close(pipeFDs[0]);
+        DEBUG_LOG(utility::colourize("fork() failed for BGSAVE : " + std::string(strerror(errno)), utility::cc::RED));
+        return resp::RespParser::serialize({"ERR Background save failed to start"}, resp::RespType::SimpleError);
+      }
+      snapshotStatus.childPid = pid;
+      snapshotStatus.progressPipeFD = pipeFDs[0];
+      snapshotStatus.startTimeMs = _getCurrentTimeMs();
+      snapshotStatus.keysProcessed = 0;
+      DEBUG_LOG("background saving started by pid " + std::to_string(pid));
+      return resp::RespParser::serialize({"Background saving started"}, resp::RespType::SimpleString);
+    }
+
+    // the commands changing the dataset : the only ones _propagateWriteCommand() takes, and the ones refused with
+    // MISCONF while the append only file cannot be written
+    const WriteCommand* _findWriteCommand(const std::vector<std::string>& commandVec) const {
+      static const std::vector<WriteCommand> writeCommands{
+        {"SET"}, {"DEL", "", 1, -1}, {"MOVE"}, {"SWAPDB"}, {"FLUSHDB"}, {"XADD"}, {"XTRIM"}, {"XGROUP", "CREATE"},
+        {"XGROUP", "DESTROY"}, {"XREADGROUP"}, {"XACK"}, {"SETBIT"}, {"BITOP"}, {"BITFIELD"}, {"PFADD"}, {"PFMERGE"},
+        {"LPUSH"}, {"RPUSH"}, {"LPOP", "", 1, 1}, {"RPOP", "", 1, 1}, {"LMOVE", "", 1, 1}, {"BLPOP", "", 1, -2},
+        {"BRPOP", "", 1, -2}, {"BLMOVE", "", 1, 1}};
+      for (const WriteCommand& writeCommand : writeCommands) {
+        if (utility::compareCaseInsensitive(writeCommand.name, commandVec[0]) &&
+            (writeCommand.subcommand.empty() || (commandVec.size() > 1 && utility::compareCaseInsensitive(writeCommand.subcommand, commandVec[1]))))
+          return &writeCommand;
+      }
+      return nullptr;
+    }
+
+    // eg : LPOP of a missing list, it runs even while writes are refused (BLPOP blocks until a push, itself refused)
+    bool _isNoOpWriteCommand(const WriteCommand& writeCommand, const std::vector<std::string>& commandVec) {
+      if (writeCommand.firstSourceKey == 0)
+        return false;
+      int numArgs = static_cast<int>(commandVec.size());
+      int lastSourceKey = (writeCommand.lastSourceKey < 0) ? numArgs + writeCommand.lastSourceKey : writeCommand.lastSourceKey;
+      for (int i = writeCommand.firstSourceKey; i <= lastSourceKey && i < numArgs; i++)
+        if (redis_data_store_obj.get_key_type(commandVec[i]) != "none")
+          return false;
+      return true;
+    }
+
+    // every command changing the keyspace passes its effect here, in a form that replays to the same result (eg : relative
+    // expiries made absolute) : it is logged to the append only file and serialized once into the replication stream,
+    // each preceded by a SELECT when the database changes
+    void _propagateWriteCommand(const std::vector<std::string>& commandVec) {
+      if (_findWriteCommand(commandVec) == nullptr) {
+        DEBUG_LOG(utility::colourize("not propagated, missing from the write command table : " + commandVec[0], utility::cc::RED));
+        return;
+      }
+      int64_t dbIndex = static_cast<int64_t>(redis_data_store_obj.get_selected_db());
+      if (appendOnlyFile.is_open()) {
+        if (dbIndex != propagatedDbIndex) {
+          appendOnlyFile.append({"SELECT", std::to_string(dbIndex)});
+          propagatedDbIndex = dbIndex;
+        }
+        appendOnlyFile.append(commandVec);
+      }
+      // a replica does not produce a stream of its own
+      if (getConfigKv("role").value_or("master") != "master")
+        return;
+      if (dbIndex != replicationStatus.propagatedDbIndex) {
+        replicationStatus.pendingStream += resp::RespParser::serialize({"SELECT", std::to_string(dbIndex)}, resp::RespType::Array);
+        replicationStatus.propagatedDbIndex = dbIndex;
+      }
+      replicationStatus.pendingStream += resp::RespParser::serialize(commandVec, resp::RespType::Array);
+    }
+
+    // feeds the writes propagated since the last call to the backlog and the replicas, as a single buffer
+    void _flushReplicationStream() {
+      if (replicationStatus.isGetAckRequested) {
+        // asks every replica for its offset (WAIT clients are parked), after the writes they must acknowledge
+        replicationStatus.pendingStream += resp::RespParser::serialize({"REPLCONF", "GETACK", "*"}, resp::RespType::Array);
+        replicationStatus.isGetAckRequested = false;
+      }
+      if (replicationStatus.pendingStream.empty())
+        return;
+      _feedReplicationStream(replicationStatus.pendingStream);
+      replicationStatus.pendingStream.clear();
+    }
+
+    size_t _getClientDbIndex(int socketFD) {
+      auto it = clientDbIndexes.find(socketFD);
+      return (it == clientDbIndexes.end()) ? 0 : it->second;
+    }
+
+    // parses a database index, errMsg is set if it is not an integer or out of range
+    int _parseDbIndex(const std::string& str, size_t& dbIndex, std::string& errMsg) {
+      int64_t index = 0;
+      if (0 != utility::parseInt64(str, index)) {
+        errMsg = "ERR value is not an integer or out of range";
+        return -1;
+      }
+      if (index < 0 || static_cast<uint64_t>(index) >= RedisDataStore::get_database_count()) {
+        errMsg = "ERR DB index is out of range";
+        return -1;
+      }
+      dbIndex = static_cast<size_t>(index);
+      return 0;
+    }
+
+    std::string _commandSELECT(int& socketFD, const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 2) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'select' command"}, resp::RespType::SimpleError);
+      }
+      size_t dbIndex = 0;
+      std::string errMsg;
+      if (0 != _parseDbIndex(commandVec[1], dbIndex, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      clientDbIndexes[socketFD] = dbIndex;
+      redis_data_store_obj.select_db(dbIndex);
+      return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+    }
+
+    std::string _commandMOVE(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'move' command"}, resp::RespType::SimpleError);
+      }
+      size_t destDbIndex = 0;
+      std::string errMsg;
+      if (0 != _parseDbIndex(commandVec[2], destDbIndex, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      if (destDbIndex == redis_data_store_obj.get_selected_db()) {
+        return resp::RespParser::serialize({"ERR source and destination objects are the same"}, resp::RespType::SimpleError);
+      }
+      bool isMoved = false;
+      redis_data_store_obj.move_key(commandVec[1], destDbIndex, isMoved);
+      if (isMoved) {
+        _propagateWriteCommand(commandVec);
+        _signalKeyAsReady(destDbIndex, commandVec[1]);
+      }
+      return resp::RespParser::serialize({isMoved ? "1" : "0"}, resp::RespType::Integer);
+    }
+
+    // swapping a dataset built in another database into place is atomic for clients : every command sees either
+    // the old or the new one
+    std::string _commandSWAPDB(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 3) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'swapdb' command"}, resp::RespType::SimpleError);
+      }
+      size_t dbIndex1 = 0, dbIndex2 = 0;
+      std::string errMsg;
+      if (0 != _parseDbIndex(commandVec[1], dbIndex1, errMsg) || 0 != _parseDbIndex(commandVec[2], dbIndex2, errMsg)) {
+        return resp::RespParser::serialize({errMsg}, resp::RespType::SimpleError);
+      }
+      redis_data_store_obj.swap_databases(dbIndex1, dbIndex2);
+      _propagateWriteCommand(commandVec);
+      // clients blocked in either database may find their lists in the other dataset
+      for (auto& [dbKey, queue] : blockingKeys)
+        if (dbKey.first == dbIndex1 || dbKey.first == dbIndex2)
+          _signalKeyAsReady(dbKey.first, dbKey.second);
+      return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+    }
+
+    std::string _commandFLUSHDB(const std::vector<std::string>& commandVec) {
+      bool isAsync = false;
+      if (commandVec.size() == 2 && utility::compareCaseInsensitive("ASYNC", commandVec[1])) {
+        isAsync = true;
+      }
+      else if (commandVec.size() > 2 || (commandVec.size() == 2 && !utility::compareCaseInsensitive("SYNC", commandVec[1]))) {
+        return resp::RespParser::serialize({"ERR syntax error"}, resp::RespType::SimpleError);
+      }
+      redis_data_store_obj.flush_db(isAsync);
+      _propagateWriteCommand(commandVec);
+      return resp::RespParser::serialize({"OK"}, resp::RespType::SimpleString);
+    }
+
+    std::string _commandBGREWRITEAOF(const std::vector<std::string>& commandVec) {
+      if (commandVec.size() != 1) {
+        return resp::RespParser::serialize({"ERR wrong number of arguments for 'bgrewriteaof' command"}, resp::RespType::SimpleError);
+      }
+      if (!appendOnlyFile.is_open()) {
+        return resp::RespParser::serialize({"ERR append only file is not enabled (start the server with --appendonly yes)"}, resp::RespType::SimpleError);
+      }
+      if (aofRewriteStatus.childPid != -1) {
+        return resp::RespParser::serialize({"ERR Background append only file rewriting already in progress"}, resp::RespType::SimpleError);
+      }
+      if (_isBackgroundSaveInProgress()) {
+        aofRewriteStatus.isScheduled = true;
+        return resp::RespParser::serialize({"Background append only file rewriting scheduled"}, resp::RespType::SimpleString);
+      }
+      if (0 != _startAppendOnlyFileRewrite()) {
+        return resp::RespParser::serialize({"ERR Can't rewrite append only file in background: fork failed"}, resp::RespType::SimpleError);
+      }
+      return resp::RespParser::serialize({"Background append only file rewriting started"}, resp::RespType::SimpleString);
+    }
+
+    // forks a child writing an rdb snapshot of the dataset, the base of the rewritten append only file; commands
+    // logged until it exits are appended to it by _finishAppendOnlyFileRewrite()
+    int _startAppendOnlyFileRewrite() {
+      std::string baseFilename = getConfigKv("dir").value_or(".") + "/temp-rewriteaof-bg-" + std::to_string(getpid()) + ".aof";
+      appendOnlyFile.flush(true);
+      pid_t pid = -1;
+      do {
+        // same as BGSAVE : no thread is inside the store while forking
+        auto keyspaceLock = redis_data_store_obj.lock_keyspace();
+        pid = fork();
+        if (pid == 0) {
+          RdbFileWriter rdbFileWriter;
+          int status = rdbFileWriter.writeFile(baseFilename, redis_data_store_obj);
+          _exit(status == 0 ? 0 : 1);
+        }
+      } while(false);
+      if (pid < 0) {
+        DEBUG_LOG(utility::colourize("fork() failed for BGREWRITEAOF : " + std::string(strerror(errno)), utility::cc::RED));
+        return -1;
+      }
+      appendOnlyFile.start_rewrite();
+      propagatedDbIndex = -1;  // the tail of the new file starts with a SELECT
+      aofRewriteStatus.childPid = pid;
+      aofRewriteStatus.isScheduled = false;
+      aofRewriteStatus.baseFilename = baseFilename;
+      aofRewriteStatus.startTimeMs = _getCurrentTimeMs();
+      DEBUG_LOG("background append only file rewriting started by pid " + std::to_string(pid));
+      return 0;
+    }
+
+    void _checkAppendOnlyFileRewrite() {
+      if (aofRewriteStatus.childPid != -1) {
+        int waitStatus = 0;
+        pid_t pid = waitpid(aofRewriteStatus.childPid, &waitStatus, WNOHANG);
+        if (pid == 0)
+          return;  // still writing
+        bool isOk = (pid == aofRewriteStatus.childPid) && WIFEXITED(waitStatus) && WEXITSTATUS(waitStatus) == 0;
+        aofRewriteStatus.childPid = -1;
+        _finishAppendOnlyFileRewrite(isOk);
+        return;
+      }
+      if (!appendOnlyFile.is_open() || _isBackgroundSaveInProgress())
+        return;
+      if (aofRewriteStatus.isScheduled) {
+        _startAppendOnlyFileRewrite();
+      }
+      else if (appendOnlyFile.is_rewrite_due(aofRewriteStatus.autoRewritePercentage, aofRewriteStatus.autoRewriteMinSize)) {
+        DEBUG_LOG("starting automatic rewriting of append only file, size " + std::to_string(appendOnlyFile.get_current_size()) +
+                  " bytes (" + std::to_string(appendOnlyFile.get_base_size()) + " bytes after the last rewrite)");
+        _startAppendOnlyFileRewrite();
+      }
+    }
+
+    void _finishAppendOnlyFileRewrite(bool isOk) {
+      if (isOk) {
+        isOk = (0 == appendOnlyFile.finish_rewrite(aofRewriteStatus.baseFilename));
+      }
+      else {
+        appendOnlyFile.abort_rewrite();
+        unlink(aofRewriteStatus.baseFilename.c_str());
+      }
+      aofRewriteStatus.isLastRewriteOk = isOk;
+      aofRewriteStatus.lastRewriteDurationSec = (_getCurrentTimeMs() - aofRewriteStatus.startTimeMs) / 1000;
+      DEBUG_LOG(utility::colourize(isOk ? "background append only file rewriting terminated with success" : "background append only file rewriting failed",
+                                   isOk ? utility::cc::GREEN : utility::cc::RED));
+    }
+
+    bool _isBackgroundSaveInProgress() {
+      return snapshotStatus.childPid != -1 || snapshotStatus.isForkless;
+    }
+
+    void _finishBackgroundSave(bool isOk) {
+      snapshotStatus.isForkless = false;
+      snapshotStatus.isLastBgsaveOk = isOk;
+      snapshotStatus.lastBgsaveDurationSec = (_getCurrentTimeMs() - snapshotStatus.startTimeMs) / 1000;
+      if (isOk) {
+        snapshotStatus.lastSaveTime = std::time(nullptr);
+        snapshotStatus.saveCount++;
+      }
+      DEBUG_LOG(utility::colourize(isOk ? "background saving terminated with success" : "background saving failed",
+                                   isOk ? utility::cc::GREEN : utility::cc::RED));
+    }
+
+    std::string _serializeSubscriptionReply(const std::string& kind, const std::optional<std::string>& name, size_t count) {
+      return resp::RespParser::serializeNestedArray({
+        resp::RespParser::serialize({kind}, resp::RespType::BulkString),
+        name.has_value() ? resp::RespParser::serialize({*name}, resp::RespType::BulkString) : resp::RespConstants::NULL_BULK_STRING,
+        resp::RespParser::serialize({std::to_string(count)}, resp::RespType::Integer)
+      });
+    }
+
+    static uint64_t _getCurrentTimeMs() {
+      // monotonic clock, only used for blocking timeouts
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t _getUnixTimeMs() {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
     }
 
     int _getInfo(std::vector<std::string>& reply, const std::string& section) {
-      static const std::vector<std::string> supported_sections = {"Replication"};
+      static const std::vector<std::string> supported_sections = {"Replication", "Persistence", "Keyspace"};
       if (utility::compareCaseInsensitive(section, "all")) {
         for (auto& section : supported_sections)
             _getInfo(reply, section);
       }
       else if (utility::compareCaseInsensitive(section, "Replication")) {
-        std::string str;
-        for (auto& key : std::vector<std::string>{"role", "master_replid", "master_repl_offset"})
-          if (auto result = getConfigKv(key)) {
-            str += "\r\n" + key + ":" + *result;
+        std::ostringstream ss;
+        ss << "role:" << getConfigKv("role").value_or("master");
+        if (getConfigKv("role").value_or("master") != "master") {
+          // -1 total bytes : the master streams its rdb without knowing the size (EOF mark)
+          bool isSyncInProgress = replicationStatus.isAwaitingRdbPayload || replicationStatus.rdbPayloadReader;
+          ss << "\r\nmaster_link_status:" << (replicationStatus.masterLinkState == MasterLinkState::Connected ? "up" : "down")
+             << "\r\nmaster_sync_in_progress:" << (isSyncInProgress ? 1 : 0);
+          if (replicationStatus.rdbPayloadReader) {
+            uint64_t readBytes = replicationStatus.rdbPayloadReader->get_stream_bytes_fed();
+            ss << "\r\nmaster_sync_total_bytes:" << (replicationStatus.rdbPayloadEofMark.empty() ? static_cast<int64_t>(readBytes) + replicationStatus.rdbPayloadBytesLeft : -1)
+               << "\r\nmaster_sync_read_bytes:" << readBytes;
+          }
+        }
+        ss << "\r\nconnected_slaves:" << _countOnlineReplicas();
+        // lag : bytes of the stream not acknowledged yet, and milliseconds since the last acknowledgement
+        size_t replicaIndex = 0;
+        uint64_t now = _getCurrentTimeMs();
+        for (auto& [replicaSocketFD, replica] : replicaClients) {
+          if (replica.fullSyncState != FullSyncState::None) {
+            ss << "\r\nslave" << replicaIndex++ << ":ip=" << _getPeerIp(replicaSocketFD) << ",port=" << replica.listeningPort
+               << ",state=" << (replica.fullSyncState == FullSyncState::WaitingSnapshot ? "wait_bgsave" : "send_bulk");
+            continue;
           }
-        reply.push_back(str.substr(2, str.length()-2));
+          if (!replica.isOnline)
+            continue;
+          uint64_t lagMs = now - std::min(now, replica.ackTimeMs);
+          ss << "\r\nslave" << replicaIndex++ << ":ip=" << _getPeerIp(replicaSocketFD) << ",port=" << replica.listeningPort
+             << ",state=online,offset=" << replica.ackOffset << ",lag=" << lagMs / 1000
+             << ",lag_bytes=" << (replicationStatus.backlog.get_master_offset() - std::min(replicationStatus.backlog.get_master_offset(), replica.ackOffset))
+             << ",lag_ms=" << lagMs;
+        }
+        ss << "\r\nmaster_replid:" << replicationStatus.replid
+           << "\r\nmaster_replid2:" << replicationStatus.replid2
+           << "\r\nmaster_repl_offset:" << replicationStatus.backlog.get_master_offset()
+           << "\r\nsecond_repl_offset:" << replicationStatus.secondReplOffset
+           << "\r\nrepl_backlog_active:1"
+           << "\r\nrepl_backlog_size:" << replicationStatus.backlog.get_size()
+           << "\r\nrepl_backlog_first_byte_offset:" << replicationStatus.backlog.get_first_byte_offset()
+           << "\r\nrepl_backlog_histlen:" << replicationStatus.backlog.get_histlen()
+           << "\r\nsync_full:" << replicationStatus.numFullResyncs
+           << "\r\nsync_partial_ok:" << replicationStatus.numPartialResyncs
+           << "\r\nsync_partial_err:" << replicationStatus.numPartialResyncErrors
+           << "\r\nclient_output_buffer_limit_disconnections:" << replicationStatus.numOutputBufferLimitDisconnections;
+        reply.push_back(ss.str());
+      }
+      else if (utility::compareCaseInsensitive(section, "Persistence")) {
+        bool isBgsaveInProgress = _isBackgroundSaveInProgress();
+        std::ostringstream ss;
+        ss << "loading:" << (loadingStatus.isLoading ? 1 : 0);
+        if (loadingStatus.isLoading) {
+          // eta assumes the rest of the file loads at the average speed so far
+          uint64_t totalBytes = loadingStatus.progress.bytes_total.load(std::memory_order_relaxed);
+          uint64_t loadedBytes = loadingStatus.progress.bytes_loaded.load(std::memory_order_relaxed);
+          uint64_t elapsedMs = _getCurrentTimeMs() - loadingStatus.startTimeMs;
+          double loadedPercentage = (totalBytes == 0) ? 0 : 100.0 * loadedBytes / totalBytes;
+          int64_t etaSeconds = (loadedBytes == 0) ? 1 : static_cast<int64_t>(elapsedMs * (totalBytes - std::min(loadedBytes, totalBytes)) / loadedBytes / 1000);
+          ss << "\r\nloading_start_time:" << loadingStatus.startTime
+             << "\r\nloading_total_bytes:" << totalBytes
+             << "\r\nloading_loaded_bytes:" << loadedBytes
+             << "\r\nloading_loaded_perc:" << std::fixed << std::setprecision(2) << loadedPercentage
+             << "\r\nloading_loaded_keys:" << loadingStatus.progress.keys_loaded.load(std::memory_order_relaxed)
+             << "\r\nloading_eta_seconds:" << etaSeconds;
+        }
+        ss << "\r\nrdb_bgsave_in_progress:" << (isBgsaveInProgress ? 1 : 0)
+           << "\r\nrdb_last_save_time:" << snapshotStatus.lastSaveTime
+           << "\r\nrdb_saves:" << snapshotStatus.saveCount
+           << "\r\nrdb_last_bgsave_status:" << (snapshotStatus.isLastBgsaveOk ? "ok" : "err")
+           << "\r\nrdb_last_bgsave_time_sec:" << snapshotStatus.lastBgsaveDurationSec
+           << "\r\nrdb_current_bgsave_time_sec:" << (isBgsaveInProgress ? static_cast<int64_t>((_getCurrentTimeMs() - snapshotStatus.startTimeMs) / 1000) : -1)
+           << "\r\ncurrent_save_keys_processed:" << (isBgsaveInProgress ? snapshotStatus.keysProcessed : 0)
+           << "\r\ncurrent_save_keys_total:" << (isBgsaveInProgress ? snapshotStatus.keysTotal : 0)
+           << "\r\naof_enabled:" << (appendOnlyFile.is_open() ? 1 : 0)
+           << "\r\naof_last_write_status:" << (appendOnlyFile.get_is_last_write_ok() ? "ok" : "err");
+        bool isAofRewriteInProgress = (aofRewriteStatus.childPid != -1);
+        ss << "\r\naof_rewrite_in_progress:" << (isAofRewriteInProgress ? 1 : 0)
+           << "\r\naof_rewrite_scheduled:" << (aofRewriteStatus.isScheduled ? 1 : 0)
+           << "\r\naof_last_rewrite_time_sec:" << aofRewriteStatus.lastRewriteDurationSec
+           << "\r\naof_current_rewrite_time_sec:" << (isAofRewriteInProgress ? static_cast<int64_t>((_getCurrentTimeMs() - aofRewriteStatus.startTimeMs) / 1000) : -1)
+           << "\r\naof_last_bgrewrite_status:" << (aofRewriteStatus.isLastRewriteOk ? "ok" : "err");
+        if (appendOnlyFile.is_open())
+          ss << "\r\naof_current_size:" << appendOnlyFile.get_current_size()
+             << "\r\naof_base_size:" << appendOnlyFile.get_base_size();
+        reply.push_back(ss.str());
+      }
+      else if (utility::compareCaseInsensitive(section, "Keyspace")) {
+        std::string str;
+        auto databaseSizes = redis_data_store_obj.get_database_sizes();
+        for (size_t index = 0; index < databaseSizes.size(); index++)
+          if (databaseSizes[index].first != 0)
+            str += "\r\ndb" + std::to_string(index) + ":keys=" + std::to_string(databaseSizes[index].first) + ",expires=" + std::to_string(databaseSizes[index].second);
+        if (!str.empty())
+          reply.push_back(str.substr(2));
       }
       return 0;
     }
 
+    // 40 random hex characters, a new one for every history of the dataset
+    static std::string _generateReplid() {
+      static const char hexDigits[] = "0123456789abcdef";
+      std::random_device randomDevice;
+      std::mt19937_64 generator(randomDevice());
+      std::uniform_int_distribution<int> distribution(0, 15);
+      std::string replid(40, '0');
+      for (auto& c : replid)
+        c = hexDigits[distribution(generator)];
+      return replid;
+    }
+
     std::string generateEmptyRdbFileContent() {
       std::stringstream ss("524544495330303131fa0972656469732d76657205372e322e30fa0a72656469732d62697473c040fa056374696d65c26d08bc65fa08757365642d6d656dc2b0c41000fa08616f662d62617365c000fff06e3bfec0ff5aa2");
       std::string emptyRdbFileContent;
@@ -856,8 +3470,25 @@ namespace RCC {
     static std::mutex configStoreMutex;
     static RedisDataStore redis_data_store_obj;
     static const std::string RDB_FILE_DIR;
-    static std::unordered_set<int> replicaSocketFDSet;
+    static std::unordered_map<int, ReplicaClient> replicaClients;  // socketFD -> replica fed the replication stream
     static resp::RespParser respParser;  // to parse RESP protocol
+    static std::unordered_map<int, BlockedClient> blockedClients;  // socketFD -> parked client
+    static std::map<std::pair<size_t, std::string>, std::list<int>> blockingKeys;  // (db, key) -> FIFO of socketFDs waiting on it
+    static std::set<std::pair<uint64_t, int>> blockedClientTimers;  // (deadline ms, socketFD), earliest first
+    static std::deque<std::pair<size_t, std::string>> readyKeys;  // (db, key) pushed to while clients wait on them
+    static std::deque<UnblockedClient> unblockedClients;  // served or timed out, reply not sent yet
+    static PubSub pubSub;
+    static SnapshotStatus snapshotStatus;
+    static const size_t forklessSnapshotBucketsPerStep = 4096;  // hash table buckets written per event loop iteration
+    static std::unordered_map<int, OutputQueue> clientOutputQueues;  // socketFD -> output not yet accepted by the socket
+    static std::unordered_set<int> clientsWithPendingWrites;  // output queued during the current event loop iteration
+    static AppendOnlyFile appendOnlyFile;
+    static AofRewriteStatus aofRewriteStatus;
+    static LoadingStatus loadingStatus;
+    static ReplicationStatus replicationStatus;
+    static DisklessSyncStatus disklessSyncStatus;
+    static int64_t propagatedDbIndex;  // database of the last command logged, -1 before the first one
+    static std::unordered_map<int, size_t> clientDbIndexes;  // socketFD -> database selected with SELECT (0 if none)
   };
 
   std::map<std::string, std::string> RedisCommandCenter::configStore;
@@ -865,8 +3496,24 @@ namespace RCC {
   RedisDataStore RedisCommandCenter::redis_data_store_obj;
   // const std::string RedisCommandCenter::RDB_FILE_DIR("../rdbfiles/");
   const std::string RedisCommandCenter::RDB_FILE_DIR("./");
-  std::unordered_set<int> RedisCommandCenter::replicaSocketFDSet;
+  std::unordered_map<int, RedisCommandCenter::ReplicaClient> RedisCommandCenter::replicaClients;
   resp::RespParser RedisCommandCenter::respParser;
+  std::unordered_map<int, RedisCommandCenter::BlockedClient> RedisCommandCenter::blockedClients;
+  std::map<std::pair<size_t, std::string>, std::list<int>> RedisCommandCenter::blockingKeys;
+  std::set<std::pair<uint64_t, int>> RedisCommandCenter::blockedClientTimers;
+  std::deque<std::pair<size_t, std::string>> RedisCommandCenter::readyKeys;
+  std::deque<RedisCommandCenter::UnblockedClient> RedisCommandCenter::unblockedClients;
+  PubSub RedisCommandCenter::pubSub;
+  RedisCommandCenter::SnapshotStatus RedisCommandCenter::snapshotStatus;
+  std::unordered_map<int, OutputQueue> RedisCommandCenter::clientOutputQueues;
+  std::unordered_set<int> RedisCommandCenter::clientsWithPendingWrites;
+  AppendOnlyFile RedisCommandCenter::appendOnlyFile;
+  RedisCommandCenter::AofRewriteStatus RedisCommandCenter::aofRewriteStatus;
+  RedisCommandCenter::LoadingStatus RedisCommandCenter::loadingStatus;
+  RedisCommandCenter::ReplicationStatus RedisCommandCenter::replicationStatus;
+  RedisCommandCenter::DisklessSyncStatus RedisCommandCenter::disklessSyncStatus;
+  int64_t RedisCommandCenter::propagatedDbIndex = -1;
+  std::unordered_map<int, size_t> RedisCommandCenter::clientDbIndexes;
 };
 
 #endif  // REDISCOMMANDCENTER_HPP
@@ -8,15 +8,43 @@
 #include <chrono>
 #include <optional>
 #include <map>
+#include <unordered_map>
 #include <queue>
+#include <deque>
 #include <vector>
 #include <cstdint>
 #include <algorithm>
+#include <memory>
+#include <future>
+#include "RedisStream.hpp"
+#include "BitOps.hpp"
+#include "HyperLogLog.hpp"
+#include "RdbFileWriter.hpp"
+#include "RdbValueType.hpp"
 #include "utility.hpp"
 
 // typedef std::pair<std::string, std::string> KVPair;
 typedef std::pair<std::string, uint64_t> KEPair;
 
+// value of a set, zset or hash key loaded from an RDB file : these types have no commands yet, so the value is kept
+// in its compact serialized form (value type byte and the bytes following the key in the file) and saved unchanged
+struct EncodedValue {
+    uint8_t value_type;
+    std::string payload;
+};
+
+// a key value pair decoded from an RDB file, expiry_time_ms is absolute (UINT64_MAX if none)
+struct LoadedKeyValue {
+    enum class Kind : uint8_t { String, List, Stream, Encoded };
+    std::string key;
+    std::string value;  // string value, or payload of an encoded value
+    uint64_t expiry_time_ms;
+    Kind kind = Kind::String;
+    std::deque<std::string> list;
+    RedisStream stream;
+    uint8_t value_type = 0;  // of an encoded value
+};
+
 struct ExpiryComparator {
         bool operator()(const KEPair& left, const KEPair& right) {
             return left.second > right.second;  // for min-heap
@@ -48,23 +76,27 @@ public:
 
     std::optional<std::string> get_kv(const std::string& key) {
         std::lock_guard<std::mutex> guard(rds_mutex);  // do I need to lock mutex for getting key, value ?
-        auto it = key_value_map.find(key);
-        if (it == key_value_map.end()) {
+        auto it = db().key_value_map.find(key);
+        if (it == db().key_value_map.end()) {
             return std::nullopt;
         }
-        return key_value_map[key];
+        return db().key_value_map[key];
     }
     
+    // expiry_time_ms is an absolute unix time in milliseconds (UINT64_MAX if none), callers convert relative ones
     int set_kv(const std::string& key, const std::string& value, const uint64_t& expiry_time_ms = UINT64_MAX) {
         uint8_t status = 0;
         try {
             std::lock_guard<std::mutex> guard(rds_mutex);
-            key_value_map[key] = value;
+            snapshot_before_write_unlocked(db_index, key);
+            db().key_stream_map.erase(key);  // SET overwrites a key of any type
+            db().key_list_map.erase(key);
+            db().key_encoded_map.erase(key);
+            db().key_value_map[key] = value;
+            db().key_expiry_map.erase(key);  // SET without expiry clears an older one
             if (expiry_time_ms != UINT64_MAX) {
-                if (expiry_time_ms < 1e5)
-                    key_expiry_pq.push({key, get_current_time_ms() + expiry_time_ms});
-                else
-                    key_expiry_pq.push({key, expiry_time_ms});
+                db().key_expiry_pq.push({key, expiry_time_ms});
+                db().key_expiry_map[key] = expiry_time_ms;
                 // if max 1000 millisecond delay is ok. If real time system, make monitor_thread_sleep_duration = 0, and remove the below linees
                 // monitor_thread_sleep_duration = std::min(static_cast<uint64_t>(max_delay_ms), ((key_expiry_pq.top().second / 2)-min_delay_ms));  // max sleep duration of 1 second i.e. 1000 ms
                 // monitor_thread_sleep_duration = std::max(static_cast<uint64_t>(min_delay_ms), monitor_thread_sleep_duration);
@@ -76,19 +108,263 @@ public:
         return status;
     }
 
+    // bitmap commands on string values : all return 0 on success and -1 on error (err_msg is set to the RESP error text)
+
+    int setbit(const std::string& key, uint64_t bit_offset, int bit, int& old_bit, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        std::string* str = get_string_unlocked(key, true, err_msg);
+        if (str == nullptr)
+            return -1;
+        uint64_t byte_index = bit_offset >> 3;
+        if (str->length() <= byte_index)
+            str->resize(byte_index + 1, '\0');
+        old_bit = bitops::getBit(*str, bit_offset);
+        bitops::setBit(*str, bit_offset, bit);
+        return 0;
+    }
+
+    int getbit(const std::string& key, uint64_t bit_offset, int& bit, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::string* str = get_string_unlocked(key, false, err_msg);
+        bit = (str == nullptr) ? 0 : bitops::getBit(*str, bit_offset);
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    // range is [start, end] in bytes (or bits if is_bit_unit), negative values count from the end
+    int bitcount(const std::string& key, std::optional<std::pair<int64_t, int64_t>> range, bool is_bit_unit, uint64_t& count, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        count = 0;
+        std::string* str = get_string_unlocked(key, false, err_msg);
+        if (str == nullptr || str->empty())
+            return err_msg.empty() ? 0 : -1;
+        if (!range.has_value()) {
+            count = bitops::popcount(reinterpret_cast<const uint8_t*>(str->data()), str->length());
+            return 0;
+        }
+        int64_t total = static_cast<int64_t>(str->length()) * (is_bit_unit ? 8 : 1);
+        int64_t start = range->first, end = range->second;
+        if (0 != normalize_range(total, start, end))
+            return 0;
+        uint64_t start_bit = is_bit_unit ? start : start * 8;
+        uint64_t end_bit = is_bit_unit ? end : end * 8 + 7;
+        count = bitops::countBitsInRange(*str, start_bit, end_bit);
+        return 0;
+    }
+
+    int bitpos(const std::string& key, int bit, std::optional<int64_t> start_opt, std::optional<int64_t> end_opt, bool is_bit_unit,
+               int64_t& pos, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::string* str = get_string_unlocked(key, false, err_msg);
+        if (str == nullptr || str->empty()) {
+            pos = bit ? -1 : 0;
+            return err_msg.empty() ? 0 : -1;
+        }
+        int64_t total = static_cast<int64_t>(str->length()) * (is_bit_unit ? 8 : 1);
+        int64_t start = start_opt.value_or(0);
+        int64_t end = end_opt.value_or(total - 1);
+        if (0 != normalize_range(total, start, end)) {
+            pos = -1;
+            return 0;
+        }
+        uint64_t start_bit = is_bit_unit ? start : start * 8;
+        uint64_t end_bit = is_bit_unit ? end : end * 8 + 7;
+        pos = bitops::findBitInRange(*str, bit, start_bit, end_bit);
+        if (pos == -1 && bit == 0 && !end_opt.has_value()) {
+            pos = static_cast<int64_t>(str->length()) * 8;  // clear bits are assumed right after the string
+        }
+        return 0;
+    }
+
+    int bitop(bitops::BitOp op, const std::string& dest_key, const std::vector<std::string>& src_keys, uint64_t& result_length, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, dest_key);
+        std::vector<const std::string*> srcs;
+        size_t max_length = 0;
+        for (auto& src_key : src_keys) {
+            const std::string* str = get_string_unlocked(src_key, false, err_msg);
+            if (!err_msg.empty())
+                return -1;
+            srcs.push_back(str);
+            if (str != nullptr)
+                max_length = std::max(max_length, str->length());
+        }
+        result_length = max_length;
+        if (max_length == 0) {
+            erase_key_unlocked(db_index, dest_key);
+            return 0;
+        }
+
+        std::string result(max_length, '\0');
+        uint8_t* dest = reinterpret_cast<uint8_t*>(result.data());
+        if (srcs[0] != nullptr)
+            memcpy(dest, srcs[0]->data(), srcs[0]->length());
+        if (op == bitops::BitOp::NOT) {
+            for (size_t i = 0; i < max_length; i++)
+                dest[i] = ~dest[i];
+        }
+        for (size_t i = 1; i < srcs.size(); i++) {
+            size_t src_length = (srcs[i] == nullptr) ? 0 : srcs[i]->length();
+            if (src_length > 0)
+                bitops::bitwiseOp(op, dest, reinterpret_cast<const uint8_t*>(srcs[i]->data()), src_length);
+            if (op == bitops::BitOp::AND && src_length < max_length)
+                memset(dest + src_length, 0, max_length - src_length);  // missing bytes are zero
+        }
+        erase_key_unlocked(db_index, dest_key);
+        db().key_value_map[dest_key] = std::move(result);
+        return 0;
+    }
+
+    // results has one entry per op, nullopt when OVERFLOW FAIL prevented the op
+    int bitfield(const std::string& key, const std::vector<bitops::BitfieldOp>& ops, std::vector<std::optional<int64_t>>& results, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        bool is_write = std::any_of(ops.begin(), ops.end(), [](const bitops::BitfieldOp& op) { return op.type != bitops::BitfieldOp::Type::GET; });
+        std::string empty_str;
+        std::string* str = get_string_unlocked(key, is_write, err_msg);
+        if (!err_msg.empty())
+            return -1;
+        if (str == nullptr)
+            str = &empty_str;  // GET only on a missing key reads zeros
+
+        for (auto& op : ops) {
+            if (op.type != bitops::BitfieldOp::Type::GET) {
+                uint64_t required_length = (op.offset + op.bits + 7) >> 3;
+                if (str->length() < required_length)
+                    str->resize(required_length, '\0');
+            }
+            int64_t old_value = op.isSigned ? bitops::getSignedField(*str, op.offset, op.bits)
+                                            : static_cast<int64_t>(bitops::getUnsignedField(*str, op.offset, op.bits));
+            if (op.type == bitops::BitfieldOp::Type::GET) {
+                results.push_back(old_value);
+                continue;
+            }
+            __int128 new_value = (op.type == bitops::BitfieldOp::Type::SET)
+                                 ? static_cast<__int128>(op.value)
+                                 : static_cast<__int128>(old_value) + op.value;
+            uint64_t raw = 0;
+            if (!bitops::handleOverflow(new_value, op.isSigned, op.bits, op.overflow, raw)) {
+                results.push_back(std::nullopt);
+                continue;
+            }
+            bitops::setField(*str, op.offset, op.bits, raw);
+            if (op.type == bitops::BitfieldOp::Type::SET)
+                results.push_back(old_value);
+            else
+                results.push_back(bitops::fieldToInt64(raw, op.isSigned, op.bits));
+        }
+        return 0;
+    }
+
+    // updated is set to 1 if at least one register changed (or the key was created)
+    int pfadd(const std::string& key, const std::vector<std::string>& elements, int& updated, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        bool is_new_key = (db().key_value_map.count(key) == 0);
+        std::string* str = get_hll_unlocked(key, true, err_msg);
+        if (!err_msg.empty())
+            return -1;
+        updated = (hll::addElements(*str, elements) > 0 || is_new_key) ? 1 : 0;
+        return 0;
+    }
+
+    int pfcount(const std::vector<std::string>& keys, uint64_t& count, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, keys[0]);
+        if (keys.size() == 1) {
+            std::string* str = get_hll_unlocked(keys[0], false, err_msg);
+            if (!err_msg.empty())
+                return -1;
+            count = (str == nullptr) ? 0 : hll::count(*str);
+            return 0;
+        }
+        std::vector<uint8_t> merged(hll::REGISTERS, 0);
+        if (-1 == merge_hll_unlocked(keys, merged, err_msg))
+            return -1;
+        count = hll::estimate(merged.data());
+        return 0;
+    }
+
+    int pfmerge(const std::string& dest_key, const std::vector<std::string>& src_keys, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, dest_key);
+        std::vector<std::string> keys{dest_key};
+        keys.insert(keys.end(), src_keys.begin(), src_keys.end());
+        std::vector<uint8_t> merged(hll::REGISTERS, 0);
+        if (-1 == merge_hll_unlocked(keys, merged, err_msg))
+            return -1;
+        db().key_value_map[dest_key] = hll::fromRawRegisters(merged.data());
+        return 0;
+    }
+
+    // pre-sizes the selected database for count keys (RDB resize hint) so loading does not rehash repeatedly; a
+    // database with several sections in the file gets the hint once per section
+    int reserve_keys(size_t count) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (incremental_snapshot.writer)
+            return 0;  // buckets must not move while a snapshot walks them
+        db().key_value_map.reserve(std::max(db().key_value_map.size(), count));
+        return 0;
+    }
+
+    // inserts a batch of loaded keys under a single lock, moving the values in
+    int bulk_set_kv(std::vector<LoadedKeyValue>&& entries) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        bool is_only_strings = db().key_stream_map.empty() && db().key_list_map.empty() && db().key_encoded_map.empty();
+        for (auto& entry : entries) {
+            snapshot_before_write_unlocked(db_index, entry.key);
+            if (!is_only_strings || entry.kind != LoadedKeyValue::Kind::String) {
+                erase_key_unlocked(db_index, entry.key);
+                is_only_strings = false;
+            }
+            if (entry.expiry_time_ms != UINT64_MAX) {
+                db().key_expiry_pq.push({entry.key, entry.expiry_time_ms});
+                db().key_expiry_map[entry.key] = entry.expiry_time_ms;
+            }
+            else if (!db().key_expiry_map.empty()) {
+                db().key_expiry_map.erase(entry.key);
+            }
+            if (entry.kind == LoadedKeyValue::Kind::List)
+                db().key_list_map.insert_or_assign(std::move(entry.key), std::move(entry.list));
+            else if (entry.kind == LoadedKeyValue::Kind::Stream)
+                db().key_stream_map.insert_or_assign(std::move(entry.key), std::move(entry.stream));
+            else if (entry.kind == LoadedKeyValue::Kind::Encoded)
+                db().key_encoded_map.insert_or_assign(std::move(entry.key), EncodedValue{entry.value_type, std::move(entry.value)});
+            else
+                db().key_value_map.insert_or_assign(std::move(entry.key), std::move(entry.value));
+        }
+        return 0;
+    }
+
     int delete_kv(const std::string& key) {
         do {
             std::lock_guard<std::mutex> guard(rds_mutex);
-            auto it = key_value_map.find(key);
-            if (it == key_value_map.end()) {
+            if (0 == erase_key_unlocked(db_index, key)) {
                 return -1;
             }
-            key_value_map.erase(key);
         } while(false);  // to unlock rds_mutex because it needs to be locked in delete_pair_from_pq(key)
         delete_pair_from_pq(key);
         return 0;
     }
 
+    // DEL : returns the number of keys which existed, their stale expiry queue entries are skipped by the monitor thread
+    size_t delete_keys(const std::vector<std::string>& keys) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        size_t num_deleted = 0;
+        for (auto& key : keys)
+            num_deleted += (erase_key_unlocked(db_index, key) != 0) ? 1 : 0;
+        return num_deleted;
+    }
+
+    // (db_index, key) of the keys the monitor thread expired since the last call, so the event loop can propagate
+    // their deletion (append only file and replicas)
+    std::vector<std::pair<size_t, std::string>> take_expired_keys() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::vector<std::pair<size_t, std::string>> keys;
+        keys.swap(expired_keys);
+        return keys;
+    }
+
     int get_keys_with_pattern(std::vector<std::string>& reply, std::string pattern_text) {
         DEBUG_LOG("get keys from pattern_text = " + pattern_text);
         size_t pos = 0;
@@ -99,7 +375,22 @@ public:
         DEBUG_LOG("pattern_text = " + pattern_text);
         std::regex pattern(pattern_text);
         std::lock_guard<std::mutex> guard(rds_mutex);
-        for (auto& pair : key_value_map) {
+        for (auto& pair : db().key_value_map) {
+            if(std::regex_match(pair.first, pattern)) {
+                reply.push_back(pair.first);
+            }
+        }
+        for (auto& pair : db().key_stream_map) {
+            if(std::regex_match(pair.first, pattern)) {
+                reply.push_back(pair.first);
+            }
+        }
+        for (auto& pair : db().key_list_map) {
+            if(std::regex_match(pair.first, pattern)) {
+                reply.push_back(pair.first);
+            }
+        }
+        for (auto& pair : db().key_encoded_map) {
             if(std::regex_match(pair.first, pattern)) {
                 reply.push_back(pair.first);
             }
@@ -107,51 +398,830 @@ public:
         return 0;
     }
 
-    static int display_all_key_value_pairs() {
+    std::string get_key_type(const std::string& key) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        return get_key_type_unlocked(key);
+    }
+
+    // stream commands : all return 0 on success and -1 on error (err_msg is set to the RESP error text)
+
+    int xadd(const std::string& key, const std::string& id_spec, const std::vector<std::string>& fields_values,
+             const StreamTrimSpec& trim_spec, bool is_nomkstream, std::optional<std::string>& result_id, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        bool is_new_key = (db().key_stream_map.count(key) == 0);
+        RedisStream* stream = get_stream_unlocked(key, !is_nomkstream, err_msg);
+        if (stream == nullptr) {
+            result_id = std::nullopt;
+            return err_msg.empty() ? 0 : -1;  // NOMKSTREAM on missing key is not an error
+        }
+        StreamID id;
+        if (0 != stream->generate_next_id(id_spec, get_current_time_ms(), id, err_msg)) {
+            if (is_new_key)
+                db().key_stream_map.erase(key);  // do not leave an empty stream created by this XADD
+            return -1;
+        }
+        stream->append(id, fields_values);
+        stream->trim(trim_spec);
+        result_id = id.to_string();
+        return 0;
+    }
+
+    int xlen(const std::string& key, uint64_t& length, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        length = (stream == nullptr) ? 0 : stream->size();
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    int xrange(const std::string& key, const StreamID& start, const StreamID& end, uint64_t count, bool is_reverse,
+               std::vector<StreamEntry>& result, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        if (stream != nullptr) {
+            stream->range(start, end, count, is_reverse, result);
+        }
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    int xtrim(const std::string& key, const StreamTrimSpec& trim_spec, uint64_t& removed, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        removed = (stream == nullptr) ? 0 : stream->trim(trim_spec);
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    int xgroup_create(const std::string& key, const std::string& group_name, const std::string& id_str, bool is_mkstream, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        RedisStream* stream = get_stream_unlocked(key, is_mkstream, err_msg);
+        if (stream == nullptr) {
+            if (err_msg.empty())
+                err_msg = "ERR The XGROUP subcommand requires the key to exist. Note that for CREATE you may want to use the MKSTREAM option to create an empty stream automatically.";
+            return -1;
+        }
+        StreamID id;
+        if (id_str == "$") {
+            id = stream->get_last_id();
+        }
+        else if (0 != StreamID::parse(id_str, id)) {
+            err_msg = "ERR Invalid stream ID specified as stream command argument";
+            return -1;
+        }
+        if (0 != stream->create_group(group_name, id)) {
+            err_msg = "BUSYGROUP Consumer Group name already exists";
+            return -1;
+        }
+        return 0;
+    }
+
+    int xgroup_destroy(const std::string& key, const std::string& group_name, int& destroyed, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        if (stream == nullptr) {
+            if (err_msg.empty())
+                err_msg = "ERR The XGROUP subcommand requires the key to exist.";
+            return -1;
+        }
+        destroyed = stream->destroy_group(group_name);
+        return 0;
+    }
+
+    int xreadgroup(const std::string& key, const std::string& group_name, const std::string& consumer_name, const std::string& id_str,
+                   uint64_t count, bool is_noack, std::vector<StreamEntry>& result, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        StreamConsumerGroup* group = (stream == nullptr) ? nullptr : stream->get_group(group_name);
+        if (group == nullptr) {
+            if (err_msg.empty())
+                err_msg = "NOGROUP No such key '" + key + "' or consumer group '" + group_name + "' in XREADGROUP with GROUP option";
+            return -1;
+        }
+        bool is_new_entries = (id_str == ">");
+        StreamID id;
+        if (!is_new_entries && 0 != StreamID::parse(id_str, id)) {
+            err_msg = "ERR Invalid stream ID specified as stream command argument";
+            return -1;
+        }
+        return stream->read_group(*group, consumer_name, is_new_entries, id, count, is_noack, get_current_time_ms(), result);
+    }
+
+    int xack(const std::string& key, const std::string& group_name, const std::vector<StreamID>& ids, uint64_t& acked, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        acked = 0;
+        RedisStream* stream = get_stream_unlocked(key, false, err_msg);
+        StreamConsumerGroup* group = (stream == nullptr) ? nullptr : stream->get_group(group_name);
+        if (group != nullptr) {
+            acked = stream->ack(*group, ids);
+        }
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    // list commands : all return 0 on success and -1 on error (err_msg is set to the RESP error text)
+
+    int list_push(const std::string& key, const std::vector<std::string>& values, bool is_left, uint64_t& length, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        std::deque<std::string>* list = get_list_unlocked(key, true, err_msg);
+        if (list == nullptr)
+            return -1;
+        for (auto& value : values) {
+            if (is_left)
+                list->push_front(value);
+            else
+                list->push_back(value);
+        }
+        length = list->size();
+        return 0;
+    }
+
+    // pops at most count elements, values is left empty if key does not exist
+    int list_pop(const std::string& key, bool is_left, uint64_t count, std::vector<std::string>& values, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, key);
+        std::deque<std::string>* list = get_list_unlocked(key, false, err_msg);
+        if (list == nullptr)
+            return err_msg.empty() ? 0 : -1;
+        while (count-- > 0 && !list->empty()) {
+            if (is_left) {
+                values.push_back(std::move(list->front()));
+                list->pop_front();
+            }
+            else {
+                values.push_back(std::move(list->back()));
+                list->pop_back();
+            }
+        }
+        if (list->empty())
+            db().key_list_map.erase(key);  // lists never exist empty
+        return 0;
+    }
+
+    int llen(const std::string& key, uint64_t& length, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::deque<std::string>* list = get_list_unlocked(key, false, err_msg);
+        length = (list == nullptr) ? 0 : list->size();
+        return err_msg.empty() ? 0 : -1;
+    }
+
+    int lrange(const std::string& key, int64_t start, int64_t end, std::vector<std::string>& values, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::deque<std::string>* list = get_list_unlocked(key, false, err_msg);
+        if (list == nullptr)
+            return err_msg.empty() ? 0 : -1;
+        if (0 != normalize_range(static_cast<int64_t>(list->size()), start, end))
+            return 0;
+        values.assign(list->begin() + start, list->begin() + end + 1);
+        return 0;
+    }
+
+    // atomically pops from src and pushes to dest, value is nullopt if src does not exist
+    int lmove(const std::string& src_key, const std::string& dest_key, bool is_src_left, bool is_dest_left,
+              std::optional<std::string>& value, std::string& err_msg) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        snapshot_before_write_unlocked(db_index, src_key);
+        snapshot_before_write_unlocked(db_index, dest_key);
+        value = std::nullopt;
+        std::deque<std::string>* src = get_list_unlocked(src_key, false, err_msg);
+        if (src == nullptr)
+            return err_msg.empty() ? 0 : -1;
+        std::deque<std::string>* dest = get_list_unlocked(dest_key, true, err_msg);
+        if (dest == nullptr)
+            return -1;
+        value = is_src_left ? src->front() : src->back();
+        if (is_src_left)
+            src->pop_front();
+        else
+            src->pop_back();
+        if (is_dest_left)
+            dest->push_front(*value);
+        else
+            dest->push_back(*value);
+        if (src->empty())
+            db().key_list_map.erase(src_key);
+        return 0;
+    }
+
+    // numbered databases : every database is an independent keyspace (dictionaries and expires index), commands of
+    // an object run against the database it selected (0 by default)
+
+    // only before any key is stored (startup); returns -1 if count is 0 or keys exist already
+    static int set_database_count(size_t count) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (count == 0 || count_keys_all_unlocked() != 0)
+            return -1;
+        databases.resize(count);
+        return 0;
+    }
+
+    static size_t get_database_count() {
+        return databases.size();  // fixed after startup
+    }
+
+    // returns -1 if db_index is out of range
+    int select_db(size_t db_index) {
+        if (db_index >= databases.size())
+            return -1;
+        this->db_index = db_index;
+        return 0;
+    }
+
+    size_t get_selected_db() const {
+        return db_index;
+    }
+
+    // MOVE : moves key (value and expiry) from the selected database to dest_db_index; is_moved is false if key does
+    // not exist or dest_db_index already holds it
+    int move_key(const std::string& key, size_t dest_db_index, bool& is_moved) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        is_moved = false;
+        Database& src = db();
+        Database& dest = databases[dest_db_index];
+        if (!contains_key_unlocked(src, key) || contains_key_unlocked(dest, key))
+            return 0;
+        snapshot_before_write_unlocked(db_index, key);
+        snapshot_before_write_unlocked(dest_db_index, key);
+        // nodes are relinked, values are not copied
+        if (auto node = src.key_value_map.extract(key))
+            dest.key_value_map.insert(std::move(node));
+        else if (auto node = src.key_list_map.extract(key))
+            dest.key_list_map.insert(std::move(node));
+        else if (auto node = src.key_stream_map.extract(key))
+            dest.key_stream_map.insert(std::move(node));
+        else if (auto node = src.key_encoded_map.extract(key))
+            dest.key_encoded_map.insert(std::move(node));
+        auto expiry_it = src.key_expiry_map.find(key);
+        if (expiry_it != src.key_expiry_map.end()) {
+            dest.key_expiry_pq.push({key, expiry_it->second});
+            dest.key_expiry_map[key] = expiry_it->second;
+            src.key_expiry_map.erase(expiry_it);  // its entry in src.key_expiry_pq is stale now
+        }
+        is_moved = true;
+        return 0;
+    }
+
+    // SWAPDB : exchanges the whole content of two databases in constant time, clients see the other dataset on their
+    // next command
+    int swap_databases(size_t db_index1, size_t db_index2) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (db_index1 == db_index2)
+            return 0;
+        if (incremental_snapshot.writer) {
+            // a running forkless snapshot keeps both datasets under their old index
+            snapshot_database_unlocked(db_index1);
+            snapshot_database_unlocked(db_index2);
+        }
+        std::swap(databases[db_index1], databases[db_index2]);
+        return 0;
+    }
+
+    // FLUSHDB : empties the selected database; with is_async the old dictionaries are freed on a background thread
+    int flush_db(bool is_async) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (incremental_snapshot.writer) {
+            // tables are cleared in place, buckets must not move while the snapshot walks them
+            snapshot_database_unlocked(db_index);
+            Database& database = db();
+            database.key_value_map.clear();
+            database.key_stream_map.clear();
+            database.key_list_map.clear();
+            database.key_encoded_map.clear();
+            database.key_expiry_pq = decltype(database.key_expiry_pq)();
+            database.key_expiry_map.clear();
+            return 0;
+        }
+        auto old_database = std::make_unique<Database>();
+        std::swap(*old_database, db());
+        if (is_async)
+            std::thread([old_database = std::move(old_database)]() {}).detach();
+        return 0;
+    }
+
+    // staged dataset : a replica loads the rdb of a full resynchronization next to the live databases (which keep
+    // serving reads meanwhile), then swaps it in at once
+
+    // drops what a previous load left and prepares empty staged databases
+    int begin_staged_load() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        staged_databases = std::vector<Database>(databases.size());
+        return 0;
+    }
+
+    int discard_staged_databases() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::vector<Database>().swap(staged_databases);
+        return 0;
+    }
+
+    // same as bulk_set_kv() for staged database db_index (keys of an rdb file are unique per database)
+    int bulk_set_staged_kv(size_t db_index, std::vector<LoadedKeyValue>&& entries) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (db_index >= staged_databases.size())
+            return -1;
+        Database& database = staged_databases[db_index];
+        for (auto& entry : entries) {
+            if (entry.expiry_time_ms != UINT64_MAX) {
+                database.key_expiry_pq.push({entry.key, entry.expiry_time_ms});
+                database.key_expiry_map[entry.key] = entry.expiry_time_ms;
+            }
+            if (entry.kind == LoadedKeyValue::Kind::List)
+                database.key_list_map.insert_or_assign(std::move(entry.key), std::move(entry.list));
+            else if (entry.kind == LoadedKeyValue::Kind::Stream)
+                database.key_stream_map.insert_or_assign(std::move(entry.key), std::move(entry.stream));
+            else if (entry.kind == LoadedKeyValue::Kind::Encoded)
+                database.key_encoded_map.insert_or_assign(std::move(entry.key), EncodedValue{entry.value_type, std::move(entry.value)});
+            else
+                database.key_value_map.insert_or_assign(std::move(entry.key), std::move(entry.value));
+        }
+        return 0;
+    }
+
+    // replaces every database with its staged one, the previous dataset is freed on a background thread
+    int swap_in_staged_databases() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        if (staged_databases.size() != databases.size())
+            return -1;
+        if (incremental_snapshot.writer) {
+            // a running forkless snapshot keeps the dataset it started with, the new one counts as written
+            for (size_t index = 0; index < databases.size(); index++)
+                snapshot_database_unlocked(index);
+            for (auto& database : staged_databases) {
+                freeze_buckets_unlocked(database.key_value_map, database.bucket_epochs[0]);
+                freeze_buckets_unlocked(database.key_list_map, database.bucket_epochs[1]);
+                freeze_buckets_unlocked(database.key_stream_map, database.bucket_epochs[2]);
+                freeze_buckets_unlocked(database.key_encoded_map, database.bucket_epochs[3]);
+                for (auto& bucket_epochs : database.bucket_epochs)
+                    std::fill(bucket_epochs.begin(), bucket_epochs.end(), incremental_snapshot.epoch);
+            }
+        }
+        auto old_databases = std::make_unique<std::vector<Database>>();
+        old_databases->swap(databases);
+        databases.swap(staged_databases);
+        expired_keys.clear();  // they belonged to the previous dataset
+        std::thread([old_databases = std::move(old_databases)]() {}).detach();
+        return 0;
+    }
+
+    // snapshot support : lock_keyspace() keeps the keyspace consistent while it is visited (or while forking)
+
+    std::unique_lock<std::mutex> lock_keyspace() {
+        return std::unique_lock<std::mutex>(rds_mutex);
+    }
+
+    // rds_mutex must be held by the caller (or the process is a forked child); counts cover every database
+    size_t count_keys_unlocked() const {
+        return count_keys_all_unlocked();
+    }
+
+    size_t count_expires_unlocked() const {
+        size_t count = 0;
+        for (auto& database : databases)
+            count += database.key_expiry_map.size();
+        return count;
+    }
+
+    // rds_mutex must be held by the caller (or the process is a forked child); for every non empty database calls
+    // visitor.on_database() with (db_index, keys, expires), then visitor.on_string(), visitor.on_list(),
+    // visitor.on_stream() or visitor.on_encoded() with (key, value, expiry_time_ms) for each of its keys,
+    // expiry_time_ms is absolute (UINT64_MAX if none); stops and returns -1 as soon as the visitor returns non zero
+    template <typename Visitor>
+    int visit_keyspace_unlocked(Visitor& visitor) const {
+        for (size_t index = 0; index < databases.size(); index++) {
+            const Database& database = databases[index];
+            if (count_keys_unlocked(database) == 0)
+                continue;
+            if (0 != visitor.on_database(index, count_keys_unlocked(database), database.key_expiry_map.size()))
+                return -1;
+            for (auto& [key, value] : database.key_value_map)
+                if (0 != visitor.on_string(key, value, get_expiry_unlocked(index, key)))
+                    return -1;
+            for (auto& [key, list] : database.key_list_map)
+                if (0 != visitor.on_list(key, list, get_expiry_unlocked(index, key)))
+                    return -1;
+            for (auto& [key, stream] : database.key_stream_map)
+                if (0 != visitor.on_stream(key, stream, get_expiry_unlocked(index, key)))
+                    return -1;
+            for (auto& [key, value] : database.key_encoded_map)
+                if (0 != visitor.on_encoded(key, value.value_type, value.payload, get_expiry_unlocked(index, key)))
+                    return -1;
+        }
+        return 0;
+    }
+
+    // INFO keyspace : (keys, expires) of every database
+    std::vector<std::pair<size_t, size_t>> get_database_sizes() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        std::vector<std::pair<size_t, size_t>> sizes;
+        for (auto& database : databases)
+            sizes.emplace_back(count_keys_unlocked(database), database.key_expiry_map.size());
+        return sizes;
+    }
+
+    /*
+      Forkless snapshot : the keyspace is written bucket by bucket from the event loop while commands keep running.
+      Every hash table bucket carries the epoch of the last snapshot that wrote it. A write to a key whose bucket
+      was not written yet by the running snapshot first writes that bucket, so the file holds the keyspace as it
+      was when the snapshot started, and extra memory is only the output buffer (bounded by the write rate).
+      Buckets stay in place during a snapshot : tables are not rehashed until it ends (keys inserted meanwhile only
+      lengthen the chains). Databases are walked in order; a bucket of another database written early goes to a
+      database selector section of its own, loaders switch back and forth between databases as the file says.
+      Once every bucket is written, fsync and rename of the file run on a background thread.
+    */
+
+    // returns 0 if a snapshot to filename is started, -1 if one is already running or the file cannot be created
+    int start_incremental_snapshot(const std::string& filename) {
         std::lock_guard<std::mutex> guard(rds_mutex);
-        for(auto& pair : key_value_map) {
-            DEBUG_LOG("key=" + pair.first + ", value = " + pair.second);
+        auto& snapshot = incremental_snapshot;
+        if (snapshot.writer || snapshot.finisher.valid())
+            return -1;
+        auto writer = std::make_unique<RdbFileWriter>();
+        snapshot.keys_total = count_keys_unlocked();
+        if (0 != writer->begin(filename))
+            return -1;
+        snapshot.writer = std::move(writer);
+        snapshot.epoch++;
+        snapshot.is_failed = false;
+        snapshot.db_cursor = 0;
+        snapshot.table_index = 0;
+        snapshot.bucket_cursor = 0;
+        snapshot.writer_db_index = SIZE_MAX;
+        for (auto& database : databases) {
+            freeze_buckets_unlocked(database.key_value_map, database.bucket_epochs[0]);
+            freeze_buckets_unlocked(database.key_list_map, database.bucket_epochs[1]);
+            freeze_buckets_unlocked(database.key_stream_map, database.bucket_epochs[2]);
+            freeze_buckets_unlocked(database.key_encoded_map, database.bucket_epochs[3]);
+        }
+        return 0;
+    }
+
+    // writes up to max_buckets more buckets; is_done is set once the snapshot ended, then returns 0 if the file was
+    // saved and -1 if it failed
+    int advance_incremental_snapshot(size_t max_buckets, bool& is_done, uint64_t& keys_written) {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        auto& snapshot = incremental_snapshot;
+        is_done = false;
+        keys_written = snapshot.keys_written;
+        if (snapshot.finisher.valid()) {
+            if (snapshot.finisher.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return 0;
+            is_done = true;
+            return (0 == snapshot.finisher.get()) ? 0 : -1;
+        }
+        if (!snapshot.writer) {
+            is_done = true;
+            return -1;
+        }
+        while (max_buckets > 0 && snapshot.db_cursor < databases.size() && !snapshot.is_failed) {
+            size_t bucket_count = databases[snapshot.db_cursor].bucket_epochs[snapshot.table_index].size();
+            size_t end = std::min(bucket_count, snapshot.bucket_cursor + max_buckets);
+            for (; snapshot.bucket_cursor < end; snapshot.bucket_cursor++) {
+                snapshot_table_bucket_unlocked(snapshot.db_cursor, snapshot.table_index, snapshot.bucket_cursor);
+                max_buckets--;
+            }
+            // >= : SWAPDB may have brought in smaller (already written) tables
+            if (snapshot.bucket_cursor >= bucket_count) {
+                snapshot.bucket_cursor = 0;
+                if (++snapshot.table_index == SNAPSHOT_TABLES) {
+                    snapshot.table_index = 0;
+                    snapshot.db_cursor++;
+                }
+            }
         }
-        if (key_expiry_pq.empty()) {
-            DEBUG_LOG("key_expiry_pq is empty");
+        keys_written = snapshot.keys_written = snapshot.writer->getKeysWritten();
+        if (snapshot.db_cursor < databases.size() && !snapshot.is_failed)
+            return 0;
+
+        for (auto& database : databases) {
+            database.key_value_map.max_load_factor(1.0);
+            database.key_list_map.max_load_factor(1.0);
+            database.key_stream_map.max_load_factor(1.0);
+            database.key_encoded_map.max_load_factor(1.0);
+        }
+        if (snapshot.is_failed) {
+            snapshot.writer->abort();
+            snapshot.writer.reset();
+            is_done = true;
+            return -1;
         }
-        else {
-            std::priority_queue<decltype(key_expiry_pq)::value_type, std::vector<decltype(key_expiry_pq)::value_type>, ExpiryComparator> temp_pq = key_expiry_pq;
-            // auto temp_pq = key_expiry_pq;
+        snapshot.finisher = std::async(std::launch::async, [writer = std::move(snapshot.writer)]() {
+            return writer->finish();
+        });
+        return 0;
+    }
+
+    // true while buckets are still being written (false once only the background fsync is left)
+    bool is_incremental_snapshot_writing() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        return incremental_snapshot.writer != nullptr;
+    }
+
+    uint64_t get_incremental_snapshot_keys_total() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        return incremental_snapshot.keys_total;
+    }
+
+    static int display_all_key_value_pairs() {
+        std::lock_guard<std::mutex> guard(rds_mutex);
+        for (size_t index = 0; index < databases.size(); index++) {
+            const Database& database = databases[index];
+            for(auto& pair : database.key_value_map) {
+                DEBUG_LOG("db=" + std::to_string(index) + ", key=" + pair.first + ", value = " + pair.second);
+            }
+            std::priority_queue<KEPair, std::vector<KEPair>, ExpiryComparator> temp_pq = database.key_expiry_pq;
             while(!temp_pq.empty()) {
                 auto& pair = temp_pq.top();
-                DEBUG_LOG("key = " + pair.first + ", expiry = " + std::to_string(pair.second));
+                DEBUG_LOG("db=" + std::to_string(index) + ", key = " + pair.first + ", expiry = " + std::to_string(pair.second));
                 temp_pq.pop();
             }
         }
         return 0;
     }
 private:
+    static const size_t SNAPSHOT_TABLES = 4;  // key_value_map, key_list_map, key_stream_map, key_encoded_map
+    static const size_t DEFAULT_DATABASES = 16;
+
+    // a numbered keyspace, every key lives in one of its value maps; SWAPDB swaps whole databases
+    struct Database {
+        std::unordered_map<std::string, std::string> key_value_map;
+        std::unordered_map<std::string, RedisStream> key_stream_map;
+        std::unordered_map<std::string, std::deque<std::string>> key_list_map;
+        std::unordered_map<std::string, EncodedValue> key_encoded_map;  // sets, zsets and hashes loaded from RDB files
+        // priority queue is meant to store only the keys with expiry so as to get the earliest expiring key
+        std::priority_queue<KEPair, std::vector<KEPair>, ExpiryComparator> key_expiry_pq;
+        std::unordered_map<std::string, uint64_t> key_expiry_map;  // current expiry of each key having one
+        std::vector<uint64_t> bucket_epochs[SNAPSHOT_TABLES];  // forkless snapshot epoch of each bucket, per table
+    };
+
+    Database& db() const {
+        return databases[db_index];
+    }
+
+    static size_t count_keys_unlocked(const Database& database) {
+        return database.key_value_map.size() + database.key_stream_map.size() + database.key_list_map.size() + database.key_encoded_map.size();
+    }
+
+    static size_t count_keys_all_unlocked() {
+        size_t count = 0;
+        for (auto& database : databases)
+            count += count_keys_unlocked(database);
+        return count;
+    }
+
+    static bool contains_key_unlocked(const Database& database, const std::string& key) {
+        return database.key_value_map.count(key) != 0 || database.key_list_map.count(key) != 0 ||
+               database.key_stream_map.count(key) != 0 || database.key_encoded_map.count(key) != 0;
+    }
+
     static void monitor_keys_for_expiry() {
         while(is_continue_monitoring) {
             std::this_thread::sleep_for(std::chrono::milliseconds(monitor_thread_sleep_duration));
             // DEBUG_LOG("monitor_thread_sleep_duration = " + std::to_string(monitor_thread_sleep_duration));
             // display_all_key_value_pairs();
-            while (!key_expiry_pq.empty()) {
-                auto kv_pair = key_expiry_pq.top();
-                std::string key = kv_pair.first;
-                uint64_t key_expiry_time = kv_pair.second;
-                if (key_expiry_time > get_current_time_ms())
-                    break;
-                // delete_kv(key); // but this is slow
-                std::lock_guard<std::mutex> guard(rds_mutex);
-                key_value_map.erase(key);
-                key_expiry_pq.pop();
+            for (size_t index = 0; index < databases.size(); index++) {
+                for (;;) {
+                    // delete_kv(key); // but this is slow
+                    std::lock_guard<std::mutex> guard(rds_mutex);
+                    auto& key_expiry_pq = databases[index].key_expiry_pq;
+                    if (key_expiry_pq.empty() || key_expiry_pq.top().second > get_current_time_ms())
+                        break;
+                    auto [key, key_expiry_time] = key_expiry_pq.top();
+                    // entry is stale if the key was deleted, moved or set again with another (or no) expiry since
+                    auto& key_expiry_map = databases[index].key_expiry_map;
+                    auto it = key_expiry_map.find(key);
+                    if (it != key_expiry_map.end() && it->second == key_expiry_time) {
+                        erase_key_unlocked(index, key);
+                        expired_keys.emplace_back(index, key);
+                    }
+                    key_expiry_pq.pop();
+                }
+            }
+        }
+    }
+
+    // rds_mutex must be held by the caller; returns number of keys erased
+    static size_t erase_key_unlocked(size_t db_index, const std::string& key) {
+        snapshot_before_write_unlocked(db_index, key);
+        Database& database = databases[db_index];
+        database.key_expiry_map.erase(key);
+        return database.key_value_map.erase(key) + database.key_stream_map.erase(key) + database.key_list_map.erase(key) + database.key_encoded_map.erase(key);
+    }
+
+    struct IncrementalSnapshot {
+        std::unique_ptr<RdbFileWriter> writer;  // set while a snapshot is running
+        uint64_t epoch = 0;  // bumped by every snapshot, a bucket is written once its epoch matches
+        size_t db_cursor = 0;  // database, table and bucket the walk continues from
+        size_t table_index = 0;
+        size_t bucket_cursor = 0;
+        size_t writer_db_index = SIZE_MAX;  // database of the section the writer is in
+        bool is_failed = false;  // a write to the file failed, the snapshot is dropped at the next step
+        uint64_t keys_total = 0;
+        uint64_t keys_written = 0;
+        std::future<int> finisher;  // RdbFileWriter::finish() of a fully written snapshot
+    };
+
+    // rds_mutex must be held by the caller; stops rehashing until the snapshot ends, small tables get some room first
+    template <typename Map>
+    static void freeze_buckets_unlocked(Map& map, std::vector<uint64_t>& bucket_epochs) {
+        map.reserve(std::max<size_t>(map.size(), 1024));  // no rehash for tables already sized for their keys
+        map.max_load_factor(1e6);
+        // epochs of older snapshots are all lower, so they never need clearing (only new buckets start at 0)
+        bucket_epochs.resize(map.bucket_count(), 0);
+    }
+
+    // rds_mutex must be held by the caller; called before key of database db_index is modified, created or deleted
+    static void snapshot_before_write_unlocked(size_t db_index, const std::string& key) {
+        if (!incremental_snapshot.writer)
+            return;
+        Database& database = databases[db_index];
+        snapshot_bucket_unlocked(db_index, database.key_value_map, database.key_value_map.bucket(key), database.bucket_epochs[0]);
+        snapshot_bucket_unlocked(db_index, database.key_list_map, database.key_list_map.bucket(key), database.bucket_epochs[1]);
+        snapshot_bucket_unlocked(db_index, database.key_stream_map, database.key_stream_map.bucket(key), database.bucket_epochs[2]);
+        snapshot_bucket_unlocked(db_index, database.key_encoded_map, database.key_encoded_map.bucket(key), database.bucket_epochs[3]);
+    }
+
+    // rds_mutex must be held by the caller; writes every bucket of database db_index not written yet
+    static void snapshot_database_unlocked(size_t db_index) {
+        for (size_t table_index = 0; table_index < SNAPSHOT_TABLES; table_index++) {
+            size_t bucket_count = databases[db_index].bucket_epochs[table_index].size();
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+                snapshot_table_bucket_unlocked(db_index, table_index, bucket);
+        }
+    }
+
+    static void snapshot_table_bucket_unlocked(size_t db_index, size_t table_index, size_t bucket) {
+        Database& database = databases[db_index];
+        if (table_index == 0)
+            snapshot_bucket_unlocked(db_index, database.key_value_map, bucket, database.bucket_epochs[0]);
+        else if (table_index == 1)
+            snapshot_bucket_unlocked(db_index, database.key_list_map, bucket, database.bucket_epochs[1]);
+        else if (table_index == 2)
+            snapshot_bucket_unlocked(db_index, database.key_stream_map, bucket, database.bucket_epochs[2]);
+        else
+            snapshot_bucket_unlocked(db_index, database.key_encoded_map, bucket, database.bucket_epochs[3]);
+    }
+
+    template <typename Map>
+    static void snapshot_bucket_unlocked(size_t db_index, const Map& map, size_t bucket, std::vector<uint64_t>& bucket_epochs) {
+        auto& snapshot = incremental_snapshot;
+        if (snapshot.is_failed)
+            return;
+        // checked before bucket_epochs is indexed : after a rehash, bucket may be past its end
+        if (map.bucket_count() != bucket_epochs.size() || bucket >= bucket_epochs.size()) {
+            DEBUG_LOG(utility::colourize("keyspace was rehashed during a forkless snapshot, dropping it", utility::cc::RED));
+            snapshot.is_failed = true;
+            return;
+        }
+        if (bucket_epochs[bucket] == snapshot.epoch)
+            return;
+        bucket_epochs[bucket] = snapshot.epoch;
+        for (auto it = map.begin(bucket); it != map.end(bucket); ++it) {
+            if (0 != select_snapshot_database_unlocked(db_index) || 0 != snapshot_entry_unlocked(db_index, it->first, it->second)) {
+                snapshot.is_failed = true;
+                return;
             }
         }
     }
 
+    // starts a database selector section in the file unless the writer is in the one of db_index already
+    static int select_snapshot_database_unlocked(size_t db_index) {
+        auto& snapshot = incremental_snapshot;
+        if (snapshot.writer_db_index == db_index)
+            return 0;
+        snapshot.writer_db_index = db_index;
+        const Database& database = databases[db_index];
+        return snapshot.writer->on_database(db_index, count_keys_unlocked(database), database.key_expiry_map.size());
+    }
+
+    static int snapshot_entry_unlocked(size_t db_index, const std::string& key, const std::string& value) {
+        return incremental_snapshot.writer->on_string(key, value, get_expiry_unlocked(db_index, key));
+    }
+
+    static int snapshot_entry_unlocked(size_t db_index, const std::string& key, const std::deque<std::string>& list) {
+        return incremental_snapshot.writer->on_list(key, list, get_expiry_unlocked(db_index, key));
+    }
+
+    static int snapshot_entry_unlocked(size_t db_index, const std::string& key, const RedisStream& stream) {
+        return incremental_snapshot.writer->on_stream(key, stream, get_expiry_unlocked(db_index, key));
+    }
+
+    static int snapshot_entry_unlocked(size_t db_index, const std::string& key, const EncodedValue& value) {
+        return incremental_snapshot.writer->on_encoded(key, value.value_type, value.payload, get_expiry_unlocked(db_index, key));
+    }
+
+    static uint64_t get_expiry_unlocked(size_t db_index, const std::string& key) {
+        const auto& key_expiry_map = databases[db_index].key_expiry_map;
+        auto it = key_expiry_map.find(key);
+        return (it == key_expiry_map.end()) ? UINT64_MAX : it->second;
+    }
+
+    std::string get_key_type_unlocked(const std::string& key) {
+        if (db().key_value_map.count(key) != 0)
+            return "string";
+        if (db().key_stream_map.count(key) != 0)
+            return "stream";
+        if (db().key_list_map.count(key) != 0)
+            return "list";
+        auto it = db().key_encoded_map.find(key);
+        if (it != db().key_encoded_map.end())
+            return getValueTypeName(it->second.value_type);
+        return "none";
+    }
+
+    // rds_mutex must be held by the caller; returns nullptr if key is missing (and not created) or holds another type
+    std::string* get_string_unlocked(const std::string& key, bool is_create, std::string& err_msg) {
+        auto it = db().key_value_map.find(key);
+        if (it != db().key_value_map.end())
+            return &(it->second);
+        if (get_key_type_unlocked(key) != "none") {
+            err_msg = WRONGTYPE_ERR;
+            return nullptr;
+        }
+        if (!is_create)
+            return nullptr;
+        return &(db().key_value_map[key]);
+    }
+
+    // rds_mutex must be held by the caller; like get_string_unlocked but also checks the value is a valid HLL
+    std::string* get_hll_unlocked(const std::string& key, bool is_create, std::string& err_msg) {
+        bool is_new_key = (db().key_value_map.count(key) == 0);
+        std::string* str = get_string_unlocked(key, is_create, err_msg);
+        if (str == nullptr)
+            return nullptr;
+        if (is_new_key) {
+            *str = hll::createEmpty();
+        }
+        else if (0 != hll::validate(*str)) {
+            err_msg = HLL_WRONGTYPE_ERR;
+            return nullptr;
+        }
+        return str;
+    }
+
+    // rds_mutex must be held by the caller; max-merges the registers of every existing key into merged
+    int merge_hll_unlocked(const std::vector<std::string>& keys, std::vector<uint8_t>& merged, std::string& err_msg) {
+        std::vector<uint8_t> raw(hll::REGISTERS);
+        for (auto& key : keys) {
+            const std::string* str = get_hll_unlocked(key, false, err_msg);
+            if (!err_msg.empty())
+                return -1;
+            if (str == nullptr)
+                continue;
+            hll::toRawRegisters(*str, raw.data());
+            hll::mergeMax(merged.data(), raw.data());
+        }
+        return 0;
+    }
+
+    // clamps [start, end] (negative values count from the end) to [0, total-1]; returns -1 if range is empty
+    static int normalize_range(int64_t total, int64_t& start, int64_t& end) {
+        if (start < 0) start += total;
+        if (end < 0) end += total;
+        if (start < 0) start = 0;
+        if (end < 0) end = 0;
+        if (end >= total) end = total - 1;
+        if (start > end || total == 0)
+            return -1;
+        return 0;
+    }
+
+    // rds_mutex must be held by the caller; returns nullptr if key is missing (and not created) or holds another type
+    RedisStream* get_stream_unlocked(const std::string& key, bool is_create, std::string& err_msg) {
+        auto it = db().key_stream_map.find(key);
+        if (it != db().key_stream_map.end())
+            return &(it->second);
+        if (get_key_type_unlocked(key) != "none") {
+            err_msg = WRONGTYPE_ERR;
+            return nullptr;
+        }
+        if (!is_create)
+            return nullptr;
+        return &(db().key_stream_map[key]);
+    }
+
+    // rds_mutex must be held by the caller; returns nullptr if key is missing (and not created) or holds another type
+    std::deque<std::string>* get_list_unlocked(const std::string& key, bool is_create, std::string& err_msg) {
+        auto it = db().key_list_map.find(key);
+        if (it != db().key_list_map.end())
+            return &(it->second);
+        if (get_key_type_unlocked(key) != "none") {
+            err_msg = WRONGTYPE_ERR;
+            return nullptr;
+        }
+        if (!is_create)
+            return nullptr;
+        return &(db().key_list_map[key]);
+    }
+
     int delete_pair_from_pq(const std::string& key) {
         std::vector<KEPair> temp;
         std::lock_guard<std::mutex> guard(rds_mutex);
-        while (!key_expiry_pq.empty()) {
-            auto top = key_expiry_pq.top();
-            key_expiry_pq.pop();
+        while (!db().key_expiry_pq.empty()) {
+            auto top = db().key_expiry_pq.top();
+            db().key_expiry_pq.pop();
             if (top.first != key) {
                 temp.push_back(top);
             }
@@ -160,7 +1230,7 @@ private:
             }
         }
         for(auto& p : temp) {
-            key_expiry_pq.push(p);
+            db().key_expiry_pq.push(p);
         }
         return 0;
     }
@@ -171,14 +1241,18 @@ private:
         return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
     }
 
-    static std::map<std::string, std::string> key_value_map;
-    // priority queue is meant to store only the keys with expiry so as to get the earliest expiring key
-    static std::priority_queue<KEPair, std::vector<KEPair>, ExpiryComparator> key_expiry_pq;
+    size_t db_index = 0;  // database selected by this object
+    static std::vector<Database> databases;
+    static std::vector<Database> staged_databases;  // filled by a replica's full resynchronization, see begin_staged_load()
+    static IncrementalSnapshot incremental_snapshot;
+    static std::vector<std::pair<size_t, std::string>> expired_keys;  // drained by take_expired_keys()
     static bool is_continue_monitoring; 
     static uint8_t rds_object_counter;
     static std::thread monitor_thread;
     static std::mutex rds_mutex;
     static uint64_t monitor_thread_sleep_duration;
+    static const std::string WRONGTYPE_ERR;
+    static const std::string HLL_WRONGTYPE_ERR;
     // static const uint16_t min_delay_ms;
     // static const uint16_t max_delay_ms;
 
@@ -188,13 +1262,17 @@ private:
     // static std::vector<std::thread> daemon_thread_pool;
 };
 
-std::map<std::string, std::string> RedisDataStore::key_value_map;
-std::priority_queue<KEPair, std::vector<KEPair>, ExpiryComparator> RedisDataStore::key_expiry_pq;
+std::vector<RedisDataStore::Database> RedisDataStore::databases(RedisDataStore::DEFAULT_DATABASES);
+std::vector<RedisDataStore::Database> RedisDataStore::staged_databases;
+RedisDataStore::IncrementalSnapshot RedisDataStore::incremental_snapshot;
+std::vector<std::pair<size_t, std::string>> RedisDataStore::expired_keys;
 bool RedisDataStore::is_continue_monitoring = false;
 uint8_t RedisDataStore::rds_object_counter;
 std::thread RedisDataStore::monitor_thread;
 std::mutex RedisDataStore::rds_mutex;
 uint64_t RedisDataStore::monitor_thread_sleep_duration = 1;  // max sleep duration allowed
+const std::string RedisDataStore::WRONGTYPE_ERR = "WRONGTYPE Operation against a key holding the wrong kind of value";
+const std::string RedisDataStore::HLL_WRONGTYPE_ERR = "WRONGTYPE Key is not a valid HyperLogLog string value.";
 // const uint16_t RedisDataStore::min_delay_ms = 10;  // lowest sleep duration allowed for monitor thread
 // const uint16_t RedisDataStore::max_delay_ms = 1000;  // max sleep duration allowed for monitor thread
 // std::map<std::string, uint64_t> RedisDataStore::key_expiry_map;
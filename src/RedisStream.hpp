@@ -0,0 +1,557 @@
+#ifndef REDISSTREAM_HPP
+#define REDISSTREAM_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <compare>
+#include <cstdint>
+#include <optional>
+#include "utility.hpp"
+
+/*
+  Stream entry ID : <milliseconds-time>-<sequence-number>, both unsigned 64 bit
+  IDs only ever grow inside a stream, so the last ID added is also the largest one.
+*/
+struct StreamID {
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    auto operator<=>(const StreamID&) const = default;
+
+    std::string to_string() const {
+        return std::to_string(ms) + "-" + std::to_string(seq);
+    }
+
+    static StreamID min() { return {0, 0}; }
+    static StreamID max() { return {UINT64_MAX, UINT64_MAX}; }
+
+    // returns false if it is the smallest / largest possible ID
+    bool decrement() {
+        if (seq > 0) { seq--; return true; }
+        if (ms > 0) { ms--; seq = UINT64_MAX; return true; }
+        return false;
+    }
+
+    bool increment() {
+        if (seq < UINT64_MAX) { seq++; return true; }
+        if (ms < UINT64_MAX) { ms++; seq = 0; return true; }
+        return false;
+    }
+
+    static int parse_number(const std::string& str, uint64_t& number) {
+        if (str.empty() || str.length() > 20)
+            return -1;
+        for (char c : str) {
+            if (c < '0' || c > '9')
+                return -1;
+        }
+        try {
+            number = std::stoull(str);
+        }
+        catch(...) {
+            return -1;
+        }
+        return 0;
+    }
+
+    /*
+      parses "<ms>-<seq>" or "<ms>", missing sequence number is replaced by missing_seq
+      ("-" and "+" are the smallest and largest ID, used by XRANGE / XREVRANGE)
+      returns 0 on success
+    */
+    static int parse(const std::string& str, StreamID& id, uint64_t missing_seq = 0) {
+        if (str == "-") { id = min(); return 0; }
+        if (str == "+") { id = max(); return 0; }
+        size_t dash_index = str.find('-');
+        if (dash_index == std::string::npos) {
+            id.seq = missing_seq;
+            return parse_number(str, id.ms);
+        }
+        if (0 != parse_number(str.substr(0, dash_index), id.ms))
+            return -1;
+        return parse_number(str.substr(dash_index + 1), id.seq);
+    }
+};
+
+struct StreamEntry {
+    StreamID id;
+    std::vector<std::string> fields_values;  // field1, value1, field2, value2, ...
+    bool is_deleted = false;  // entry was trimmed away (XREADGROUP history), or is marked deleted in its node (visit_nodes())
+};
+
+struct StreamPendingEntry {
+    std::string consumer_name;
+    uint64_t delivery_time_ms;
+    uint64_t delivery_count;
+};
+
+struct StreamConsumer {
+    uint64_t seen_time_ms = 0;
+    std::set<StreamID> pending_ids;  // ids delivered to this consumer and not acknowledged yet
+};
+
+struct StreamConsumerGroup {
+    StreamID last_delivered_id;
+    std::map<StreamID, StreamPendingEntry> pending_entries;  // PEL of the whole group
+    std::map<std::string, StreamConsumer> consumers;
+};
+
+struct StreamTrimSpec {
+    enum class Strategy : uint8_t { None, MaxLen, MinId };
+    Strategy strategy = Strategy::None;
+    bool is_approx = false;  // "~" lets trimming stop at node boundaries
+    uint64_t maxlen = 0;
+    StreamID minid;
+};
+
+/*
+  Stream storage :
+  entries are stored in nodes, every node is a single byte buffer (similar to a redis listpack)
+  holding up to node_max_entries entries. Nodes are indexed by the ID of their first (master) entry.
+  Inside a node every entry is delta encoded against the master entry :
+    <flags:1 byte> <varint ms delta> <varint seq or seq delta> [<varint num fields> <fields>] <values>
+  entries having the same field names as the master entry only store the values (flag SAME_FIELDS),
+  every string is stored as <varint length><bytes>.
+  Since IDs only grow, appends always go to the last node : amortized O(1) and range reads
+  are a lookup of the first node followed by a sequential decode.
+*/
+class RedisStream {
+public:
+    RedisStream() : length(0) {}
+
+    uint64_t size() const { return length; }
+    StreamID get_last_id() const { return last_id; }
+
+    // last_id stays above the last entry once entries were trimmed, a loaded stream restores it (never lowers it)
+    void set_last_id(const StreamID& id) { last_id = std::max(last_id, id); }
+
+    size_t get_node_count() const { return nodes.size(); }
+
+    const std::map<std::string, StreamConsumerGroup>& get_groups() const { return groups; }
+
+    /*
+      calls visitor(master_id, master_fields, entries) for every node in ID order, entries include the ones marked
+      deleted (StreamEntry::is_deleted); stops at the first visitor call not returning 0 and returns its status
+    */
+    template <typename NodeVisitor>
+    int visit_nodes(NodeVisitor&& visitor) const {
+        std::vector<StreamEntry> entries;
+        for (auto& [master_id, node] : nodes) {
+            entries.clear();
+            size_t offset = 0;
+            while (offset < node.entries.size()) {
+                StreamEntry entry;
+                entry.is_deleted = decode_entry(node, offset, entry);
+                entries.push_back(std::move(entry));
+            }
+            int status = visitor(master_id, node.master_fields, entries);
+            if (status != 0)
+                return status;
+        }
+        return 0;
+    }
+
+    // generates the ID to use for XADD from "*", "<ms>-*" or "<ms>-<seq>"; returns 0 on success
+    int generate_next_id(const std::string& id_spec, uint64_t now_ms, StreamID& id, std::string& err_msg) const {
+        if (id_spec == "*") {
+            id.ms = std::max(now_ms, last_id.ms);
+            id.seq = (id.ms == last_id.ms) ? last_id.seq + 1 : 0;
+            if (id.ms == last_id.ms && last_id.seq == UINT64_MAX) {
+                id.ms++;
+                id.seq = 0;
+            }
+        }
+        else if (id_spec.length() >= 2 && id_spec.substr(id_spec.length() - 2) == "-*") {
+            if (0 != StreamID::parse_number(id_spec.substr(0, id_spec.length() - 2), id.ms)) {
+                err_msg = "ERR Invalid stream ID specified as stream command argument";
+                return -1;
+            }
+            if (id.ms < last_id.ms) {
+                err_msg = "ERR The ID specified in XADD is equal or smaller than the target stream top item";
+                return -1;
+            }
+            if (id.ms == last_id.ms && last_id.seq == UINT64_MAX) {
+                err_msg = "ERR The ID specified in XADD is equal or smaller than the target stream top item";
+                return -1;
+            }
+            id.seq = (id.ms == last_id.ms) ? last_id.seq + 1 : 0;  // "0-*" on an empty stream gives 0-1
+        }
+        else {
+            if (0 != StreamID::parse(id_spec, id)) {
+                err_msg = "ERR Invalid stream ID specified as stream command argument";
+                return -1;
+            }
+            if (id == StreamID::min()) {
+                err_msg = "ERR The ID specified in XADD must be greater than 0-0";
+                return -1;
+            }
+            if (id <= last_id) {
+                err_msg = "ERR The ID specified in XADD is equal or smaller than the target stream top item";
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // id must be greater than get_last_id(), see generate_next_id()
+    int append(const StreamID& id, const std::vector<std::string>& fields_values) {
+        if (nodes.empty() || is_node_full(nodes.rbegin()->second)) {
+            StreamNode node;
+            node.master_id = id;
+            for (size_t i = 0; i < fields_values.size(); i += 2)
+                node.master_fields.push_back(fields_values[i]);
+            nodes.emplace_hint(nodes.end(), id, std::move(node));
+        }
+        StreamNode& node = nodes.rbegin()->second;
+        encode_entry(node, id, fields_values);
+        node.entry_count++;
+        length++;
+        last_id = id;
+        return 0;
+    }
+
+    // appends entries with start <= id <= end to result, at most count entries (0 means no limit)
+    int range(const StreamID& start, const StreamID& end, uint64_t count, bool is_reverse, std::vector<StreamEntry>& result) const {
+        if (nodes.empty() || start > end)
+            return 0;
+        if (!is_reverse) {
+            auto it = nodes.upper_bound(start);
+            if (it != nodes.begin())
+                --it;
+            for (; it != nodes.end() && it->first <= end; ++it) {
+                size_t offset = 0;
+                const StreamNode& node = it->second;
+                while (offset < node.entries.size()) {
+                    StreamEntry entry;
+                    bool is_deleted = decode_entry(node, offset, entry);
+                    if (entry.id > end)
+                        return 0;
+                    if (!is_deleted && entry.id >= start) {
+                        result.push_back(std::move(entry));
+                        if (count != 0 && result.size() >= count)
+                            return 0;
+                    }
+                }
+            }
+        }
+        else {
+            auto it = nodes.upper_bound(end);
+            while (it != nodes.begin()) {
+                --it;
+                const StreamNode& node = it->second;
+                std::vector<size_t> offsets;  // entries of a node are only decodable forward, so collect offsets first
+                offsets.reserve(node.entry_count);
+                size_t offset = 0;
+                while (offset < node.entries.size()) {
+                    offsets.push_back(offset);
+                    offset = skip_entry(node, offset);
+                }
+                for (auto rit = offsets.rbegin(); rit != offsets.rend(); ++rit) {
+                    StreamEntry entry;
+                    size_t entry_offset = *rit;
+                    bool is_deleted = decode_entry(node, entry_offset, entry);
+                    if (entry.id < start)
+                        return 0;
+                    if (!is_deleted && entry.id <= end) {
+                        result.push_back(std::move(entry));
+                        if (count != 0 && result.size() >= count)
+                            return 0;
+                    }
+                }
+                if (it->first < start)
+                    break;
+            }
+        }
+        return 0;
+    }
+
+    std::optional<StreamEntry> lookup(const StreamID& id) const {
+        std::vector<StreamEntry> result;
+        range(id, id, 1, false, result);
+        if (result.empty())
+            return std::nullopt;
+        return result[0];
+    }
+
+    // returns number of entries removed
+    uint64_t trim(const StreamTrimSpec& spec) {
+        uint64_t removed = 0;
+        while (!nodes.empty()) {
+            auto it = nodes.begin();
+            StreamNode& node = it->second;
+            uint64_t live_count = node.entry_count - node.deleted_count;
+
+            if (spec.strategy == StreamTrimSpec::Strategy::MaxLen) {
+                if (length <= spec.maxlen)
+                    break;
+                if (length - live_count >= spec.maxlen) {
+                    // drop the whole node without decoding it
+                    removed += live_count;
+                    length -= live_count;
+                    nodes.erase(it);
+                    continue;
+                }
+            }
+            else if (spec.strategy == StreamTrimSpec::Strategy::MinId) {
+                auto next_it = std::next(it);
+                if (next_it != nodes.end() && next_it->first <= spec.minid) {
+                    // every entry of this node is smaller than the next node's master id
+                    removed += live_count;
+                    length -= live_count;
+                    nodes.erase(it);
+                    continue;
+                }
+            }
+            else {
+                break;
+            }
+
+            if (spec.is_approx)
+                break;  // only whole nodes are removed with "~"
+
+            // mark entries of the first node as deleted one by one
+            size_t offset = 0;
+            bool is_done = false;
+            while (offset < node.entries.size()) {
+                StreamEntry entry;
+                size_t entry_offset = offset;
+                bool is_deleted = decode_entry(node, offset, entry);
+                if (is_deleted)
+                    continue;
+                if (spec.strategy == StreamTrimSpec::Strategy::MaxLen && length <= spec.maxlen) {
+                    is_done = true;
+                    break;
+                }
+                if (spec.strategy == StreamTrimSpec::Strategy::MinId && entry.id >= spec.minid) {
+                    is_done = true;
+                    break;
+                }
+                node.entries[entry_offset] |= FLAG_DELETED;
+                node.deleted_count++;
+                length--;
+                removed++;
+            }
+            if (node.deleted_count == node.entry_count)
+                nodes.erase(it);  // last_id is kept, so new IDs still grow after trimming everything
+            if (is_done)
+                break;
+        }
+        return removed;
+    }
+
+    StreamConsumerGroup* get_group(const std::string& group_name) {
+        auto it = groups.find(group_name);
+        if (it == groups.end())
+            return nullptr;
+        return &(it->second);
+    }
+
+    // returns 0 on success, -1 if group already exists
+    int create_group(const std::string& group_name, const StreamID& last_delivered_id) {
+        if (groups.count(group_name) != 0)
+            return -1;
+        groups[group_name].last_delivered_id = last_delivered_id;
+        return 0;
+    }
+
+    // returns 1 if group was destroyed else 0
+    int destroy_group(const std::string& group_name) {
+        return static_cast<int>(groups.erase(group_name));
+    }
+
+    /*
+      XREADGROUP : with id ">" new entries are delivered and added to the group PEL,
+      otherwise entries pending for consumer with ID > id are delivered again (history)
+    */
+    int read_group(StreamConsumerGroup& group, const std::string& consumer_name, bool is_new_entries,
+                   const StreamID& id, uint64_t count, bool is_noack, uint64_t now_ms, std::vector<StreamEntry>& result) {
+        StreamConsumer& consumer = group.consumers[consumer_name];
+        consumer.seen_time_ms = now_ms;
+        if (is_new_entries) {
+            StreamID start = group.last_delivered_id;
+            if (!start.increment())
+                return 0;
+            range(start, StreamID::max(), count, false, result);
+            for (auto& entry : result) {
+                group.last_delivered_id = entry.id;
+                if (is_noack)
+                    continue;
+                auto pel_it = group.pending_entries.find(entry.id);
+                if (pel_it != group.pending_entries.end()) {
+                    // entry was owned by another consumer, move it
+                    group.consumers[pel_it->second.consumer_name].pending_ids.erase(entry.id);
+                }
+                group.pending_entries[entry.id] = {consumer_name, now_ms, 1};
+                consumer.pending_ids.insert(entry.id);
+            }
+            return 0;
+        }
+
+        for (auto it = consumer.pending_ids.upper_bound(id); it != consumer.pending_ids.end(); ++it) {
+            if (count != 0 && result.size() >= count)
+                break;
+            auto entry = lookup(*it);
+            if (entry.has_value()) {
+                result.push_back(std::move(*entry));
+            }
+            else {
+                StreamEntry deleted_entry;
+                deleted_entry.id = *it;
+                deleted_entry.is_deleted = true;
+                result.push_back(std::move(deleted_entry));
+            }
+            auto& pending_entry = group.pending_entries[*it];
+            pending_entry.delivery_time_ms = now_ms;
+            pending_entry.delivery_count++;
+        }
+        return 0;
+    }
+
+    // returns number of ids removed from the group PEL
+    uint64_t ack(StreamConsumerGroup& group, const std::vector<StreamID>& ids) {
+        uint64_t acked = 0;
+        for (auto& id : ids) {
+            auto it = group.pending_entries.find(id);
+            if (it == group.pending_entries.end())
+                continue;
+            auto consumer_it = group.consumers.find(it->second.consumer_name);
+            if (consumer_it != group.consumers.end())
+                consumer_it->second.pending_ids.erase(id);
+            group.pending_entries.erase(it);
+            acked++;
+        }
+        return acked;
+    }
+
+private:
+    struct StreamNode {
+        StreamID master_id;
+        std::vector<std::string> master_fields;
+        std::string entries;  // delta encoded entries, see class comment
+        uint32_t entry_count = 0;  // including entries marked as deleted
+        uint32_t deleted_count = 0;
+    };
+
+    static const uint8_t FLAG_DELETED = 0x01;
+    static const uint8_t FLAG_SAME_FIELDS = 0x02;
+    static const uint32_t node_max_entries = 100;  // same as redis stream-node-max-entries
+    static const size_t node_max_bytes = 4096;  // same as redis stream-node-max-bytes
+
+    bool is_node_full(const StreamNode& node) const {
+        return node.entry_count >= node_max_entries || node.entries.size() >= node_max_bytes;
+    }
+
+    static void encode_varint(std::string& buf, uint64_t number) {
+        while (number >= 0x80) {
+            buf += static_cast<char>((number & 0x7F) | 0x80);
+            number >>= 7;
+        }
+        buf += static_cast<char>(number);
+    }
+
+    static uint64_t decode_varint(const std::string& buf, size_t& offset) {
+        uint64_t number = 0;
+        int shift = 0;
+        while (offset < buf.size()) {
+            uint8_t byte = static_cast<uint8_t>(buf[offset++]);
+            number |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                break;
+            shift += 7;
+        }
+        return number;
+    }
+
+    static void encode_string(std::string& buf, const std::string& str) {
+        encode_varint(buf, str.length());
+        buf.append(str);
+    }
+
+    static std::string decode_string(const std::string& buf, size_t& offset) {
+        uint64_t str_length = decode_varint(buf, offset);
+        std::string str = buf.substr(offset, str_length);
+        offset += str_length;
+        return str;
+    }
+
+    static void skip_string(const std::string& buf, size_t& offset) {
+        uint64_t str_length = decode_varint(buf, offset);
+        offset += str_length;
+    }
+
+    void encode_entry(StreamNode& node, const StreamID& id, const std::vector<std::string>& fields_values) {
+        size_t num_fields = fields_values.size() / 2;
+        bool is_same_fields = (num_fields == node.master_fields.size());
+        for (size_t i = 0; is_same_fields && i < num_fields; i++) {
+            is_same_fields = (fields_values[2 * i] == node.master_fields[i]);
+        }
+
+        uint64_t ms_delta = id.ms - node.master_id.ms;
+        node.entries += static_cast<char>(is_same_fields ? FLAG_SAME_FIELDS : 0);
+        encode_varint(node.entries, ms_delta);
+        encode_varint(node.entries, (ms_delta == 0) ? id.seq - node.master_id.seq : id.seq);
+        if (!is_same_fields) {
+            encode_varint(node.entries, num_fields);
+            for (size_t i = 0; i < num_fields; i++)
+                encode_string(node.entries, fields_values[2 * i]);
+        }
+        for (size_t i = 0; i < num_fields; i++)
+            encode_string(node.entries, fields_values[2 * i + 1]);
+    }
+
+    // decodes entry at offset and moves offset to the next entry; returns true if entry is marked deleted
+    bool decode_entry(const StreamNode& node, size_t& offset, StreamEntry& entry) const {
+        uint8_t flags = static_cast<uint8_t>(node.entries[offset++]);
+        uint64_t ms_delta = decode_varint(node.entries, offset);
+        uint64_t seq = decode_varint(node.entries, offset);
+        entry.id.ms = node.master_id.ms + ms_delta;
+        entry.id.seq = (ms_delta == 0) ? node.master_id.seq + seq : seq;
+
+        if (flags & FLAG_SAME_FIELDS) {
+            entry.fields_values.reserve(2 * node.master_fields.size());
+            for (auto& field : node.master_fields) {
+                entry.fields_values.push_back(field);
+                entry.fields_values.push_back(decode_string(node.entries, offset));
+            }
+        }
+        else {
+            uint64_t num_fields = decode_varint(node.entries, offset);
+            std::vector<std::string> fields;
+            fields.reserve(num_fields);
+            for (uint64_t i = 0; i < num_fields; i++)
+                fields.push_back(decode_string(node.entries, offset));
+            entry.fields_values.reserve(2 * num_fields);
+            for (uint64_t i = 0; i < num_fields; i++) {
+                entry.fields_values.push_back(std::move(fields[i]));
+                entry.fields_values.push_back(decode_string(node.entries, offset));
+            }
+        }
+        return (flags & FLAG_DELETED) != 0;
+    }
+
+    // returns offset of the entry after the one at offset
+    size_t skip_entry(const StreamNode& node, size_t offset) const {
+        uint8_t flags = static_cast<uint8_t>(node.entries[offset++]);
+        decode_varint(node.entries, offset);
+        decode_varint(node.entries, offset);
+        uint64_t num_fields = node.master_fields.size();
+        if (!(flags & FLAG_SAME_FIELDS)) {
+            num_fields = decode_varint(node.entries, offset);
+            for (uint64_t i = 0; i < num_fields; i++)
+                skip_string(node.entries, offset);
+        }
+        for (uint64_t i = 0; i < num_fields; i++)
+            skip_string(node.entries, offset);
+        return offset;
+    }
+
+    std::map<StreamID, StreamNode> nodes;  // node master id -> node
+    std::map<std::string, StreamConsumerGroup> groups;
+    uint64_t length;  // number of live entries
+    StreamID last_id;
+};
+
+#endif  // REDISSTREAM_HPP
@@ -0,0 +1,94 @@
+#ifndef REPLICATIONBACKLOG_HPP
+#define REPLICATIONBACKLOG_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/*
+  Fixed size ring buffer holding the tail of the replication stream, so a replica reconnecting after a short
+  outage gets only the bytes it missed (PSYNC <replid> <offset> answered with +CONTINUE) instead of a full resync.
+  Offsets follow PSYNC : the replication offset is the number of bytes ever fed to the stream, the first byte
+  being at offset 1. The backlog covers [get_first_byte_offset(), get_master_offset()].
+*/
+class ReplicationBacklog {
+public:
+    static const size_t DEFAULT_SIZE = 1024 * 1024;
+
+    explicit ReplicationBacklog(size_t size = DEFAULT_SIZE) : buffer(std::max<size_t>(size, 1)) {}
+
+    // drops the history, the offset is kept
+    void resize(size_t size) {
+        buffer.assign(std::max<size_t>(size, 1), '\0');
+        write_index = 0;
+        histlen = 0;
+    }
+
+    // drops the history and continues the stream from master_offset (eg : replica after a full resync)
+    void reset(uint64_t offset) {
+        write_index = 0;
+        histlen = 0;
+        master_offset = offset;
+    }
+
+    void feed(const char* data, size_t length) {
+        master_offset += length;
+        if (length >= buffer.size()) {
+            // only the last buffer.size() bytes can be kept
+            data += length - buffer.size();
+            length = buffer.size();
+        }
+        size_t first_part = std::min(length, buffer.size() - write_index);
+        memcpy(buffer.data() + write_index, data, first_part);
+        memcpy(buffer.data(), data + first_part, length - first_part);
+        write_index = (write_index + length) % buffer.size();
+        histlen = std::min(histlen + length, buffer.size());
+    }
+
+    void feed(const std::string& str) {
+        feed(str.data(), str.length());
+    }
+
+    uint64_t get_master_offset() const {
+        return master_offset;
+    }
+
+    uint64_t get_first_byte_offset() const {
+        return master_offset - histlen + 1;
+    }
+
+    size_t get_histlen() const {
+        return histlen;
+    }
+
+    size_t get_size() const {
+        return buffer.size();
+    }
+
+    // true if every byte from offset (next byte the replica expects) to the end of the stream is in the backlog
+    bool contains(uint64_t offset) const {
+        return offset >= get_first_byte_offset() && offset <= master_offset + 1;
+    }
+
+    // appends the bytes from offset to the end of the stream to out, returns -1 if they are not all in the backlog
+    int copy_from(uint64_t offset, std::string& out) const {
+        if (!contains(offset))
+            return -1;
+        size_t length = master_offset + 1 - offset;
+        size_t start_index = (write_index + buffer.size() - length) % buffer.size();
+        size_t first_part = std::min(length, buffer.size() - start_index);
+        out.append(buffer.data() + start_index, first_part);
+        out.append(buffer.data(), length - first_part);
+        return 0;
+    }
+
+private:
+    std::vector<char> buffer;
+    size_t write_index = 0;  // where the next byte goes
+    size_t histlen = 0;  // bytes of history in buffer
+    uint64_t master_offset = 0;
+};
+
+#endif  // REPLICATIONBACKLOG_HPP
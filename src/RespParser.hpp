@@ -5,6 +5,8 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 #include "utility.hpp"
 
 namespace resp {
@@ -129,6 +131,56 @@ namespace resp {
       return 0;
     }
 
+    static int parseCommandFrame(const char* data, size_t length, std::vector<std::string>& argv, size_t& frameLength) {
+      /*
+        incremental, binary safe parsing of one command (*<n>\r\n followed by n bulk strings) from the start of data
+        returns 1 and sets argv and frameLength (bytes taken by the command) if the command is complete,
+        0 if more bytes are needed, -1 if data does not conform to RESP
+      */
+      argv.clear();
+      frameLength = 0;
+      size_t index = 0;
+      auto parseHeader = [&](char typeChar, int64_t& number) -> int {
+        if (index >= length)
+          return 0;
+        if (data[index] != typeChar)
+          return -1;
+        const char* crlf = static_cast<const char*>(memmem(data + index, length - index, "\r\n", 2));
+        if (crlf == nullptr)
+          return (length - index > 32) ? -1 : 0;  // a header is a few digits long
+        if (0 != utility::parseInt64(std::string(data + index + 1, crlf), number) || number < 0)
+          return -1;
+        index = crlf + 2 - data;
+        return 1;
+      };
+
+      int64_t arrayLength = 0;
+      int status = parseHeader(static_cast<char>(RespType::Array), arrayLength);
+      if (status != 1)
+        return status;
+      argv.reserve(static_cast<size_t>(std::min<int64_t>(arrayLength, 1024)));
+      for (int64_t i = 0; i < arrayLength; i++) {
+        int64_t bulkLength = 0;
+        status = parseHeader(static_cast<char>(RespType::BulkString), bulkLength);
+        if (status != 1) {
+          argv.clear();
+          return status;
+        }
+        if (length - index < static_cast<uint64_t>(bulkLength) + 2) {
+          argv.clear();
+          return 0;
+        }
+        if (data[index + bulkLength] != '\r' || data[index + bulkLength + 1] != '\n') {
+          argv.clear();
+          return -1;
+        }
+        argv.emplace_back(data + index, bulkLength);
+        index += bulkLength + 2;
+      }
+      frameLength = index;
+      return 1;
+    }
+
     static std::string serialize(const std::vector<std::string>& vec, RespType respType) {
       if (respType == RespType::SimpleString) {
         return "+" + vec[0] + RespConstants::CRLF;
@@ -136,6 +188,9 @@ namespace resp {
       else if (respType == RespType::SimpleError) {
         return "-" + vec[0] + RespConstants::CRLF;
       }
+      else if (respType == RespType::Integer) {
+        return ":" + vec[0] + RespConstants::CRLF;
+      }
       else if (respType == RespType::BulkString) {
         return "$" + std::to_string(vec[0].length()) + RespConstants::CRLF + vec[0] + RespConstants::CRLF;
       }
@@ -153,7 +208,19 @@ namespace resp {
         return serialize({errMsg}, RespType::SimpleError);
       }
     }
-    
+
+    static std::string serializeNestedArray(const std::vector<std::string>& serializedElements) {
+      /*
+        elements are already RESP serialized (any RespType, even arrays)
+        this function only adds the array header, eg : XRANGE reply is an array of [id, [field, value, ...]]
+      */
+      std::string result = "*" + std::to_string(serializedElements.size()) + RespConstants::CRLF;
+      for (auto& element : serializedElements) {
+        result += element;
+      }
+      return result;
+    }
+
   private:
     bool isRespTypeCharOrEndOfRespBuffer() {
       /*
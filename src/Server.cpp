@@ -36,7 +36,6 @@ int main(int argc, char **argv) {
   const int timeout_ms = 1000;  // 0 means non blocking; if > 0 then poll() in pm::PollManager::pollSockets() will block for timeout_ms seconds
   // std::vector<struct pollfd> readySocketPollfdVec;  // to get list of sockets which are ready to readFrom or writeTo
   bool isSlaveServer = false;  // to track if current server running is replica or master
-  bool isHandShakeSuccessful = false;  // true if replica has done the handshake with the master else false
   bool isConnectedToMasterServer = false;  // true if replica and connected to master else false
   int serverListenerSocketFD = -1;  // if master server; to keep track of socket using which server is listening 
   int masterConnectorSocketFD = -1;  // if replica server; to keep track of socket using which replica is connected to master
@@ -45,6 +44,40 @@ int main(int argc, char **argv) {
   // parsing cmd line arguments
   process_cmdline_args(argc, argv, arg_parser);
 
+  RCC::RedisCommandCenter::setConfigKv("snapshot-mode", arg_parser.get<std::string>("--snapshot-mode"));
+  RCC::RedisCommandCenter::setConfigKv("appendonly", arg_parser.get<std::string>("--appendonly"));
+  RCC::RedisCommandCenter::setConfigKv("appendfilename", arg_parser.get<std::string>("--appendfilename"));
+  RCC::RedisCommandCenter::setConfigKv("appendfsync", arg_parser.get<std::string>("--appendfsync"));
+  RCC::RedisCommandCenter::setConfigKv("auto-aof-rewrite-percentage", arg_parser.get<std::string>("--auto-aof-rewrite-percentage"));
+  RCC::RedisCommandCenter::setConfigKv("auto-aof-rewrite-min-size", arg_parser.get<std::string>("--auto-aof-rewrite-min-size"));
+  const bool isAppendOnly = (arg_parser.get<std::string>("--appendonly") == "yes");
+  int64_t numDatabases = 0;
+  if (0 != utility::parseInt64(arg_parser.get<std::string>("--databases"), numDatabases) || numDatabases < 1 ||
+      0 != RedisDataStore::set_database_count(static_cast<size_t>(numDatabases))) {
+    DEBUG_LOG(utility::colourize("invalid --databases : " + arg_parser.get<std::string>("--databases"), utility::cc::RED));
+    std::exit(1);
+  }
+  RCC::RedisCommandCenter::setConfigKv("databases", arg_parser.get<std::string>("--databases"));
+  int64_t replBacklogSize = 0;
+  if (0 != utility::parseInt64(arg_parser.get<std::string>("--repl-backlog-size"), replBacklogSize) ||
+      0 != RCC::RedisCommandCenter::setReplicationBacklogSize(replBacklogSize)) {
+    DEBUG_LOG(utility::colourize("invalid --repl-backlog-size : " + arg_parser.get<std::string>("--repl-backlog-size"), utility::cc::RED));
+    std::exit(1);
+  }
+  RCC::RedisCommandCenter::setConfigKv("repl-backlog-size", arg_parser.get<std::string>("--repl-backlog-size"));
+  int64_t replDisklessSyncDelay = 0;
+  if (0 != utility::parseInt64(arg_parser.get<std::string>("--repl-diskless-sync-delay"), replDisklessSyncDelay) ||
+      0 != RCC::RedisCommandCenter::setReplDisklessSyncDelay(replDisklessSyncDelay)) {
+    DEBUG_LOG(utility::colourize("invalid --repl-diskless-sync-delay : " + arg_parser.get<std::string>("--repl-diskless-sync-delay"), utility::cc::RED));
+    std::exit(1);
+  }
+  RCC::RedisCommandCenter::setConfigKv("repl-diskless-sync-delay", arg_parser.get<std::string>("--repl-diskless-sync-delay"));
+  if (0 != RCC::RedisCommandCenter::setClientOutputBufferLimit(arg_parser.get<std::string>("--client-output-buffer-limit"))) {
+    DEBUG_LOG(utility::colourize("invalid --client-output-buffer-limit : " + arg_parser.get<std::string>("--client-output-buffer-limit"), utility::cc::RED));
+    std::exit(1);
+  }
+  RCC::RedisCommandCenter::setConfigKv("client-output-buffer-limit", arg_parser.get<std::string>("--client-output-buffer-limit"));
+
   // fetch listeningPortNumber from cmd line argument --port  
   std::string listeningPortNumber = arg_parser.get<std::string>("--port");
 
@@ -104,17 +137,28 @@ int main(int argc, char **argv) {
     isConnectedToMasterServer = false;
   }
 
+  if (auto dir = arg_parser.present("--dir")) {
+    RCC::RedisCommandCenter::setConfigKv("dir", *dir);
+  }
+  // with appendonly yes the append only file is the source of truth, the rdb file is only loaded if there is none yet
+  const bool isAppendOnlyFileLoaded = isAppendOnly && (0 == access(RCC::RedisCommandCenter::getAppendOnlyFilePath().c_str(), F_OK));
+  std::string loadFilename;  // dataset loaded in background, empty if none
+  if (isAppendOnlyFileLoaded) {
+    loadFilename = RCC::RedisCommandCenter::getAppendOnlyFilePath();
+  }
   if (auto dir = arg_parser.present("--dir")) {
     if (auto dbfilename = arg_parser.present("--dbfilename")) {
-      RCC::RedisCommandCenter::setConfigKv("dir", *dir);
       RCC::RedisCommandCenter::setConfigKv("dbfilename", *dbfilename);
-      RCC::RedisCommandCenter::read_rdb_file();
+      if (!isAppendOnlyFileLoaded)
+        loadFilename = RCC::RedisCommandCenter::getRdbFilePath();
     }
     else {
       // continue without reading RDB file, graceful handling
       DEBUG_LOG(utility::colourize("--dir flag not provided not read rdb file", utility::cc::YELLOW));
     }
   }
+  // the event loop serves PING / INFO (and answers -LOADING) while the dataset loads
+  rcc.startLoading(loadFilename, isAppendOnlyFileLoaded, isAppendOnly);
 
   uint64_t counter = 0;
   std::unordered_set<int> replicaSocketsSet;  // to keep track of replica sockets
@@ -122,22 +166,18 @@ int main(int argc, char **argv) {
 
   // infinite loop to poll sockets and listen form new connections and server connected sockets
   for(;;) {
-    if (isSlaveServer && !isConnectedToMasterServer) {
-      if (0 == rcc.connectToMasterServer(masterConnectorSocketFD, replicaof, pollManager)) {
-        isConnectedToMasterServer = true;
-        isHandShakeSuccessful = true;
-        DEBUG_LOG(utility::colourize("replica SUCCESSFULLY to connect to master server", utility::cc::GREEN));
-      }
-      else {
-        isConnectedToMasterServer = false;  
-        isHandShakeSuccessful = false;
-        masterConnectorSocketFD = -1;
+    if (isSlaveServer) {
+      // non blocking : starts a connection attempt when the reconnect backoff allows it, the handshake is driven by
+      // handleMasterLinkEvents() so clients are served while the master is unreachable
+      if (0 != rcc.connectToMasterServer(masterConnectorSocketFD, replicaof, pollManager)) {
         DEBUG_LOG(utility::colourize("replica failed to connect to master server", utility::cc::RED));
       }
+      isConnectedToMasterServer = (masterConnectorSocketFD != -1);
     }
 
     readySocketPollfdVec.clear();
-    if (0 != pollManager.pollSockets(timeout_ms, readySocketPollfdVec)) {
+    // poll() wakes up early if a client blocked by BLPOP / BRPOP / BLMOVE times out before timeout_ms
+    if (0 != pollManager.pollSockets(rcc.getPollTimeoutMs(timeout_ms), readySocketPollfdVec)) {
       DEBUG_LOG(utility::colourize("encountered error while polling", utility::cc::RED));
     }
 
@@ -164,16 +204,19 @@ int main(int argc, char **argv) {
         //   }
         // }
         if (isConnectedToMasterServer) {
-          // if handshake is successful and current server (replica) is connected to master
-          // listen to master (masterConnectorSocketFD) for commands
+          // completes the connect and the handshake, then listens to master (masterConnectorSocketFD) for commands
           // if (0 == receiveCommandsFromMaster(masterConnectorSocketFD, respParser, rcc, pollManager)) {
-          if (0 == rcc.receiveCommandsFromMaster(masterConnectorSocketFD, pollManager)) {
+          if (0 == rcc.handleMasterLinkEvents(masterConnectorSocketFD, pfd.revents, pollManager)) {
             std::string msg = utility::colourize("successfully received from master and updated state", utility::cc::GREEN);
             DEBUG_LOG(msg);
           }
           else {
             DEBUG_LOG(utility::colourize("No command to be read now from master", utility::cc::RED));
           }
+          if (masterConnectorSocketFD == -1) {
+            // master hung up, reconnect (and PSYNC from the offset processed so far) once the backoff allows it
+            isConnectedToMasterServer = false;
+          }
         }
       }
       else {
@@ -181,6 +224,12 @@ int main(int argc, char **argv) {
         // client can be any redis client or even a replica server
         // this block handles clients
         // pm::printPollFD(pfd);
+        if (pfd.revents & POLLOUT) {
+          // only polled for while the client has queued output (eg : published messages)
+          rcc.flushClientOutput(pfd.fd, pollManager);
+          if ((pfd.revents & ~POLLOUT) == 0)
+            continue;
+        }
         // if (clientHandler(pfd.fd, respParser, rcc, pollManager, replicaSocketsSet) != 0) {
         if (rcc.clientHandler(pfd.fd, pollManager) != 0) {
           ss.clear();
@@ -195,6 +244,17 @@ int main(int argc, char **argv) {
         }
       }
     }  // looping through all FDs which are ready to be read from or write to
+
+    rcc.handleBlockedClientsTimeout(pollManager);
+    rcc.propagateExpiredKeys();
+    rcc.flushAppendOnlyFile();
+    rcc.flushReplicationStream();
+    rcc.flushPendingWrites(pollManager);
+    rcc.checkBackgroundSave();
+    if (0 != rcc.checkLoading()) {
+      DEBUG_LOG(utility::colourize("refusing to start, failed to load or open the append only file", utility::cc::RED));
+      std::_Exit(1);  // without static destructors, the store's would wait for its expiry thread while holding its lock
+    }
   } // infinite for loop
 
   return 0;
@@ -312,10 +372,50 @@ int process_cmdline_args(int argc, char** argv, argparse::ArgumentParser& argume
     .default_value("6379");
     // .scan<'d', int>();
 
+  argument_parser.add_argument("--snapshot-mode")
+    .help("how BGSAVE snapshots the dataset : \"fork\" (copy-on-write child process) or \"forkless\" (incremental, in process)")
+    .default_value("fork");
+
+  argument_parser.add_argument("--appendonly")
+    .help("log every write command to an append only file (stored in --dir) and replay it on startup : \"yes\" or \"no\"")
+    .default_value("no");
+
+  argument_parser.add_argument("--appendfilename")
+    .help("append only filename which is stored in --dir")
+    .default_value("appendonly.aof");
+
+  argument_parser.add_argument("--appendfsync")
+    .help("when the append only file is fsync'ed : \"always\" (before replying), \"everysec\" (background thread) or \"no\" (left to the OS)")
+    .default_value("everysec");
+
+  argument_parser.add_argument("--auto-aof-rewrite-percentage")
+    .help("rewrite the append only file in background once it grew by this percentage since the last rewrite, 0 disables")
+    .default_value("100");
+
+  argument_parser.add_argument("--auto-aof-rewrite-min-size")
+    .help("size in bytes the append only file must reach before it is rewritten automatically")
+    .default_value("67108864");
+
+  argument_parser.add_argument("--databases")
+    .help("number of databases, selected with SELECT <index> (0 to databases-1)")
+    .default_value("16");
+
   argument_parser.add_argument("--replicaof")
     .help("this server is a slave of which server, mention \"<master_host> <master_port>\"")
     .default_value("NA");
 
+  argument_parser.add_argument("--repl-backlog-size")
+    .help("size in bytes of the replication backlog, replicas reconnecting within it only get the writes they missed")
+    .default_value("1048576");
+
+  argument_parser.add_argument("--repl-diskless-sync-delay")
+    .help("seconds a full resynchronization waits before its snapshot starts, replicas asking meanwhile share it")
+    .default_value("5");
+
+  argument_parser.add_argument("--client-output-buffer-limit")
+    .help("\"replica <hard limit bytes> <soft limit bytes> <soft limit seconds>\", a replica whose pending output reaches a limit is disconnected")
+    .default_value("replica 268435456 67108864 60");
+
   try {
     // DEBUG_LOG("in try block");
     argument_parser.parse_args(argc, argv);
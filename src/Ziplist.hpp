@@ -0,0 +1,92 @@
+#ifndef ZIPLIST_HPP
+#define ZIPLIST_HPP
+
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+/*
+  Ziplist, the compact sequence of RDB files written by redis before 7.0 (replaced by listpack), only decoded :
+  header (10 bytes) : total bytes (4) | offset of the last entry (4) | number of entries (2), little endian
+  entries           : previous entry length (1 byte, or 0xFE + 4 bytes) | encoding | data
+                      00pppppp / 01pppppp qqqqqqqq / 10000000 <4 bytes>  string of 6 / 14 / 32 bits length (big endian)
+                      11000000 / 11010000 / 11100000 / 11110000 / 11111110  int 16 / 32 / 64 / 24 / 8 bits (little endian)
+                      1111xxxx                                              int xxxx - 1 (0 to 12)
+  terminator        : 0xFF
+*/
+namespace ziplist {
+
+    const size_t HEADER_SIZE = 10;
+    const uint8_t END = 0xFF;
+
+    // calls on_element(std::string&&) for every entry, integers are converted to their decimal form;
+    // throws std::runtime_error if zl is not a valid ziplist
+    template <typename OnElement>
+    void decode(const std::string& zl, OnElement&& on_element) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(zl.data());
+        size_t size = zl.length();
+        auto require = [&](size_t pos, size_t count) {
+            if (pos + count > size)
+                throw std::runtime_error("corrupt ziplist");
+        };
+        auto read_signed = [&](size_t pos, int num_bytes) {
+            require(pos, num_bytes);
+            uint64_t raw = 0;
+            for (int i = 0; i < num_bytes; i++)
+                raw |= static_cast<uint64_t>(p[pos + i]) << (8 * i);
+            int shift = 64 - 8 * num_bytes;
+            return static_cast<int64_t>(raw << shift) >> shift;  // sign extension
+        };
+        require(0, HEADER_SIZE);
+        size_t pos = HEADER_SIZE;
+        for (;;) {
+            require(pos, 1);
+            if (p[pos] == END)
+                break;
+            pos += (p[pos] < 0xFE) ? 1 : 5;  // previous entry length
+            require(pos, 1);
+            uint8_t encoding = p[pos];
+            size_t length = 0;
+            if ((encoding >> 6) == 0) {
+                length = encoding & 0x3F;
+                pos += 1;
+            }
+            else if ((encoding >> 6) == 1) {
+                require(pos, 2);
+                length = (static_cast<size_t>(encoding & 0x3F) << 8) | p[pos + 1];
+                pos += 2;
+            }
+            else if (encoding == 0x80) {
+                require(pos, 5);
+                length = (static_cast<size_t>(p[pos + 1]) << 24) | (static_cast<size_t>(p[pos + 2]) << 16) |
+                         (static_cast<size_t>(p[pos + 3]) << 8) | p[pos + 4];
+                pos += 5;
+            }
+            else {
+                int num_bytes = 0;
+                switch (encoding) {
+                    case 0xC0: num_bytes = 2; break;
+                    case 0xD0: num_bytes = 4; break;
+                    case 0xE0: num_bytes = 8; break;
+                    case 0xF0: num_bytes = 3; break;
+                    case 0xFE: num_bytes = 1; break;
+                    default:
+                        if (encoding < 0xF1 || encoding > 0xFD)
+                            throw std::runtime_error("corrupt ziplist");
+                        on_element(std::to_string((encoding & 0x0F) - 1));
+                        pos += 1;
+                        continue;
+                }
+                on_element(std::to_string(read_signed(pos + 1, num_bytes)));
+                pos += 1 + num_bytes;
+                continue;
+            }
+            require(pos, length);
+            on_element(std::string(reinterpret_cast<const char*>(p + pos), length));
+            pos += length;
+        }
+    }
+
+};  // namespace ziplist
+
+#endif  // ZIPLIST_HPP
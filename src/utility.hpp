@@ -5,6 +5,12 @@
 #include <chrono>
 #include <ctime>
 #include <regex>
+#include <iomanip>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/socket.h>
 
 
@@ -73,6 +79,84 @@ namespace utility {
         return str1_lower.compare(str2_lower) == 0;
     }
 
+    int parseInt64(const std::string& str, int64_t& number) {
+        // returns 0 if whole str is a valid base 10 signed 64 bit integer
+        const char* first = str.data();
+        const char* last = str.data() + str.length();
+        if (first != last && *first == '+')
+            first++;
+        auto [ptr, ec] = std::from_chars(first, last, number);
+        if (str.empty() || ec != std::errc() || ptr != last)
+            return -1;
+        return 0;
+    }
+
+    bool _globMatchSingle(const std::string& pattern, size_t& p, char ch) {
+        // matches one pattern token (?, [...], \x or a literal) at p against ch, moves p past the token on success
+        if (pattern[p] == '?') {
+            p++;
+            return true;
+        }
+        if (pattern[p] == '[') {
+            size_t i = p + 1;
+            bool isNegated = (i < pattern.length() && pattern[i] == '^');
+            if (isNegated)
+                i++;
+            bool isMatched = false;
+            while (i < pattern.length() && pattern[i] != ']') {
+                if (pattern[i] == '\\' && i + 1 < pattern.length()) {
+                    isMatched |= (pattern[i + 1] == ch);
+                    i += 2;
+                }
+                else if (i + 2 < pattern.length() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    char low = std::min(pattern[i], pattern[i + 2]);
+                    char high = std::max(pattern[i], pattern[i + 2]);
+                    isMatched |= (ch >= low && ch <= high);
+                    i += 3;
+                }
+                else {
+                    isMatched |= (pattern[i] == ch);
+                    i++;
+                }
+            }
+            if (isMatched == isNegated)
+                return false;
+            p = (i < pattern.length()) ? i + 1 : i;  // skip ']'
+            return true;
+        }
+        size_t literal = (pattern[p] == '\\' && p + 1 < pattern.length()) ? p + 1 : p;
+        if (pattern[literal] != ch)
+            return false;
+        p = literal + 1;
+        return true;
+    }
+
+    bool globMatch(const std::string& pattern, const std::string& str) {
+        // redis style glob : * ? [abc] [^abc] [a-z] and \ to escape, backtracks only to the last *
+        size_t p = 0, s = 0;
+        size_t starP = std::string::npos, starS = 0;
+        while (s < str.length()) {
+            if (p < pattern.length()) {
+                if (pattern[p] == '*') {
+                    starP = p++;
+                    starS = s;
+                    continue;
+                }
+                if (_globMatchSingle(pattern, p, str[s])) {
+                    s++;
+                    continue;
+                }
+            }
+            if (starP == std::string::npos)
+                return false;
+            p = starP + 1;
+            s = ++starS;
+        }
+        while (p < pattern.length() && pattern[p] == '*')
+            p++;
+        return p == pattern.length();
+    }
+
     uint8_t convertHexCharToByte(char hexChar4bits) {
         uint8_t byte = 0;
         if (hexChar4bits >= '0' && hexChar4bits <= '9') {